@@ -0,0 +1,485 @@
+#include "asyncread.hpp"
+#include "batch.hpp"
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+ReadPool::ReadPool(uint32_t numSlots, uint32_t slotSize)
+    : m_numSlots(numSlots), m_slotSize(slotSize)
+{
+    // Page aligned, which registered buffers and O_DIRECT both like.
+    const size_t ALIGN = 4096;
+    m_allocation = ::operator new(bytes() + ALIGN);
+    m_base = (uint8_t*)(((uintptr_t)m_allocation + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1));
+    m_free.reserve(numSlots);
+    for (uint32_t i = numSlots; i > 0; --i)
+        m_free.push_back(m_base + (size_t)(i - 1) * slotSize);
+}
+
+ReadPool::~ReadPool()
+{
+    ::operator delete(m_allocation);
+}
+
+uint8_t* ReadPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_free.empty())
+        return nullptr;
+    uint8_t* buffer = m_free.back();
+    m_free.pop_back();
+    return buffer;
+}
+
+void ReadPool::release(uint8_t* buffer)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(buffer);
+}
+
+static const char* READER_NAMES[] = { "sync", "pread", "io_uring" };
+
+const char* readerName(ReaderKind kind)
+{
+    return READER_NAMES[(uint32_t)kind];
+}
+
+bool readerFromName(const std::string& name, ReaderKind& kind)
+{
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        if (name == READER_NAMES[i] || (i == (uint32_t)ReaderKind::Uring && name == "uring"))
+        {
+            kind = (ReaderKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static ReaderKind readSync(const std::vector<std::string>& files, const std::vector<uint32_t>& order, const AdmitFile& admit,
+    const std::function<void(std::unique_ptr<FileJob>)>& deliver)
+{
+    for (uint32_t i : order)
+    {
+        std::unique_ptr<FileJob> job(new FileJob(files[i], (int32_t)i));
+        if (admit)
+            admit(*job, true);
+        if (readJob(*job))
+            deliver(std::move(job));
+    }
+    return ReaderKind::Sync;
+}
+
+#ifndef _WIN32
+// Buffer for a file of size bytes: a pool slot when it fits and one is
+// free, otherwise the heap.
+static InputBuffer inputBuffer(ReadPool& pool, size_t size)
+{
+    if (size <= pool.slotSize())
+    {
+        uint8_t* slot = pool.acquire();
+        if (slot)
+            return InputBuffer(slot, InputBufferDeleter{ &pool });
+    }
+    return InputBuffer(new uint8_t[size > 0 ? size : 1]);
+}
+
+// Opens both files of job and sizes its buffers. Reports the first file that
+// can't be opened, like readJob.
+static bool openJob(FileJob& job, ReadPool& pool, int fds[2])
+{
+    const std::string* names[2] = { &job.file, &job.material };
+    int sizes[2] = {};
+    fds[0] = fds[1] = -1;
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        struct stat st;
+        fds[i] = open(names[i]->c_str(), O_RDONLY | O_CLOEXEC);
+        if (fds[i] < 0 || fstat(fds[i], &st) != 0 || st.st_size > 0x7FFFFFFF)
+        {
+            printf("Could not read %s\n", names[i]->c_str());
+            for (uint32_t j = 0; j <= i; ++j)
+            {
+                if (fds[j] >= 0)
+                    close(fds[j]);
+            }
+            return false;
+        }
+        sizes[i] = (int)st.st_size;
+    }
+
+    job.geomSize = sizes[0];
+    job.matSize = sizes[1];
+    job.geomData = inputBuffer(pool, job.geomSize);
+    job.matData = inputBuffer(pool, job.matSize);
+    return true;
+}
+
+static bool preadAll(int fd, uint8_t* buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = pread(fd, buffer + done, size - done, (off_t)done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+
+static ReaderKind readPread(const std::vector<std::string>& files, const std::vector<uint32_t>& order, ReadPool& pool, const AdmitFile& admit,
+    const std::function<void(std::unique_ptr<FileJob>)>& deliver)
+{
+    for (uint32_t i : order)
+    {
+        std::unique_ptr<FileJob> job(new FileJob(files[i], (int32_t)i));
+        if (admit)
+            admit(*job, true);
+        bool ok;
+        {
+            FileScope fileScope(job->index);
+            StageScope scope(Stage::Read);
+            int fds[2];
+            if (!openJob(*job, pool, fds))
+                continue;
+            ok = preadAll(fds[0], job->geomData.get(), job->geomSize) && preadAll(fds[1], job->matData.get(), job->matSize);
+            close(fds[0]);
+            close(fds[1]);
+            scope.setItems((uint64_t)job->geomSize + job->matSize);
+        }
+        if (!ok)
+        {
+            printf("Could not read %s\n", job->file.c_str());
+            continue;
+        }
+        deliver(std::move(job));
+    }
+    return ReaderKind::Pread;
+}
+#endif
+
+#ifdef __linux__
+// Minimal io_uring over the raw syscalls, so there is no liburing dependency.
+struct Uring
+{
+    int fd = -1;
+    unsigned entries = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+
+    unsigned pending = 0; // queued but not yet submitted
+    bool fixedBuffers = false;
+
+    bool init(unsigned numEntries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, numEntries, &p);
+        if (fd < 0)
+            return false;
+        entries = p.sq_entries;
+
+        sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMmap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+            return false;
+        cqRing = singleMmap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED)
+            return false;
+        sqes = (io_uring_sqe*)sqeMap;
+
+        uint8_t* sq = (uint8_t*)sqRing;
+        sqHead = (unsigned*)(sq + p.sq_off.head);
+        sqTail = (unsigned*)(sq + p.sq_off.tail);
+        sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + p.sq_off.array);
+        uint8_t* cq = (uint8_t*)cqRing;
+        cqHead = (unsigned*)(cq + p.cq_off.head);
+        cqTail = (unsigned*)(cq + p.cq_off.tail);
+        cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    ~Uring()
+    {
+        if (sqes)
+            munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Registers the pool so reads into it skip the per-I/O page pinning.
+    // Fails harmlessly when RLIMIT_MEMLOCK is too low.
+    void registerBuffers(ReadPool& pool)
+    {
+        iovec iov;
+        iov.iov_base = pool.base();
+        iov.iov_len = pool.bytes();
+        fixedBuffers = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    }
+
+    void queueRead(int file, uint8_t* buffer, uint32_t length, uint64_t offset, bool fixed, uint64_t userData)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = file;
+        sqe->off = offset;
+        sqe->addr = (uint64_t)(uintptr_t)buffer;
+        sqe->len = length;
+        sqe->buf_index = 0;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++pending;
+    }
+
+    // Submits everything queued and waits for at least one completion.
+    bool submitAndWait()
+    {
+        for (;;)
+        {
+            int r = (int)syscall(__NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r >= 0)
+            {
+                pending -= std::min<unsigned>(pending, (unsigned)r);
+                return true;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return false;
+        }
+    }
+
+    template <typename F>
+    void reap(F onCompletion)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            onCompletion(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+static ReaderKind readUring(const std::vector<std::string>& files, const std::vector<uint32_t>& order, uint32_t filesInFlight, ReadPool& pool,
+    const AdmitFile& admit, const std::function<void(std::unique_ptr<FileJob>)>& deliver)
+{
+    filesInFlight = std::max(filesInFlight, 1u);
+    Uring ring;
+    if (!ring.init(filesInFlight * 2))
+    {
+        static bool reported = false;
+        if (!reported)
+            printf("io_uring unavailable (%s), reading with pread\n", strerror(errno));
+        reported = true;
+        return readPread(files, order, pool, admit, deliver);
+    }
+    ring.registerBuffers(pool);
+
+    struct PendingRead
+    {
+        int fd;
+        uint8_t* buffer;
+        uint32_t size;
+        uint32_t done;
+        bool fixed;
+    };
+
+    struct InFlight
+    {
+        std::unique_ptr<FileJob> job;
+        int fds[2];
+        PendingRead reads[2];
+        uint32_t outstanding;
+        bool failed;
+    };
+
+    std::vector<InFlight> slots(filesInFlight);
+    std::vector<uint32_t> freeSlots;
+    for (uint32_t i = filesInFlight; i > 0; --i)
+        freeSlots.push_back(i - 1);
+
+    // user_data is slot * 2 + file, 0 for the geom, 1 for the mat.
+    auto queue = [&](uint32_t slot, uint32_t which)
+    {
+        PendingRead& r = slots[slot].reads[which];
+        ring.queueRead(r.fd, r.buffer + r.done, r.size - r.done, r.done, r.fixed, slot * 2 + which);
+    };
+
+    auto finish = [&](uint32_t slot)
+    {
+        InFlight& f = slots[slot];
+        close(f.fds[0]);
+        close(f.fds[1]);
+        if (f.failed)
+            printf("Could not read %s\n", f.job->file.c_str());
+        else
+            deliver(std::move(f.job));
+        f.job.reset();
+        freeSlots.push_back(slot);
+    };
+
+    size_t next = 0;
+    std::unique_ptr<FileJob> heldBack;
+    while (next < order.size() || heldBack || freeSlots.size() < filesInFlight)
+    {
+        while ((next < order.size() || heldBack) && !freeSlots.empty())
+        {
+            std::unique_ptr<FileJob> job = std::move(heldBack);
+            if (!job)
+            {
+                uint32_t i = order[next++];
+                job.reset(new FileJob(files[i], (int32_t)i));
+            }
+            // Only wait for admission when nothing is in flight that could
+            // free what it is waiting for.
+            if (admit && !admit(*job, freeSlots.size() == filesInFlight))
+            {
+                heldBack = std::move(job);
+                break;
+            }
+            int fds[2];
+            if (!openJob(*job, pool, fds))
+                continue;
+
+            uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            InFlight& f = slots[slot];
+            f.fds[0] = fds[0];
+            f.fds[1] = fds[1];
+            f.failed = false;
+            f.outstanding = 0;
+            uint8_t* buffers[2] = { job->geomData.get(), job->matData.get() };
+            int sizes[2] = { job->geomSize, job->matSize };
+            f.job = std::move(job);
+            for (uint32_t i = 0; i < 2; ++i)
+            {
+                f.reads[i] = { fds[i], buffers[i], (uint32_t)sizes[i], 0, ring.fixedBuffers && pool.owns(buffers[i]) };
+                if (sizes[i] > 0)
+                {
+                    queue(slot, i);
+                    ++f.outstanding;
+                }
+            }
+            if (f.outstanding == 0)
+                finish(slot);
+        }
+
+        if (freeSlots.size() == filesInFlight)
+            continue;
+
+        StageScope scope(Stage::Read);
+        uint64_t bytes = 0;
+        if (!ring.submitAndWait())
+        {
+            printf("io_uring_enter failed (%s)\n", strerror(errno));
+            break;
+        }
+        ring.reap([&](uint64_t userData, int32_t res)
+        {
+            uint32_t slot = (uint32_t)(userData / 2);
+            uint32_t which = (uint32_t)(userData % 2);
+            InFlight& f = slots[slot];
+            PendingRead& r = f.reads[which];
+            if (res > 0)
+            {
+                r.done += (uint32_t)res;
+                bytes += (uint64_t)res;
+                if (r.done < r.size)
+                {
+                    // Short read, ask for the rest.
+                    queue(slot, which);
+                    return;
+                }
+            }
+            else
+            {
+                f.failed = true;
+            }
+            if (--f.outstanding == 0)
+                finish(slot);
+        });
+        scope.setItems(bytes);
+    }
+
+    // Only reached early when io_uring_enter itself failed; let the kernel
+    // finish with the buffers before they go back to the pool.
+    for (InFlight& f : slots)
+    {
+        if (f.job)
+        {
+            close(f.fds[0]);
+            close(f.fds[1]);
+            f.job->geomData.release();
+            f.job->matData.release();
+        }
+    }
+    return ReaderKind::Uring;
+}
+#endif
+
+ReaderKind readFiles(const std::vector<std::string>& files, const std::vector<uint32_t>& order, ReaderKind kind, uint32_t filesInFlight, ReadPool& pool,
+    const AdmitFile& admit, const std::function<void(std::unique_ptr<FileJob>)>& deliver)
+{
+#ifdef __linux__
+    if (kind == ReaderKind::Uring)
+        return readUring(files, order, filesInFlight, pool, admit, deliver);
+#endif
+#ifndef _WIN32
+    if (kind != ReaderKind::Sync)
+        return readPread(files, order, pool, admit, deliver);
+#endif
+    return readSync(files, order, admit, deliver);
+}
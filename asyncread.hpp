@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct FileJob;
+
+// Equally sized input buffers carved from one allocation and handed out
+// again once a file has been decoded, so a batch run doesn't allocate per
+// input. With io_uring the whole block is registered with the kernel.
+struct ReadPool
+{
+    ReadPool(uint32_t numSlots, uint32_t slotSize);
+    ~ReadPool();
+
+    // nullptr when every slot is in use
+    uint8_t* acquire();
+    void release(uint8_t* buffer);
+
+    bool owns(const uint8_t* buffer) const
+    {
+        return buffer >= m_base && buffer < m_base + (size_t)m_numSlots * m_slotSize;
+    }
+
+    uint32_t slotSize() const
+    {
+        return m_slotSize;
+    }
+
+    uint8_t* base() const
+    {
+        return m_base;
+    }
+
+    size_t bytes() const
+    {
+        return (size_t)m_numSlots * m_slotSize;
+    }
+
+private:
+    void* m_allocation;
+    uint8_t* m_base;
+    uint32_t m_numSlots;
+    uint32_t m_slotSize;
+    std::mutex m_mutex;
+    std::vector<uint8_t*> m_free;
+};
+
+enum class ReaderKind : uint8_t
+{
+    Sync,  // readfile() per file, on whichever thread converts it
+    Pread, // one reader thread, pread into pool buffers
+    Uring  // one reader thread keeping many io_uring reads in flight
+};
+
+const char* readerName(ReaderKind kind);
+bool readerFromName(const std::string& name, ReaderKind& kind);
+
+// Asked before a file is opened, e.g. to reserve memory for it. With wait
+// false it may return false to hold the file back until reads in flight
+// have completed; with wait true it has to admit the file eventually.
+typedef std::function<bool(FileJob& job, bool wait)> AdmitFile;
+
+// Reads the .geom.edge/.mat.edge pair of files[order[0]], files[order[1]]...
+// with up to filesInFlight pairs outstanding, and calls deliver on the calling thread
+// for each pair that was read completely. Missing or unreadable files are
+// reported like readJob does and skipped. Falls back to pread when io_uring
+// can't be set up. admit may be empty. Returns the reader that actually ran.
+ReaderKind readFiles(const std::vector<std::string>& files, const std::vector<uint32_t>& order, ReaderKind kind, uint32_t filesInFlight, ReadPool& pool,
+    const AdmitFile& admit, const std::function<void(std::unique_ptr<FileJob>)>& deliver);
@@ -0,0 +1,249 @@
+#include "attributes.hpp"
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static const char* FORMAT_NAMES[NUM_ATTRIBUTE_FORMATS] = { "f32", "f16", "i16n", "i16", "u8n", "u8", "x11y11z10n", "fixed", "edge_normal" };
+
+const char* attributeFormatName(AttributeFormat format)
+{
+    return (uint32_t)format < NUM_ATTRIBUTE_FORMATS ? FORMAT_NAMES[(uint32_t)format] : "unknown";
+}
+
+uint32_t attributeBytes(const AttributeStream& stream)
+{
+    switch (stream.format)
+    {
+    case AttributeFormat::F32: return stream.components * 4u;
+    case AttributeFormat::F16:
+    case AttributeFormat::I16N:
+    case AttributeFormat::I16: return stream.components * 2u;
+    case AttributeFormat::U8N:
+    case AttributeFormat::U8: return stream.components;
+    case AttributeFormat::X11Y11Z10N: return 4;
+    case AttributeFormat::EdgeNormal: return 3;
+    case AttributeFormat::FixedPoint:
+    {
+        uint32_t bits = 0;
+        for (uint32_t c = 0; c < stream.components && c < 4; ++c)
+            bits += stream.integerBits[c] + stream.fractionBits[c];
+        return (bits + 7) / 8;
+    }
+    default: return 0;
+    }
+}
+
+bool attributeStreamValid(const AttributeStream& stream)
+{
+    if ((uint32_t)stream.format >= NUM_ATTRIBUTE_FORMATS || stream.components < 1 || stream.components > 4)
+        return false;
+    if ((stream.format == AttributeFormat::X11Y11Z10N || stream.format == AttributeFormat::EdgeNormal) && stream.components != 3)
+        return false;
+    if (stream.format == AttributeFormat::FixedPoint)
+    {
+        for (uint32_t c = 0; c < stream.components; ++c)
+        {
+            uint32_t bits = stream.integerBits[c] + stream.fractionBits[c];
+            if (bits == 0 || bits > 32)
+                return false;
+        }
+    }
+    return stream.offset + attributeBytes(stream) <= stream.stride;
+}
+
+uint64_t attributeSpan(const AttributeStream& stream, uint64_t count)
+{
+    return count == 0 ? 0 : (count - 1) * stream.stride + stream.offset + attributeBytes(stream);
+}
+
+static inline uint32_t load16(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t load32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline float snorm(int32_t value, uint32_t bits)
+{
+    float scale = 1.0f / (float)((1u << (bits - 1)) - 1);
+    return std::max(value * scale, -1.0f);
+}
+
+// Tightly packed float and half streams: one call to the SIMD kernel.
+template <uint32_t N>
+static void decodePackedF32(const uint8_t* src, const AttributeStream&, size_t count, float* dst)
+{
+    g_kernels.swapFloats(src, dst, count * N);
+}
+
+template <uint32_t N>
+static void decodePackedF16(const uint8_t* src, const AttributeStream&, size_t count, float* dst)
+{
+    g_kernels.halfToFloat(src, dst, count * N);
+}
+
+// Strided float and half streams are gathered a chunk at a time, so the
+// conversion still runs through the SIMD kernels.
+template <uint32_t N, uint32_t SIZE>
+static void decodeStridedFloats(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    const size_t CHUNK = 256;
+    uint8_t packed[CHUNK * N * SIZE];
+    src += stream.offset;
+    for (size_t begin = 0; begin < count; begin += CHUNK)
+    {
+        size_t n = std::min(CHUNK, count - begin);
+        for (size_t v = 0; v < n; ++v)
+            memcpy(packed + v * N * SIZE, src + (begin + v) * stream.stride, N * SIZE);
+        if (SIZE == 4)
+            g_kernels.swapFloats(packed, dst + begin * N, n * N);
+        else
+            g_kernels.halfToFloat(packed, dst + begin * N, n * N);
+    }
+}
+
+template <uint32_t N>
+static void decodeI16N(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        for (uint32_t c = 0; c < N; ++c)
+            *dst++ = snorm((int16_t)load16(src + c * 2), 16);
+    }
+}
+
+template <uint32_t N>
+static void decodeI16(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        for (uint32_t c = 0; c < N; ++c)
+            *dst++ = (float)(int16_t)load16(src + c * 2);
+    }
+}
+
+template <uint32_t N>
+static void decodeU8N(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    const float scale = 1.0f / 255.0f;
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        for (uint32_t c = 0; c < N; ++c)
+            *dst++ = src[c] * scale;
+    }
+}
+
+template <uint32_t N>
+static void decodeU8(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        for (uint32_t c = 0; c < N; ++c)
+            *dst++ = (float)src[c];
+    }
+}
+
+static void decodeX11Y11Z10N(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        uint32_t word = load32(src);
+        // Shift each field to the top of the word, then back down signed.
+        *dst++ = snorm((int32_t)(word << 21) >> 21, 11);
+        *dst++ = snorm((int32_t)(word << 10) >> 21, 11);
+        *dst++ = snorm((int32_t)word >> 22, 10);
+    }
+}
+
+template <uint32_t N>
+static void decodeFixedPoint(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    uint32_t bits[N];
+    float scale[N];
+    for (uint32_t c = 0; c < N; ++c)
+    {
+        bits[c] = stream.integerBits[c] + stream.fractionBits[c];
+        scale[c] = 1.0f / (float)(1ull << stream.fractionBits[c]);
+    }
+    src += stream.offset;
+    for (size_t v = 0; v < count; ++v, src += stream.stride)
+    {
+        uint32_t bit = 0;
+        for (uint32_t c = 0; c < N; ++c)
+        {
+            uint64_t raw = 0;
+            for (uint32_t b = 0; b < bits[c]; ++b, ++bit)
+                raw = (raw << 1) | ((src[bit / 8] >> (7 - bit % 8)) & 1);
+            int64_t value = (int64_t)(raw << (64 - bits[c])) >> (64 - bits[c]);
+            *dst++ = value * scale[c];
+        }
+    }
+}
+
+// decodeNormals writes separate x/y/z arrays; interleaved a chunk at a time.
+static void decodeEdgeNormals(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    const size_t CHUNK = 256;
+    float x[CHUNK], y[CHUNK], z[CHUNK];
+    uint8_t packed[CHUNK * 6];
+    src += stream.offset;
+    for (size_t begin = 0; begin < count; begin += CHUNK)
+    {
+        size_t n = std::min(CHUNK, count - begin);
+        const uint8_t* normals = src + begin * stream.stride;
+        if (stream.stride != 6)
+        {
+            for (size_t v = 0; v < n; ++v)
+                memcpy(packed + v * 6, src + (begin + v) * stream.stride, 3);
+            normals = packed;
+        }
+        g_kernels.decodeNormals(normals, n, x, y, z);
+        for (size_t v = 0; v < n; ++v)
+        {
+            float* out = dst + (begin + v) * 3;
+            out[0] = x[v];
+            out[1] = y[v];
+            out[2] = z[v];
+        }
+    }
+}
+
+template <uint32_t N>
+static AttributeKernel kernelFor(const AttributeStream& stream)
+{
+    bool packed = stream.offset == 0 && stream.stride == attributeBytes(stream);
+    switch (stream.format)
+    {
+    case AttributeFormat::F32: return packed ? decodePackedF32<N> : decodeStridedFloats<N, 4>;
+    case AttributeFormat::F16: return packed ? decodePackedF16<N> : decodeStridedFloats<N, 2>;
+    case AttributeFormat::I16N: return decodeI16N<N>;
+    case AttributeFormat::I16: return decodeI16<N>;
+    case AttributeFormat::U8N: return decodeU8N<N>;
+    case AttributeFormat::U8: return decodeU8<N>;
+    case AttributeFormat::FixedPoint: return decodeFixedPoint<N>;
+    case AttributeFormat::X11Y11Z10N: return N == 3 ? decodeX11Y11Z10N : nullptr;
+    case AttributeFormat::EdgeNormal: return N == 3 ? decodeEdgeNormals : nullptr;
+    default: return nullptr;
+    }
+}
+
+AttributeKernel attributeKernel(const AttributeStream& stream)
+{
+    switch (stream.components)
+    {
+    case 1: return kernelFor<1>(stream);
+    case 2: return kernelFor<2>(stream);
+    case 3: return kernelFor<3>(stream);
+    case 4: return kernelFor<4>(stream);
+    default: return nullptr;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vertex attribute streams of EDGE geometry, described per stream instead
+// of hard-coded per attribute. A stream is read with the kernel for its
+// (format, component count) pair, picked once by attributeKernel(); the
+// float and half formats of tightly packed streams go straight to the
+// SIMD kernels in g_kernels.
+
+enum class AttributeFormat : uint8_t
+{
+    F32,        // big-endian float
+    F16,        // big-endian half
+    I16N,       // big-endian int16 / 32767, clamped to -1
+    I16,        // big-endian int16, as is
+    U8N,        // uint8 / 255
+    U8,         // uint8, as is
+    X11Y11Z10N, // big-endian word, x in the low 11 bits, then y, z in the top 10; signed normalized
+    FixedPoint, // signed, integerBits + fractionBits per component, bit packed MSB first
+    EdgeNormal, // int8 remapped to [-0.5, 0.5] and normalized, as the normal blocks have always been read
+    Count
+};
+
+static const uint32_t NUM_ATTRIBUTE_FORMATS = (uint32_t)AttributeFormat::Count;
+
+const char* attributeFormatName(AttributeFormat format);
+
+struct AttributeStream
+{
+    AttributeFormat format = AttributeFormat::F32;
+    uint8_t components = 3; // 1 to 4; X11Y11Z10N and EdgeNormal have 3
+    uint8_t stride = 12;    // bytes from one vertex to the next
+    uint8_t offset = 0;     // of the attribute within a vertex
+    // FixedPoint only.
+    uint8_t integerBits[4] = {};
+    uint8_t fractionBits[4] = {};
+};
+
+inline AttributeStream attributeStream(AttributeFormat format, uint8_t components, uint8_t stride)
+{
+    AttributeStream stream;
+    stream.format = format;
+    stream.components = components;
+    stream.stride = stride;
+    return stream;
+}
+
+// Bytes of one vertex's attribute, from its offset.
+uint32_t attributeBytes(const AttributeStream& stream);
+// Known format, component count it supports, attribute within the stride.
+bool attributeStreamValid(const AttributeStream& stream);
+// Bytes count vertices of the stream span, from the start of the first.
+uint64_t attributeSpan(const AttributeStream& stream, uint64_t count);
+
+// Decodes count vertices starting at src (the first vertex, not the
+// attribute) to dst, components floats per vertex.
+typedef void (*AttributeKernel)(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst);
+
+// The kernel for a valid stream. The ones that convert through g_kernels
+// look it up on every call, so --isa applies to kernels picked earlier.
+AttributeKernel attributeKernel(const AttributeStream& stream);
+
+inline void decodeAttributes(const uint8_t* src, const AttributeStream& stream, size_t count, float* dst)
+{
+    attributeKernel(stream)(src, stream, count, dst);
+}
@@ -0,0 +1,718 @@
+#include "batch.hpp"
+#include "geom.hpp"
+#include "profile.hpp"
+#include "queue.hpp"
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#ifdef _DEBUG
+//#define DECODE_ONLY
+#endif
+
+static const char* FILE_STATUS_NAMES[] = { "read_failed", "material_failed", "geom_failed", "write_failed", "converted" };
+
+const char* fileStatusName(FileStatus status)
+{
+    return FILE_STATUS_NAMES[(uint32_t)status];
+}
+
+bool fileStatusFromName(const std::string& name, FileStatus& status)
+{
+    for (uint32_t i = 0; i <= (uint32_t)FileStatus::Converted; ++i)
+    {
+        if (name == FILE_STATUS_NAMES[i])
+        {
+            status = (FileStatus)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+FileJob::FileJob(const std::string& file, int32_t index)
+    : file(file), index(index), corpusIndex(index)
+{
+    path = file;
+    if (path.find_last_of("/") != std::string::npos)
+    {
+        path = path.substr(0, path.find_last_of("/")) + "/";
+    }
+    material = std::regex_replace(file, std::regex("geom.edge"), "mat.edge");
+}
+
+FileJob::~FileJob()
+{
+    if (reservation.budget)
+        reservation.budget->release(reservation.input + reservation.decoded);
+}
+
+FileStamp fileStamp(const std::string& file)
+{
+    FileStamp stamp;
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(file, ec);
+    if (ec)
+        return stamp;
+    auto mtime = std::filesystem::last_write_time(file, ec);
+    if (ec)
+        return stamp;
+    stamp.size = size;
+    stamp.mtime = (int64_t)mtime.time_since_epoch().count();
+    return stamp;
+}
+
+bool MaterialCache::find(const std::string& file, const FileStamp& stamp, std::unique_ptr<GeomMaterial>& material)
+{
+    std::shared_ptr<const GeomMaterial> cached;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(file);
+        if (it == m_entries.end() || !(it->second.stamp == stamp) || stamp.size == 0)
+        {
+            ++m_misses;
+            return false;
+        }
+        ++m_hits;
+        cached = it->second.material;
+    }
+    // Writing the materials touches their filenames, so every job gets a copy.
+    material.reset(new GeomMaterial(*cached));
+    return true;
+}
+
+void MaterialCache::insert(const std::string& file, const FileStamp& stamp, const GeomMaterial& material)
+{
+    if (stamp.size == 0)
+        return;
+    std::shared_ptr<const GeomMaterial> copy(new GeomMaterial(material));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry& entry = m_entries[file];
+    entry.stamp = stamp;
+    entry.material = copy;
+}
+
+uint64_t MaterialCache::hits()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t MaterialCache::misses()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+size_t MaterialCache::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+bool MemoryBudget::tryReserve(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!fits(bytes))
+        return false;
+    m_used += bytes;
+    m_peak = std::max(m_peak, m_used);
+    return true;
+}
+
+void MemoryBudget::reserve(uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [&]()
+    {
+        return fits(bytes);
+    });
+    m_used += bytes;
+    m_peak = std::max(m_peak, m_used);
+}
+
+void MemoryBudget::release(uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_used -= std::min(bytes, m_used);
+        ++m_releases;
+    }
+    m_released.notify_all();
+}
+
+void MemoryBudget::resize(uint64_t from, uint64_t to)
+{
+    if (to < from)
+    {
+        release(from - to);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used += to - from;
+    m_peak = std::max(m_peak, m_used);
+}
+
+uint64_t MemoryBudget::releases()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_releases;
+}
+
+void MemoryBudget::waitForRelease(uint64_t seen)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_released.wait(lock, [&]()
+    {
+        return m_releases != seen;
+    });
+}
+
+void MemoryBudget::observe(uint64_t estimated, uint64_t actual)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_estimated += estimated;
+    m_actual += actual;
+}
+
+uint64_t MemoryBudget::scaleEstimate(uint64_t estimated)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_actual <= m_estimated)
+        return estimated;
+    return (uint64_t)((double)estimated * m_actual / m_estimated);
+}
+
+uint64_t MemoryBudget::peak()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_peak;
+}
+
+bool readJob(FileJob& job)
+{
+    FileScope fileScope(job.index);
+    {
+        StageScope scope(Stage::Read);
+        job.geomData.reset(readfile(job.file, job.geomSize));
+        if (job.materials)
+        {
+            job.matStamp = fileStamp(job.material);
+            job.materials->find(job.material, job.matStamp, job.mat);
+        }
+        if (job.mat == nullptr)
+            job.matData.reset(readfile(job.material, job.matSize));
+        scope.setItems((uint64_t)job.geomSize + job.matSize);
+    }
+    if (job.geomData == nullptr || (job.matData == nullptr && job.mat == nullptr))
+    {
+        printf("Could not read %s\n", job.geomData == nullptr ? job.file.c_str() : job.material.c_str());
+        return false;
+    }
+    if (job.result)
+        job.result->bytes = (uint64_t)job.geomSize + job.matSize;
+    return true;
+}
+
+bool decodeJob(FileJob& job)
+{
+    FileScope fileScope(job.index);
+    uint64_t start = profileNow();
+    try
+    {
+        if (job.mat == nullptr)
+        {
+            job.mat.reset(new GeomMaterial(job.material));
+            StageScope scope(Stage::Header);
+            job.mat->parse(job.matData.get());
+            if (job.materials)
+                job.materials->insert(job.material, job.matStamp, *job.mat);
+        }
+    }
+    catch (...)
+    {
+        printf("Exception thrown when parsing %s\n", job.file.c_str());
+        if (job.result)
+            job.result->status = FileStatus::MaterialFailed;
+        return false;
+    }
+
+    try
+    {
+        uint8_t* data = job.geomData.get();
+        job.geom.reset(new Geom(job.file, job.geomSize));
+        {
+            StageScope scope(Stage::Header);
+            job.geom->parse(data);
+            job.geom->parseMeshHeaders(data);
+            scope.setItems(job.geom->meshHeaders.size());
+        }
+        bool readIdx = false;
+        // Welding leaves no duplicates to mark.
+        job.geom->parseMesh(data, readIdx, !job.mesh.weld);
+        MeshProcessStats process = processMeshes(*job.geom, job.mesh);
+        if (job.result)
+            job.result->process = process;
+    }
+    catch (...)
+    {
+        printf("Exception thrown when parsing %s\n", job.file.c_str());
+        job.geom.reset();
+    }
+
+    if (job.result)
+    {
+        FileResult& result = *job.result;
+        result.status = FileStatus::GeomFailed; // until written
+        if (job.geom)
+        {
+            result.meshes = (uint32_t)job.geom->meshHeaders.size();
+            for (const GeomMeshHeader& h : job.geom->meshHeaders)
+            {
+                result.vertices += h.num_vertices;
+                result.triangles += h.numIndices / 3;
+            }
+        }
+        result.ns += profileNow() - start;
+    }
+
+    // Everything needed for writing has been copied out.
+    job.geomData.reset();
+    job.matData.reset();
+    if (job.reservation.budget)
+    {
+        // Duplicate lists don't show in the headers, so swap the estimate
+        // for what was actually decoded.
+        Reservation& r = job.reservation;
+        uint64_t decoded = job.geom ? job.geom->decodedBytes() : 0;
+        if (job.geom)
+            r.budget->observe(r.estimatedDecoded, decoded);
+        r.budget->resize(r.input + r.decoded, decoded);
+        r.input = 0;
+        r.decoded = decoded;
+    }
+    return true;
+}
+
+void writeJob(FileJob& job)
+{
+    FileScope fileScope(job.index);
+    uint64_t start = profileNow();
+    bool written = true;
+    try
+    {
+        if (job.geom && job.decoded)
+        {
+            StageScope scope(Stage::Write);
+            written = job.decoded(job);
+        }
+        if (job.write)
+        {
+            {
+                StageScope scope(Stage::Write);
+                job.mat->dumpMaterials(job.path);
+            }
+#ifndef DECODE_ONLY
+            if (job.geom)
+                job.geom->dump_meshes(*job.mat);
+#endif
+        }
+    }
+    catch (...)
+    {
+        printf("Exception thrown when writing %s\n", job.file.c_str());
+        written = false;
+    }
+
+    if (job.result)
+    {
+        if (!written)
+            job.result->status = FileStatus::WriteFailed;
+        else if (job.geom)
+            job.result->status = FileStatus::Converted;
+        job.result->ns += profileNow() - start;
+    }
+}
+
+void convertFile(const std::string& file, int32_t fileIndex, const BatchOptions& options, const Reservation& reservation, FileResult* result)
+{
+    FileJob job(file, fileIndex);
+    job.reservation = reservation;
+    job.result = result;
+    job.write = options.write;
+    job.decoded = options.decoded;
+    job.mesh = options.mesh;
+    job.materials = options.materials;
+    if (!options.corpusIndices.empty())
+        job.corpusIndex = (int32_t)options.corpusIndices[fileIndex];
+    if (readJob(job) && decodeJob(job))
+        writeJob(job);
+}
+
+static Reservation reservationFor(MemoryBudget& budget, const FileEstimate& estimate)
+{
+    Reservation reservation;
+    reservation.budget = &budget;
+    reservation.input = estimate.inputBytes;
+    reservation.decoded = budget.scaleEstimate(estimate.decodedBytes);
+    reservation.estimatedDecoded = estimate.decodedBytes;
+    return reservation;
+}
+
+// Reader -> decoders -> writer. The queues cap the files in flight at
+// 2 * queueDepth + jobs + 2 (plus readsInFlight being read), and a file's
+// input buffers are gone before it waits for the writer. Decoding of the
+// next files overlaps writing.
+static void runPipeline(const std::vector<std::string>& files, const std::vector<uint32_t>& order, const BatchOptions& options,
+    MemoryBudget* budget, const std::vector<FileEstimate>& estimates, std::vector<FileResult>& results)
+{
+    typedef std::unique_ptr<FileJob> JobPtr;
+    BoundedQueue<JobPtr> decodeQueue(std::max(options.queueDepth, 1u));
+    BoundedQueue<JobPtr> writeQueue(std::max(options.queueDepth, 1u));
+    std::atomic<uint32_t> decodersLeft(options.jobs);
+
+    // Two buffers for every file that can hold input at the same time, so
+    // the pool only runs dry for files larger than a slot.
+    const uint32_t POOL_SLOT_SIZE = 256 * 1024;
+    uint32_t poolSlots = options.reader == ReaderKind::Sync ? 0 :
+        2 * (options.readsInFlight + 2 * (uint32_t)decodeQueue.capacity() + options.jobs + 2);
+    ReadPool pool(poolSlots, POOL_SLOT_SIZE);
+
+    std::thread reader([&]()
+    {
+        profileSetThreadName("reader");
+        AdmitFile admit;
+        if (budget)
+        {
+            admit = [&](FileJob& job, bool wait)
+            {
+                Reservation reservation = reservationFor(*budget, estimates[job.index]);
+                uint64_t bytes = reservation.input + reservation.decoded;
+                if (wait)
+                    budget->reserve(bytes);
+                else if (!budget->tryReserve(bytes))
+                    return false;
+                job.reservation = reservation;
+                return true;
+            };
+        }
+        readFiles(files, order, options.reader, options.readsInFlight, pool, admit, [&](JobPtr job)
+        {
+            job->result = &results[job->index];
+            job->write = options.write;
+            job->decoded = options.decoded;
+            job->mesh = options.mesh;
+            if (!options.corpusIndices.empty())
+                job->corpusIndex = (int32_t)options.corpusIndices[job->index];
+            job->result->bytes = (uint64_t)job->geomSize + job->matSize;
+            decodeQueue.push(std::move(job));
+        });
+        decodeQueue.close();
+    });
+
+    std::vector<std::thread> decoders;
+    for (uint32_t d = 0; d < options.jobs; ++d)
+    {
+        decoders.emplace_back([&, d]()
+        {
+            profileSetThreadName("decoder " + std::to_string(d));
+            JobPtr job;
+            while (decodeQueue.pop(job))
+            {
+                if (decodeJob(*job))
+                    writeQueue.push(std::move(job));
+                job.reset();
+            }
+            if (--decodersLeft == 0)
+                writeQueue.close();
+        });
+    }
+
+    profileSetThreadName("writer");
+    JobPtr job;
+    while (writeQueue.pop(job))
+    {
+        writeJob(*job);
+        job.reset();
+    }
+
+    reader.join();
+    for (std::thread& t : decoders)
+        t.join();
+}
+
+FileEstimate estimateFile(const std::string& file)
+{
+    const uint32_t GEOM_HEADER_SIZE = 16;
+    const uint32_t MESH_HEADER_SIZE = 128;
+    // Fixed per-file work (opening, materials, output files) and per-item
+    // costs, in ns, roughly as measured by the bench on one core.
+    const uint64_t FILE_COST = 100000;
+    const uint64_t VERTEX_COST = 2000;
+    const uint64_t TRIANGLE_COST = 200;
+    const uint64_t VERTEX_PAIR_COST = 15;
+    // The .mat.edge, the index copy and the like; MeshVertex, normal,
+    // decode temporaries and OBJ text per vertex; both triangle lists and
+    // the index decode arrays per triangle.
+    const uint64_t FILE_BYTES = 64 * 1024;
+    const uint64_t VERTEX_BYTES = 160;
+    const uint64_t TRIANGLE_BYTES = 48;
+
+    FileEstimate estimate;
+    estimate.cost = FILE_COST;
+    estimate.inputBytes = FILE_BYTES;
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (!fp)
+        return estimate;
+
+    uint8_t header[GEOM_HEADER_SIZE];
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    if (size < (long)(GEOM_HEADER_SIZE + sizeof(GeomAABB)) || fread(header, 1, GEOM_HEADER_SIZE, fp) != GEOM_HEADER_SIZE)
+    {
+        fclose(fp);
+        return estimate;
+    }
+    estimate.geomSize = (uint32_t)size;
+    estimate.inputBytes = estimate.geomSize + FILE_BYTES;
+
+    uint32_t offset = 0;
+    uint32_t numMeshes = parse32(header, offset);
+    numMeshes = std::min<uint32_t>(numMeshes, (estimate.geomSize - GEOM_HEADER_SIZE - sizeof(GeomAABB)) / MESH_HEADER_SIZE);
+    std::vector<uint8_t> meshHeaders((size_t)numMeshes * MESH_HEADER_SIZE);
+    size_t read = fread(meshHeaders.data(), 1, meshHeaders.size(), fp);
+    fclose(fp);
+    if (read != meshHeaders.size())
+        return estimate;
+
+    GeomAABB aabb = {};
+    offset = 0;
+    for (uint32_t i = 0; i < numMeshes; ++i)
+    {
+        GeomMeshHeader h;
+        h.parse(aabb, meshHeaders.data(), offset);
+        uint64_t vertices = h.num_vertices;
+        estimate.vertices += vertices;
+        estimate.triangles += h.numIndices / 3;
+        estimate.cost += vertices * VERTEX_COST + (uint64_t)(h.numIndices / 3) * TRIANGLE_COST + vertices * vertices / 2 * VERTEX_PAIR_COST;
+    }
+    estimate.decodedBytes = estimate.vertices * VERTEX_BYTES + estimate.triangles * TRIANGLE_BYTES;
+    estimate.numMeshes = numMeshes;
+    estimate.valid = true;
+    return estimate;
+}
+
+std::vector<BatchTask> scheduleTasks(const std::vector<FileEstimate>& estimates, uint64_t packCost)
+{
+    std::vector<uint32_t> byCost(estimates.size());
+    for (uint32_t i = 0; i < byCost.size(); ++i)
+        byCost[i] = i;
+    std::stable_sort(byCost.begin(), byCost.end(), [&](uint32_t a, uint32_t b)
+    {
+        return estimates[a].cost > estimates[b].cost;
+    });
+
+    std::vector<BatchTask> tasks;
+    BatchTask packed;
+    for (uint32_t i : byCost)
+    {
+        if (estimates[i].cost >= packCost)
+        {
+            tasks.emplace_back();
+            tasks.back().files.push_back(i);
+            tasks.back().cost = estimates[i].cost;
+            continue;
+        }
+        packed.files.push_back(i);
+        packed.cost += estimates[i].cost;
+        if (packed.cost >= packCost)
+        {
+            tasks.push_back(std::move(packed));
+            packed = BatchTask();
+        }
+    }
+    if (!packed.files.empty())
+        tasks.push_back(std::move(packed));
+
+    std::stable_sort(tasks.begin(), tasks.end(), [](const BatchTask& a, const BatchTask& b)
+    {
+        return a.cost > b.cost;
+    });
+    return tasks;
+}
+
+std::vector<FileResult> runBatch(const std::vector<std::string>& files, const BatchOptions& options)
+{
+    // Files estimated below this are packed together, so a corpus of tiny
+    // files isn't dominated by handing out tasks.
+    const uint64_t PACK_COST = 1000000;
+    // How far past the oldest waiting task the budget may admit smaller
+    // ones that fit.
+    const size_t ADMIT_LOOKAHEAD = 64;
+
+    bool pipeline = options.pipeline || options.reader != ReaderKind::Sync;
+    bool largestFirst = options.largestFirst && options.jobs > 1;
+    std::unique_ptr<MemoryBudget> budget;
+    if (options.memoryBudget > 0 && (pipeline || options.jobs > 1))
+        budget.reset(new MemoryBudget(options.memoryBudget));
+
+    std::vector<FileEstimate> estimates;
+    if (largestFirst || budget)
+    {
+        estimates.reserve(files.size());
+        for (const std::string& file : files)
+            estimates.push_back(estimateFile(file));
+    }
+
+    std::vector<FileResult> results(files.size());
+    std::vector<BatchTask> tasks;
+    if (largestFirst)
+    {
+        tasks = scheduleTasks(estimates, PACK_COST);
+    }
+    else
+    {
+        tasks.resize(files.size());
+        for (uint32_t i = 0; i < files.size(); ++i)
+            tasks[i].files.push_back(i);
+    }
+
+    if (pipeline)
+    {
+        std::vector<uint32_t> order;
+        order.reserve(files.size());
+        for (const BatchTask& task : tasks)
+            order.insert(order.end(), task.files.begin(), task.files.end());
+        runPipeline(files, order, options, budget.get(), estimates, results);
+    }
+    else if (options.jobs <= 1 && options.scheduler == nullptr)
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+            convertFile(files[i], (int32_t)i, options, Reservation(), &results[i]);
+    }
+    else
+    {
+        // File tasks go to the scheduler in order; their meshes and the
+        // larger stages inside them become tasks idle workers can steal,
+        // so the last big file doesn't run on one core.
+        std::unique_ptr<TaskScheduler> ownScheduler;
+        TaskScheduler* scheduler = options.scheduler;
+        if (scheduler == nullptr)
+        {
+            ownScheduler.reset(new TaskScheduler(options.jobs));
+            scheduler = ownScheduler.get();
+        }
+        uint32_t workers = scheduler->numWorkers();
+        TaskGroup group;
+        std::vector<Reservation> reservations(budget ? files.size() : 0);
+        std::atomic<uint32_t> running(0);
+        auto spawnTask = [&](const BatchTask& task)
+        {
+            ++running;
+            scheduler->spawn(group, Stage::Count, [&files, &options, &task, &reservations, &results, &running, &budget]()
+            {
+                for (uint32_t i : task.files)
+                    convertFile(files[i], (int32_t)i, options, reservations.empty() ? Reservation() : reservations[i], &results[i]);
+                --running;
+                if (budget)
+                    budget->release(0); // wakes the admission loop
+            });
+        };
+
+        if (!budget)
+        {
+            for (const BatchTask& task : tasks)
+                spawnTask(task);
+        }
+        else
+        {
+            // Admit tasks in order as their footprint fits, letting smaller
+            // ones a little further down overtake one that has to wait. No
+            // more are admitted than can run, so later reservations already
+            // benefit from the decoded sizes observed so far.
+            std::vector<bool> started(tasks.size(), false);
+            size_t first = 0;
+            while (first < tasks.size())
+            {
+                uint64_t seen = budget->releases();
+                size_t end = std::min(tasks.size(), first + ADMIT_LOOKAHEAD);
+                for (size_t t = first; t < end && running < workers; ++t)
+                {
+                    if (started[t])
+                        continue;
+                    uint64_t bytes = 0;
+                    for (uint32_t i : tasks[t].files)
+                    {
+                        reservations[i] = reservationFor(*budget, estimates[i]);
+                        bytes += reservations[i].input + reservations[i].decoded;
+                    }
+                    if (budget->tryReserve(bytes))
+                    {
+                        started[t] = true;
+                        spawnTask(tasks[t]);
+                    }
+                }
+                while (first < tasks.size() && started[first])
+                    ++first;
+                if (first < tasks.size())
+                    budget->waitForRelease(seen);
+            }
+        }
+        scheduler->wait(group);
+    }
+
+    if (budget && g_profileActive)
+        printf("memory budget %.1f MiB, peak reserved %.1f MiB\n", budget->limit() / 1048576.0, budget->peak() / 1048576.0);
+    return results;
+}
+
+static bool endsWith(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool collectInputs(const std::string& path, std::vector<std::string>& files)
+{
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec))
+    {
+        std::vector<std::string> found;
+        for (auto it = std::filesystem::recursive_directory_iterator(path, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            std::string name = it->path().generic_string();
+            if (it->is_regular_file(ec) && endsWith(name, ".geom.edge"))
+                found.push_back(name);
+        }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+        return true;
+    }
+
+    if (endsWith(path, ".txt"))
+    {
+        std::ifstream list(path);
+        if (!list)
+        {
+            printf("Could not read %s\n", path.c_str());
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line))
+        {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+                line.pop_back();
+            if (!line.empty() && line[0] != '#')
+                files.push_back(line);
+        }
+        return true;
+    }
+
+    files.push_back(path);
+    return true;
+}
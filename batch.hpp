@@ -0,0 +1,282 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "asyncread.hpp"
+#include "meshops.hpp"
+
+struct FileJob;
+struct Geom;
+struct GeomMaterial;
+struct MaterialCache;
+struct TaskScheduler;
+
+// Frees heap input buffers and hands pool buffers back to their pool.
+struct InputBufferDeleter
+{
+    ReadPool* pool = nullptr;
+
+    void operator()(uint8_t* buffer) const
+    {
+        if (pool)
+            pool->release(buffer);
+        else
+            delete[] buffer;
+    }
+};
+
+typedef std::unique_ptr<uint8_t[], InputBufferDeleter> InputBuffer;
+
+// Called with every decoded Geom before its OBJ files are written, on
+// whichever thread writes it. Returning false marks the file WriteFailed.
+typedef std::function<bool(const FileJob& job)> DecodedFn;
+
+struct BatchOptions
+{
+    uint32_t jobs = 1;
+    // Separate reader, decoder (jobs of them) and writer threads connected
+    // by bounded queues of queueDepth files each.
+    bool pipeline = false;
+    uint32_t queueDepth = 4;
+    // How the pipeline reader loads files. Anything but Sync implies the
+    // pipeline; readsInFlight is the number of file pairs outstanding.
+    ReaderKind reader = ReaderKind::Sync;
+    uint32_t readsInFlight = 16;
+    // With more than one job, estimate every file from its headers first and
+    // start the most expensive ones first, so a huge file doesn't come last.
+    bool largestFirst = true;
+    // Bytes the files being converted may hold at once, judged by their
+    // header estimates. 0 for no limit.
+    uint64_t memoryBudget = 0;
+    // false skips the OBJ/MTL output.
+    bool write = true;
+    DecodedFn decoded;
+    MeshOptions mesh;
+    // Index of every file in the whole corpus, for --shard, so names built
+    // from it don't clash between shards. Empty when the files are the
+    // corpus.
+    std::vector<uint32_t> corpusIndices;
+    // Kept by a resident process across batches: the workers to run on
+    // instead of starting jobs threads, and the parsed .mat.edge files.
+    // Neither is used by the pipeline.
+    TaskScheduler* scheduler = nullptr;
+    MaterialCache* materials = nullptr;
+};
+
+// Size and modification time, to tell whether a file changed.
+struct FileStamp
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size && mtime == other.mtime;
+    }
+};
+
+// Zero for a file that can't be stat'ed.
+FileStamp fileStamp(const std::string& file);
+
+// Parsed .mat.edge files by path. An entry is only used while the file's
+// stamp still matches, and every user gets its own copy.
+struct MaterialCache
+{
+    bool find(const std::string& file, const FileStamp& stamp, std::unique_ptr<GeomMaterial>& material);
+    void insert(const std::string& file, const FileStamp& stamp, const GeomMaterial& material);
+
+    uint64_t hits();
+    uint64_t misses();
+    size_t size();
+
+private:
+    struct Entry
+    {
+        FileStamp stamp;
+        std::shared_ptr<const GeomMaterial> material;
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Entry> m_entries;
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+};
+
+// Admission control for --memory-budget. Files reserve their estimated
+// footprint before they are read and give it back as their buffers go.
+struct MemoryBudget
+{
+    MemoryBudget(uint64_t limit)
+        : m_limit(limit)
+    {
+    }
+
+    // A reservation larger than the whole budget is let through once
+    // nothing else is held, so it runs alone rather than never.
+    bool tryReserve(uint64_t bytes);
+    void reserve(uint64_t bytes);
+    void release(uint64_t bytes);
+    // Replaces a reservation of from bytes by one of to bytes. Growing never
+    // blocks; it only holds back later reservations.
+    void resize(uint64_t from, uint64_t to);
+
+    // Counts releases, for waitForRelease.
+    uint64_t releases();
+    // Blocks until there was a release after releases() returned seen.
+    void waitForRelease(uint64_t seen);
+
+    uint64_t limit() const
+    {
+        return m_limit;
+    }
+
+    uint64_t peak();
+
+    // Decoded sizes seen so far against their header estimates. Later
+    // estimates are scaled up by the ratio, since a corpus tends to be off
+    // the same way throughout.
+    void observe(uint64_t estimated, uint64_t actual);
+    uint64_t scaleEstimate(uint64_t estimated);
+
+private:
+    bool fits(uint64_t bytes) const
+    {
+        return m_used == 0 || m_used + bytes <= m_limit;
+    }
+
+    uint64_t m_limit;
+    uint64_t m_used = 0;
+    uint64_t m_peak = 0;
+    uint64_t m_releases = 0;
+    uint64_t m_estimated = 0;
+    uint64_t m_actual = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+};
+
+// Part of a MemoryBudget held by one file: the input part goes back once
+// the input buffers are freed, the rest when the file is done.
+struct Reservation
+{
+    MemoryBudget* budget = nullptr;
+    uint64_t input = 0;
+    uint64_t decoded = 0;
+    uint64_t estimatedDecoded = 0; // unscaled, for MemoryBudget::observe
+};
+
+enum class FileStatus : uint8_t
+{
+    ReadFailed, // where every file starts
+    MaterialFailed,
+    GeomFailed, // materials written, meshes not
+    WriteFailed,
+    Converted
+};
+
+const char* fileStatusName(FileStatus status);
+bool fileStatusFromName(const std::string& name, FileStatus& status);
+
+// What happened to one input of a batch.
+struct FileResult
+{
+    FileStatus status = FileStatus::ReadFailed;
+    uint32_t meshes = 0;
+    uint64_t vertices = 0;
+    uint64_t triangles = 0;
+    uint64_t bytes = 0; // .geom.edge plus .mat.edge
+    uint64_t ns = 0;    // decoding and writing
+    MeshProcessStats process;
+};
+
+// One .geom.edge/.mat.edge pair on its way through the converter.
+struct FileJob
+{
+    std::string file;
+    std::string material;
+    std::string path; // output directory, with trailing slash
+    int32_t index = -1;
+    int32_t corpusIndex = -1; // see BatchOptions::corpusIndices
+
+    int geomSize = 0;
+    int matSize = 0;
+    InputBuffer geomData;
+    InputBuffer matData;
+
+    std::unique_ptr<GeomMaterial> mat;
+    // Null when decoding failed; the materials are still written.
+    std::unique_ptr<Geom> geom;
+
+    Reservation reservation;
+    FileResult* result = nullptr;
+    bool write = true;
+    DecodedFn decoded;
+    MeshOptions mesh;
+    MaterialCache* materials = nullptr;
+    FileStamp matStamp;
+
+    FileJob(const std::string& file, int32_t index);
+    ~FileJob();
+};
+
+// The three steps of a conversion. Each opens its own FileScope, so they can
+// run on different threads.
+// readJob loads both files and returns false (after saying so) if either
+// is missing.
+bool readJob(FileJob& job);
+// decodeJob parses everything and frees the input buffers. Returns false
+// when there is nothing left to write.
+bool decodeJob(FileJob& job);
+void writeJob(FileJob& job);
+
+// Reads, decodes and writes one .geom.edge and its .mat.edge, as far as
+// options.write, decoded, mesh and materials say. fileIndex identifies the file in
+// profile output. The reservation, if any, is given back along the way, and
+// result is filled in when given.
+void convertFile(const std::string& file, int32_t fileIndex, const BatchOptions& options, const Reservation& reservation = Reservation(),
+    FileResult* result = nullptr);
+
+// What the GeomHeader and mesh headers say about a file, read without
+// loading the rest of it.
+struct FileEstimate
+{
+    bool valid = false;
+    uint32_t geomSize = 0;
+    uint32_t numMeshes = 0;
+    uint64_t vertices = 0;
+    uint64_t triangles = 0;
+    // Rough conversion time in ns. findDuplicates is quadratic per mesh, so
+    // large meshes are dominated by num_vertices^2.
+    uint64_t cost = 0;
+    // Rough peak memory while converting: the input files, then the decoded
+    // meshes and the OBJ text being formatted.
+    uint64_t inputBytes = 0;
+    uint64_t decodedBytes = 0;
+};
+
+FileEstimate estimateFile(const std::string& file);
+
+// Files one worker converts back to back, as indices into the batch.
+struct BatchTask
+{
+    std::vector<uint32_t> files;
+    uint64_t cost = 0;
+};
+
+// Longest-processing-time first: one task per file, except that files
+// cheaper than packCost share tasks of about packCost each. Sorted by
+// descending cost, ties in batch order.
+std::vector<BatchTask> scheduleTasks(const std::vector<FileEstimate>& estimates, uint64_t packCost);
+
+// Converts every file; the results are in the same order as files.
+std::vector<FileResult> runBatch(const std::vector<std::string>& files, const BatchOptions& options);
+
+// Appends the inputs named by path: every *.geom.edge below a directory,
+// the lines of a .txt list, or path itself.
+bool collectInputs(const std::string& path, std::vector<std::string>& files);
@@ -0,0 +1,852 @@
+#include "bench.hpp"
+#include "batch.hpp"
+#include "geom.hpp"
+#include "kernels.hpp"
+#include "profile.hpp"
+#include "synth.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+
+#ifdef _WIN32
+static const char* NULL_DEVICE = "NUL";
+#else
+static const char* NULL_DEVICE = "/dev/null";
+#endif
+
+volatile uint64_t g_benchSink = 0;
+
+static const uint32_t MAX_MESH_VERTICES = 0xFFFF / 12;
+static const uint32_t MAX_MESH_TRIANGLES = 0xFFFF / 3;
+
+// One synthetic single-mesh Geom, kept in the three states the stage
+// benchmarks start from.
+struct MeshFixture
+{
+    SynthFile file;
+    std::unique_ptr<GeomMaterial> material;
+    std::unique_ptr<Geom> geom;
+    GeomMeshHeader headerOnly;
+    GeomMeshHeader verticesDecoded;
+    GeomMeshHeader decoded;
+
+    uint8_t* data()
+    {
+        return file.geom.data();
+    }
+};
+
+static std::shared_ptr<MeshFixture> makeMeshFixture(uint32_t numVertices)
+{
+    SynthOptions o;
+    o.numFiles = 1;
+    o.minMeshes = o.maxMeshes = 1;
+    o.minVertices = o.maxVertices = std::min(numVertices, MAX_MESH_VERTICES);
+    o.numMaterials = 1;
+
+    auto f = std::make_shared<MeshFixture>();
+    f->file = synthFile(o, 0);
+    f->material.reset(new GeomMaterial("bench.mat.edge"));
+    f->material->parse(f->file.mat.data());
+    f->geom.reset(new Geom("bench.geom.edge", (uint32_t)f->file.geom.size()));
+    f->geom->parse(f->data());
+    f->geom->parseMeshHeaders(f->data());
+
+    f->headerOnly = f->geom->meshHeaders[0];
+    f->verticesDecoded = f->headerOnly;
+    f->verticesDecoded.parseBlock1(f->data());
+    f->decoded = f->verticesDecoded;
+    f->decoded.parseFloatBlock(f->data());
+    f->decoded.parseIndexArray(f->data());
+    return f;
+}
+
+static std::vector<uint8_t> randomBytes(SynthRng& rng, size_t count)
+{
+    std::vector<uint8_t> bytes(count);
+    for (uint8_t& b : bytes)
+        b = (uint8_t)rng.next();
+    return bytes;
+}
+
+// --isa picks one level; by default every level the CPU supports runs.
+static std::vector<Isa> benchIsas(const BenchOptions& options)
+{
+    std::vector<Isa> isas;
+    Isa isa;
+    if (!options.isa.empty() && isaFromName(options.isa.c_str(), isa))
+    {
+        isas.push_back(isa);
+        return isas;
+    }
+    for (uint32_t i = 0; i < NUM_ISAS; ++i)
+    {
+        if (isaSupported((Isa)i))
+            isas.push_back((Isa)i);
+    }
+    return isas;
+}
+
+std::vector<BenchCase> benchCases(const BenchOptions& options)
+{
+    std::vector<BenchCase> cases;
+    const uint32_t n = std::max(options.size, 32u);
+    SynthRng rng(options.size);
+
+    auto bytes = std::make_shared<std::vector<uint8_t>>(randomBytes(rng, (size_t)n * 4 + 16));
+
+    cases.push_back({ "Reverse32", "scalar", n, nullptr, [bytes, n]()
+    {
+        const uint32_t* src = (const uint32_t*)bytes->data();
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < n; ++i)
+            acc += Reverse32(src[i]);
+        g_benchSink += acc;
+    } });
+
+    cases.push_back({ "Reverse16", "scalar", n, nullptr, [bytes, n]()
+    {
+        const uint16_t* src = (const uint16_t*)bytes->data();
+        uint32_t acc = 0;
+        for (uint32_t i = 0; i < n; ++i)
+            acc += Reverse16(src[i]);
+        g_benchSink += acc;
+    } });
+
+    cases.push_back({ "ReverseFloat", "scalar", n, nullptr, [bytes, n]()
+    {
+        const float* src = (const float*)bytes->data();
+        float acc = 0.0f;
+        for (uint32_t i = 0; i < n; ++i)
+            acc += ReverseFloat(src[i]);
+        g_benchSink += (uint64_t)(acc != 0.0f);
+    } });
+
+    cases.push_back({ "parsef16", "scalar", n, nullptr, [bytes, n]()
+    {
+        uint32_t offset = 0;
+        float acc = 0.0f;
+        for (uint32_t i = 0; i < n; ++i)
+            acc += parsef16(bytes->data(), offset);
+        g_benchSink += (uint64_t)(acc != 0.0f);
+    } });
+
+    cases.push_back({ "parsef8", "scalar", n, nullptr, [bytes, n]()
+    {
+        uint32_t offset = 0;
+        float acc = 0.0f;
+        for (uint32_t i = 0; i < n; ++i)
+            acc += parsef8(bytes->data(), offset);
+        g_benchSink += (uint64_t)(acc != 0.0f);
+    } });
+
+    {
+        // About half the stream are first uses of a vertex, like real meshes.
+        std::vector<uint16_t> stream(n);
+        uint32_t next = 0;
+        for (uint16_t& s : stream)
+            s = (uint16_t)((next == 0 || rng.unit() < 0.5f) ? next++ : rng.range(0, next - 1));
+        auto explicitIndices = std::make_shared<std::vector<uint16_t>>();
+        auto preface = std::make_shared<std::vector<uint8_t>>(write1bArray(stream, *explicitIndices));
+        uint32_t num1Bit = (uint32_t)preface->size() * 8;
+        cases.push_back({ "read1bArray", "scalar", num1Bit, nullptr, [explicitIndices, preface, num1Bit]()
+        {
+            GeomMeshHeader h;
+            std::vector<uint16_t> decoded = h.read1bArray(*explicitIndices, preface->data(), num1Bit);
+            g_benchSink += decoded.back();
+        } });
+    }
+
+    auto floats = std::make_shared<std::vector<float>>((size_t)n * 3);
+    auto normalBytes = std::make_shared<std::vector<uint8_t>>(randomBytes(rng, (size_t)n * 6));
+
+    // Inputs for the index decode steps, shared by every ISA level.
+    const uint32_t numVarBit = (n + 0x1F) & 0xFFFFFFE0;
+    std::vector<std::shared_ptr<std::vector<uint8_t>>> packedArrays;
+    for (uint32_t bits = 1; bits <= 16; ++bits)
+    {
+        std::vector<uint16_t> raw(numVarBit);
+        for (uint16_t& r : raw)
+            r = (uint16_t)(rng.next() & ((1u << bits) - 1));
+        auto packed = std::make_shared<std::vector<uint8_t>>(writeVariableBitArray(raw, bits));
+        packed->resize(packed->size() + 8, 0); // slack for word-sized loads, like parseIndexArray
+        packedArrays.push_back(packed);
+    }
+
+    auto pristine = std::make_shared<std::vector<uint16_t>>(numVarBit);
+    for (uint16_t& v : *pristine)
+        v = (uint16_t)rng.range(0, 64);
+
+    std::shared_ptr<std::vector<uint16_t>> faceStream = std::make_shared<std::vector<uint16_t>>();
+    std::shared_ptr<std::vector<uint8_t>> faces;
+    uint32_t numTris = std::min(n, MAX_MESH_TRIANGLES);
+    {
+        SynthOptions o;
+        SynthMesh mesh = synthMesh(rng, o, (uint32_t)(numTris / o.trisPerVertex));
+        numTris = (uint32_t)mesh.triangles.size() / 3;
+        uint32_t ops[4] = {};
+        faces = std::make_shared<std::vector<uint8_t>>(encodeFaces(mesh.triangles, *faceStream, ops));
+        faces->resize(faces->size() + 2, 0); // buildFaces reads whole groups of 8 triangles
+    }
+
+    std::shared_ptr<MeshFixture> fixture = makeMeshFixture(n);
+    uint32_t numVertices = fixture->headerOnly.num_vertices;
+    uint32_t numTriangles = fixture->headerOnly.numIndices / 3;
+    auto work = std::make_shared<GeomMeshHeader>();
+
+    // Everything that goes through the dispatch table runs once per level;
+    // setup binds the level so the stage cases pick it up too.
+    for (Isa isa : benchIsas(options))
+    {
+        const DecodeKernels* k = &kernelsFor(isa);
+        const char* variant = isaName(isa);
+        auto select = [isa]() { kernelsSelect(isa); };
+
+        cases.push_back({ "swapFloats", variant, n, select, [k, bytes, floats, n]()
+        {
+            k->swapFloats(bytes->data(), floats->data(), n);
+            g_benchSink += (uint64_t)((*floats)[n - 1] != 0.0f);
+        } });
+
+        cases.push_back({ "halfToFloat", variant, n, select, [k, bytes, floats, n]()
+        {
+            k->halfToFloat(bytes->data(), floats->data(), n);
+            g_benchSink += (uint64_t)((*floats)[n - 1] != 0.0f);
+        } });
+
+        cases.push_back({ "decodeNormals", variant, n, select, [k, normalBytes, floats, n]()
+        {
+            float* out = floats->data();
+            k->decodeNormals(normalBytes->data(), n, out, out + n, out + n * 2);
+            g_benchSink += (uint64_t)(out[n * 3 - 1] != 0.0f);
+        } });
+
+        // Variable-bit unpacking at every width the format allows.
+        for (uint32_t bits = 1; bits <= 16; ++bits)
+        {
+            auto packed = packedArrays[bits - 1];
+            cases.push_back({ "readVariableBitArray/" + std::to_string(bits), variant, numVarBit, select, [packed, bits, numVarBit]()
+            {
+                GeomMeshHeader h;
+                std::vector<uint16_t> values = h.readVariableBitArray(packed->data(), bits, numVarBit);
+                g_benchSink += values.back();
+            } });
+        }
+
+        auto indices = std::make_shared<std::vector<uint16_t>>();
+        cases.push_back({ "readBackRefIndices", variant, numVarBit, [isa, pristine, indices]() { kernelsSelect(isa); *indices = *pristine; }, [indices, numVarBit]()
+        {
+            GeomMeshHeader h;
+            h.readBackRefIndices(*indices, numVarBit, 32);
+            g_benchSink += indices->back();
+        } });
+
+        cases.push_back({ "buildFaces", variant, numTris, select, [faceStream, faces, numTris]()
+        {
+            GeomMeshHeader h;
+            std::vector<uint16_t> indices = h.buildFaces(*faceStream, faces->data(), numTris);
+            g_benchSink += indices.size();
+        } });
+
+        cases.push_back({ "parseBlock1", variant, numVertices, [isa, fixture, work]() { kernelsSelect(isa); *work = fixture->headerOnly; }, [fixture, work]()
+        {
+            work->parseBlock1(fixture->data());
+            g_benchSink += work->meshBlock1.size();
+        } });
+
+        cases.push_back({ "parseFloatBlock", variant, numVertices, [isa, fixture, work]() { kernelsSelect(isa); *work = fixture->verticesDecoded; }, [fixture, work]()
+        {
+            work->parseFloatBlock(fixture->data());
+            g_benchSink += work->normals.size();
+        } });
+
+        cases.push_back({ "parseIndexArray", variant, numTriangles, [isa, fixture, work]() { kernelsSelect(isa); *work = fixture->headerOnly; }, [fixture, work]()
+        {
+            work->parseIndexArray(fixture->data());
+            g_benchSink += work->triangles.size();
+        } });
+    }
+
+    cases.push_back({ "findDuplicates", "scalar", numVertices, [fixture, work]()
+    {
+        *work = fixture->verticesDecoded;
+        for (MeshVertex& v : work->meshBlock1)
+            v.duplicates.clear();
+    }, [work]()
+    {
+        work->findDuplicates();
+        g_benchSink += work->meshBlock1.size();
+    } });
+
+    // OBJ formatting only; the text goes to the null device.
+    std::shared_ptr<FILE> sink(fopen(NULL_DEVICE, "w"), [](FILE* fp) { if (fp) fclose(fp); });
+    if (sink)
+    {
+        cases.push_back({ "dumpBlock1ToOBJ", "scalar", numVertices, nullptr, [fixture, sink]()
+        {
+            fixture->decoded.writeOBJ(sink.get(), *fixture->material);
+            g_benchSink += fixture->decoded.triangles.size();
+        } });
+    }
+
+    return cases;
+}
+
+static BenchResult summarize(const std::string& name, const std::string& variant, uint64_t elements, std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult r;
+    r.name = name;
+    r.variant = variant;
+    r.elements = elements;
+    r.minNs = samples.front();
+    r.medianNs = samples[samples.size() / 2];
+    r.p95Ns = samples[std::min(samples.size() - 1, (size_t)(samples.size() * 0.95))];
+    return r;
+}
+
+static double elapsedNs(std::chrono::steady_clock::time_point begin)
+{
+    auto d = std::chrono::steady_clock::now() - begin;
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+BenchResult runBench(const BenchCase& bench, const BenchOptions& options)
+{
+    for (uint32_t i = 0; i < options.warmup; ++i)
+    {
+        if (bench.setup)
+            bench.setup();
+        bench.run();
+    }
+
+    std::vector<double> samples;
+    uint32_t reps = std::max(options.reps, 1u);
+    for (uint32_t i = 0; i < reps; ++i)
+    {
+        if (bench.setup)
+            bench.setup();
+        auto begin = std::chrono::steady_clock::now();
+        bench.run();
+        auto end = std::chrono::steady_clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+        samples.push_back(ns / std::max<uint64_t>(bench.elements, 1));
+    }
+    return summarize(bench.name, bench.variant, bench.elements, samples);
+}
+
+std::vector<BenchResult> benchCorpus(const BenchOptions& options)
+{
+    // Fixed so results stay comparable across runs regardless of --size.
+    SynthOptions o;
+    o.seed = 2024;
+    o.numFiles = 8;
+
+    std::vector<SynthFile> files;
+    for (uint32_t i = 0; i < o.numFiles; ++i)
+        files.push_back(synthFile(o, i));
+
+    std::shared_ptr<FILE> sink(fopen(NULL_DEVICE, "w"), [](FILE* fp) { if (fp) fclose(fp); });
+    if (!sink)
+        return {};
+
+    const uint32_t NUM_CORPUS_STAGES = 4;
+    const char* names[NUM_CORPUS_STAGES] = { "corpus/header parse", "corpus/vertex decode", "corpus/index decode", "corpus/write" };
+    std::vector<double> samples[NUM_CORPUS_STAGES];
+    uint64_t elements[NUM_CORPUS_STAGES] = {};
+
+    uint32_t runs = options.warmup + std::max(options.reps, 1u);
+    for (uint32_t run = 0; run < runs; ++run)
+    {
+        double ns[NUM_CORPUS_STAGES] = {};
+        uint64_t items[NUM_CORPUS_STAGES] = {};
+        for (SynthFile& f : files)
+        {
+            GeomMaterial material("bench.mat.edge");
+            material.parse(f.mat.data());
+
+            auto begin = std::chrono::steady_clock::now();
+            Geom g("bench.geom.edge", (uint32_t)f.geom.size());
+            g.parse(f.geom.data());
+            g.parseMeshHeaders(f.geom.data());
+            ns[0] += elapsedNs(begin);
+            items[0] += g.meshHeaders.size();
+
+            for (GeomMeshHeader& h : g.meshHeaders)
+            {
+                begin = std::chrono::steady_clock::now();
+                h.parseBlock1(f.geom.data());
+                h.parseFloatBlock(f.geom.data());
+                ns[1] += elapsedNs(begin);
+                items[1] += h.num_vertices;
+
+                begin = std::chrono::steady_clock::now();
+                h.parseIndexArray(f.geom.data());
+                ns[2] += elapsedNs(begin);
+                items[2] += h.numIndices / 3;
+
+                begin = std::chrono::steady_clock::now();
+                h.writeOBJ(sink.get(), material);
+                ns[3] += elapsedNs(begin);
+                items[3] += h.num_vertices;
+            }
+        }
+
+        if (run < options.warmup)
+            continue;
+        for (uint32_t s = 0; s < NUM_CORPUS_STAGES; ++s)
+        {
+            samples[s].push_back(ns[s] / std::max<uint64_t>(items[s], 1));
+            elements[s] = items[s];
+        }
+    }
+
+    std::vector<BenchResult> results;
+    for (uint32_t s = 0; s < NUM_CORPUS_STAGES; ++s)
+        results.push_back(summarize(names[s], isaName(g_kernels.isa), elements[s], samples[s]));
+    return results;
+}
+
+void benchPrintHeader()
+{
+    printf("%-26s %-8s %10s %12s %12s %12s %12s\n", "benchmark", "variant", "elements", "median ns", "min ns", "p95 ns", "Melem/s");
+}
+
+void benchPrintResult(const BenchResult& r)
+{
+    printf("%-26s %-8s %10llu %12.3f %12.3f %12.3f %12.2f\n", r.name.c_str(), r.variant.c_str(), (unsigned long long)r.elements,
+        r.medianNs, r.minNs, r.p95Ns, r.medianNs > 0 ? 1000.0 / r.medianNs : 0.0);
+}
+
+bool benchWriteJson(const std::string& filename, const std::vector<BenchResult>& results)
+{
+    FILE* fp = fopen(filename.c_str(), "w+");
+    if (fp == nullptr)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"variant\": \"%s\", \"elements\": %llu, \"median_ns\": %.4f, \"min_ns\": %.4f, \"p95_ns\": %.4f}%s\n",
+            r.name.c_str(), r.variant.c_str(), (unsigned long long)r.elements, r.medianNs, r.minNs, r.p95Ns,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+    return true;
+}
+
+int benchScaling(const BenchOptions& options)
+{
+    std::vector<std::string> files;
+    if (!options.corpusPath.empty())
+    {
+        if (!collectInputs(options.corpusPath, files))
+            return -1;
+    }
+    else
+    {
+        SynthOptions o;
+        o.seed = 2024;
+        o.numFiles = 64;
+        std::error_code ec;
+        std::string dir = (std::filesystem::temp_directory_path(ec) / "geomparse_scaling").generic_string();
+        printf("Generating %u synthetic geoms in %s\n", o.numFiles, dir.c_str());
+        files = synthCorpus(dir, o);
+    }
+    if (files.empty())
+    {
+        printf("No input files for the scaling run\n");
+        return -1;
+    }
+
+    uint64_t inputBytes = 0;
+    for (const std::string& f : files)
+    {
+        std::error_code ec;
+        inputBytes += std::filesystem::file_size(f, ec);
+        std::string mat = f.substr(0, f.size() - strlen("geom.edge")) + "mat.edge";
+        inputBytes += std::filesystem::file_size(mat, ec);
+    }
+
+    uint32_t maxJobs = options.maxJobs > 0 ? options.maxJobs : std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<uint32_t> jobCounts;
+    for (uint32_t j = 1; j < maxJobs; j *= 2)
+        jobCounts.push_back(j);
+    jobCounts.push_back(maxJobs);
+
+    profileEnable(false, true);
+    printf("%zu files, %.2f MB, %u run(s) per worker count, median run reported\n", files.size(), inputBytes / (1024.0 * 1024.0), std::max(options.runs, 1u));
+    printf("%6s %10s %10s %9s %9s %11s %7s %8s %7s %7s %12s\n", "jobs", "wall ms", "files/s", "MB/s", "speedup", "efficiency",
+        "io %", "decode %", "write %", "idle %", "peak RSS MB");
+
+    double baseWall = 0.0;
+    for (uint32_t jobs : jobCounts)
+    {
+        struct Run
+        {
+            double wallNs;
+            uint64_t stageNs[NUM_STAGES];
+            uint64_t peakRSS;
+        };
+        std::vector<Run> runs;
+        for (uint32_t r = 0; r < std::max(options.runs, 1u); ++r)
+        {
+            uint64_t calls[NUM_STAGES];
+            uint64_t before[NUM_STAGES];
+            uint64_t after[NUM_STAGES];
+            profileResetPeakRSS();
+            profileStageTotals(calls, before);
+
+            BatchOptions batch;
+            batch.jobs = jobs;
+            auto begin = std::chrono::steady_clock::now();
+            runBatch(files, batch);
+            Run run;
+            run.wallNs = elapsedNs(begin);
+
+            profileStageTotals(calls, after);
+            for (uint32_t s = 0; s < NUM_STAGES; ++s)
+                run.stageNs[s] = after[s] - before[s];
+            run.peakRSS = profilePeakRSS();
+            runs.push_back(run);
+        }
+        std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) { return a.wallNs < b.wallNs; });
+        const Run& run = runs[runs.size() / 2];
+
+        if (baseWall == 0.0)
+            baseWall = run.wallNs * jobCounts.front();
+        double speedup = baseWall / run.wallNs;
+        double workerNs = run.wallNs * jobs;
+        double io = (double)run.stageNs[(uint32_t)Stage::Read];
+        double decode = (double)(run.stageNs[(uint32_t)Stage::Header] + run.stageNs[(uint32_t)Stage::Vertex] + run.stageNs[(uint32_t)Stage::Index]);
+        double write = (double)run.stageNs[(uint32_t)Stage::Write];
+        double idle = std::max(workerNs - io - decode - write, 0.0);
+        double seconds = run.wallNs / 1e9;
+
+        printf("%6u %10.2f %10.1f %9.2f %9.2f %10.1f%% %7.1f %8.1f %7.1f %7.1f %12.1f\n", jobs, run.wallNs / 1e6,
+            files.size() / seconds, inputBytes / (1024.0 * 1024.0) / seconds, speedup, speedup / jobs * 100.0,
+            io / workerNs * 100.0, decode / workerNs * 100.0, write / workerNs * 100.0, idle / workerNs * 100.0,
+            run.peakRSS / (1024.0 * 1024.0));
+    }
+    return 0;
+}
+
+// Reader for the flat objects benchWriteJson produces; unknown keys are skipped.
+bool benchReadJson(const std::string& filename, std::vector<BenchResult>& results)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        text.append(buf, n);
+    fclose(fp);
+
+    size_t pos = text.find("\"benchmarks\"");
+    if (pos == std::string::npos)
+    {
+        printf("%s is not a benchmark result file\n", filename.c_str());
+        return false;
+    }
+
+    auto readString = [&](size_t& at, std::string& out) -> bool
+    {
+        at = text.find('"', at);
+        if (at == std::string::npos)
+            return false;
+        size_t end = text.find('"', at + 1);
+        if (end == std::string::npos)
+            return false;
+        out = text.substr(at + 1, end - at - 1);
+        at = end + 1;
+        return true;
+    };
+
+    while ((pos = text.find('{', pos)) != std::string::npos)
+    {
+        size_t end = text.find('}', pos);
+        if (end == std::string::npos)
+            break;
+
+        BenchResult r = { "", "scalar", 0, 0.0, 0.0, 0.0 };
+        size_t at = pos + 1;
+        std::string key;
+        while (at < end && readString(at, key) && at < end)
+        {
+            at = text.find(':', at) + 1;
+            while (at < end && isspace((unsigned char)text[at]))
+                ++at;
+            if (text[at] == '"')
+            {
+                std::string value;
+                readString(at, value);
+                if (key == "name")
+                    r.name = value;
+                else if (key == "variant")
+                    r.variant = value;
+            }
+            else
+            {
+                double value = strtod(text.c_str() + at, nullptr);
+                if (key == "elements")
+                    r.elements = (uint64_t)value;
+                else if (key == "median_ns")
+                    r.medianNs = value;
+                else if (key == "min_ns")
+                    r.minNs = value;
+                else if (key == "p95_ns")
+                    r.p95Ns = value;
+                at = text.find_first_of(",}", at);
+            }
+        }
+        if (!r.name.empty())
+            results.push_back(r);
+        pos = end + 1;
+    }
+    return true;
+}
+
+static const char* GATED_STAGES[] = { "parseIndexArray", "parseBlock1", "dumpBlock1ToOBJ" };
+
+static bool isGated(const std::string& name)
+{
+    for (const char* gated : GATED_STAGES)
+    {
+        if (name == gated)
+            return true;
+    }
+    return false;
+}
+
+static bool hasBench(const std::vector<BenchResult>& results, const std::string& name)
+{
+    for (const BenchResult& r : results)
+    {
+        if (r.name == name)
+            return true;
+    }
+    return false;
+}
+
+uint32_t benchCompare(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& current, double threshold)
+{
+    std::map<std::string, const BenchResult*> base;
+    for (const BenchResult& r : baseline)
+        base[r.name + "|" + r.variant] = &r;
+
+    uint32_t regressions = 0;
+    std::set<std::string> compared; // gated stages with a variant in both runs
+    printf("\n%-26s %-8s %12s %12s %9s %12s %12s %9s  %s\n", "benchmark", "variant", "base median", "median", "change",
+        "base p95", "p95", "change", "verdict");
+    for (const BenchResult& cur : current)
+    {
+        auto it = base.find(cur.name + "|" + cur.variant);
+        if (it == base.end())
+        {
+            printf("%-26s %-8s %12s %12.3f %9s %12s %12.3f %9s  new\n", cur.name.c_str(), cur.variant.c_str(), "-", cur.medianNs, "", "-", cur.p95Ns, "");
+            continue;
+        }
+
+        // A change only counts once it clears both the relative threshold
+        // and the spread (p95 - median) either run showed, so a noisy
+        // stage needs a bigger shift before it trips the gate. The best
+        // run has to move as well, which filters out a few slow samples
+        // dragging the median.
+        const BenchResult& b = *it->second;
+        if (isGated(cur.name))
+            compared.insert(cur.name);
+        double spread = std::max(std::max(b.p95Ns - b.medianNs, cur.p95Ns - cur.medianNs), 0.0);
+        double medianLimit = b.medianNs + std::max(b.medianNs * threshold, spread);
+        double minLimit = b.minNs + b.minNs * threshold;
+        double p95Limit = b.p95Ns + std::max(b.p95Ns * threshold, spread);
+        double medianChange = b.medianNs > 0 ? (cur.medianNs / b.medianNs - 1.0) * 100.0 : 0.0;
+        double p95Change = b.p95Ns > 0 ? (cur.p95Ns / b.p95Ns - 1.0) * 100.0 : 0.0;
+
+        const char* verdict = "ok";
+        if (cur.medianNs > medianLimit && cur.minNs > minLimit)
+        {
+            verdict = isGated(cur.name) ? "REGRESSION" : "slower";
+            if (isGated(cur.name))
+                regressions++;
+        }
+        else if (cur.p95Ns > p95Limit)
+        {
+            verdict = isGated(cur.name) ? "p95 REGRESSION" : "p95 slower";
+            if (isGated(cur.name))
+                regressions++;
+        }
+        else if (cur.medianNs < b.medianNs - std::max(b.medianNs * threshold, spread))
+        {
+            verdict = "faster";
+        }
+
+        printf("%-26s %-8s %12.3f %12.3f %+8.1f%% %12.3f %12.3f %+8.1f%%  %s\n", cur.name.c_str(), cur.variant.c_str(),
+            b.medianNs, cur.medianNs, medianChange, b.p95Ns, cur.p95Ns, p95Change, verdict);
+    }
+
+    // A gated stage that wasn't compared (--filter, a rename, a cut-off
+    // baseline, runs at different --isa levels) can't be shown not to have
+    // regressed, so it fails the gate too.
+    for (const char* gated : GATED_STAGES)
+    {
+        if (compared.count(gated) > 0)
+            continue;
+        bool inBaseline = hasBench(baseline, gated);
+        bool inCurrent = hasBench(current, gated);
+        const char* why = !inBaseline && !inCurrent ? "missing from the baseline and this run" : !inBaseline ? "missing from the baseline" :
+            !inCurrent ? "missing from this run" : "no variant in both runs";
+        printf("%-26s %-8s %s\n", gated, "", why);
+        regressions++;
+    }
+    return regressions;
+}
+
+bool benchParseOptions(int argc, char* argv[], int first, BenchOptions& options)
+{
+    for (int i = first; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--size" && hasValue)
+            options.size = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--warmup" && hasValue)
+            options.warmup = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--reps" && hasValue)
+            options.reps = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--filter" && hasValue)
+            options.filter = argv[++i];
+        else if (arg == "--json" && hasValue)
+            options.jsonFile = argv[++i];
+        else if (arg == "--list")
+            options.list = true;
+        else if (arg == "--no-corpus")
+            options.corpus = false;
+        else if (arg == "--compare" && hasValue)
+            options.compareFile = argv[++i];
+        else if (arg == "--threshold" && hasValue)
+            options.threshold = atof(argv[++i]) / 100.0;
+        else if (arg == "--scaling")
+            options.scaling = true;
+        else if (arg == "--corpus" && hasValue)
+            options.corpusPath = argv[++i];
+        else if (arg == "--max-jobs" && hasValue)
+            options.maxJobs = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--runs" && hasValue)
+            options.runs = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--isa" && hasValue)
+            options.isa = argv[++i];
+        else if (arg.compare(0, 6, "--isa=") == 0)
+            options.isa = arg.substr(6);
+        else
+            return false;
+    }
+    return true;
+}
+
+void printBenchUsage()
+{
+    printf("Usage geomparse bench [options]\n");
+    printf("      geomparse_bench [options]\n");
+    printf("  --size N       elements per run, vertices/triangles for mesh stages (default 8192)\n");
+    printf("  --warmup N     untimed runs before measuring (default 3)\n");
+    printf("  --reps N       timed runs, reported as min/median/p95 (default 15)\n");
+    printf("  --filter str   only run benchmarks whose name contains str\n");
+    printf("  --json file    also write the results as JSON\n");
+    printf("  --list         list the benchmarks and exit\n");
+    printf("  --no-corpus    skip the synthetic corpus conversion\n");
+    printf("  --compare file compare against a stored --json run, fail when the median or p95 of\n");
+    printf("                 parseIndexArray, parseBlock1 or dumpBlock1ToOBJ regressed, or when one of them\n");
+    printf("                 wasn't compared at any variant (--isa) present in both runs\n");
+    printf("  --threshold P  allowed slowdown in percent before noise (default 10)\n");
+    printf("  --scaling      convert a corpus at 1, 2, 4 ... N workers and report scaling\n");
+    printf("  --corpus path  corpus for --scaling: directory, list.txt or file (default synthetic)\n");
+    printf("  --max-jobs N   largest worker count for --scaling (default hardware threads)\n");
+    printf("  --runs N       conversions per worker count for --scaling (default 3)\n");
+    printf("  --isa level    scalar|sse|avx2|avx512, only bench that level (default all supported)\n");
+}
+
+int benchMain(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!benchParseOptions(argc, argv, 1, options))
+    {
+        printBenchUsage();
+        return -1;
+    }
+
+    if (!options.isa.empty() && !kernelsSelect(options.isa.c_str()))
+        return -1;
+    Isa selected = g_kernels.isa;
+
+    if (options.scaling)
+        return benchScaling(options);
+
+    std::vector<BenchResult> baseline;
+    if (!options.compareFile.empty() && !benchReadJson(options.compareFile, baseline))
+        return -1;
+
+    std::vector<BenchCase> cases = benchCases(options);
+    std::vector<BenchResult> results;
+    if (!options.list)
+        benchPrintHeader();
+    for (const BenchCase& c : cases)
+    {
+        if (!options.filter.empty() && c.name.find(options.filter) == std::string::npos)
+            continue;
+        if (options.list)
+        {
+            printf("%s %s\n", c.name.c_str(), c.variant.c_str());
+            continue;
+        }
+        results.push_back(runBench(c, options));
+        benchPrintResult(results.back());
+    }
+
+    // The per-level cases leave the last level bound.
+    kernelsSelect(selected);
+
+    if (options.corpus && !options.list && (options.filter.empty() || std::string("corpus/").find(options.filter) != std::string::npos ||
+        options.filter.find("corpus") != std::string::npos))
+    {
+        for (const BenchResult& r : benchCorpus(options))
+        {
+            results.push_back(r);
+            benchPrintResult(r);
+        }
+    }
+
+    if (!options.jsonFile.empty() && !benchWriteJson(options.jsonFile, results))
+        return -1;
+
+    if (!baseline.empty())
+    {
+        uint32_t regressions = benchCompare(baseline, results, options.threshold);
+        if (regressions > 0)
+        {
+            printf("%u gated stage(s) regressed or missing against %s\n", regressions, options.compareFile.c_str());
+            return 1;
+        }
+        printf("No gated regressions against %s\n", options.compareFile.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Microbenchmarks for the decode primitives and per-mesh stages. Every case
+// runs over in-memory buffers; results are reported per element so cases of
+// different sizes and kernel variants can be compared directly.
+
+struct BenchOptions
+{
+    uint32_t size = 8192;
+    uint32_t warmup = 3;
+    uint32_t reps = 15;
+    std::string filter;
+    std::string jsonFile;
+    bool list = false;
+    bool corpus = true;
+    // Regression gate: compare against a stored --json run.
+    std::string compareFile;
+    double threshold = 0.10;
+    // Thread-scaling mode: convert a corpus at 1, 2, 4 ... maxJobs workers.
+    bool scaling = false;
+    std::string corpusPath;
+    uint32_t maxJobs = 0;
+    uint32_t runs = 3;
+    // Decode kernel level, empty runs every supported one.
+    std::string isa;
+};
+
+struct BenchCase
+{
+    std::string name;
+    std::string variant;
+    uint64_t elements;
+    // Called before every timed run to restore state the run consumes.
+    std::function<void()> setup;
+    std::function<void()> run;
+};
+
+struct BenchResult
+{
+    std::string name;
+    std::string variant;
+    uint64_t elements;
+    double minNs;
+    double medianNs;
+    double p95Ns;
+};
+
+// Keeps results alive so the optimizer can't drop the measured work.
+extern volatile uint64_t g_benchSink;
+
+std::vector<BenchCase> benchCases(const BenchOptions& options);
+BenchResult runBench(const BenchCase& bench, const BenchOptions& options);
+
+// Converts a fixed synthetic corpus in memory (OBJ text goes to the null
+// device) and reports each stage as "corpus/<stage>" per element.
+std::vector<BenchResult> benchCorpus(const BenchOptions& options);
+
+void benchPrintHeader();
+void benchPrintResult(const BenchResult& result);
+bool benchWriteJson(const std::string& filename, const std::vector<BenchResult>& results);
+bool benchReadJson(const std::string& filename, std::vector<BenchResult>& results);
+
+// Converts options.corpusPath (or a generated corpus) at growing worker
+// counts and prints throughput, speedup, efficiency, where the worker time
+// went and peak RSS for each.
+int benchScaling(const BenchOptions& options);
+
+// Prints a per-benchmark comparison and returns the number of regressions in
+// the gated stages (parseIndexArray, parseBlock1, dumpBlock1ToOBJ), median
+// or p95, plus one for each of them not compared at a single variant, e.g.
+// missing from either side or only run at different --isa levels.
+uint32_t benchCompare(const std::vector<BenchResult>& baseline, const std::vector<BenchResult>& current, double threshold);
+
+// Parses bench options from argv[first...]. Returns false on unknown args.
+bool benchParseOptions(int argc, char* argv[], int first, BenchOptions& options);
+void printBenchUsage();
+
+int benchMain(int argc, char* argv[]);
@@ -0,0 +1,546 @@
+#include "daemon.hpp"
+#include "batch.hpp"
+#include "export.hpp"
+#include "geom.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <thread>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+static volatile sig_atomic_t g_stop = 0;
+
+// Clients are served one at a time, so one that doesn't finish a request
+// in time is dropped rather than left to stall the rest.
+static const uint64_t REQUEST_TIMEOUT_NS = 5000000000ull;
+
+static void onSignal(int)
+{
+    g_stop = 1;
+}
+
+struct LineReader
+{
+    int fd;
+    std::string buffer;
+    size_t at = 0;
+    // Descriptors that came along with the data, in order.
+    std::deque<int> fds;
+    // profileNow() past which readLine gives up, 0 to wait for ever.
+    uint64_t deadline = 0;
+    bool timedOut = false;
+
+    LineReader(int fd)
+        : fd(fd)
+    {
+    }
+
+    ~LineReader()
+    {
+        for (int received : fds)
+            close(received);
+    }
+
+    // false at the end of the stream, on a signal or past the deadline
+    bool readLine(std::string& line)
+    {
+        for (;;)
+        {
+            size_t end = buffer.find('\n', at);
+            if (end != std::string::npos)
+            {
+                line = buffer.substr(at, end - at);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                at = end + 1;
+                return true;
+            }
+            buffer.erase(0, at);
+            at = 0;
+
+            if (deadline > 0)
+            {
+                uint64_t now = profileNow();
+                pollfd pfd = { fd, POLLIN, 0 };
+                int ready = now < deadline ? poll(&pfd, 1, (int)((deadline - now + 999999) / 1000000)) : 0;
+                if (ready < 0 && errno == EINTR && !g_stop)
+                    continue;
+                timedOut = ready == 0;
+                if (ready <= 0)
+                    return false;
+            }
+
+            char chunk[4096];
+            iovec iov = { chunk, sizeof(chunk) };
+            union
+            {
+                cmsghdr header;
+                char bytes[CMSG_SPACE(sizeof(int) * 16)];
+            } control;
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control.bytes;
+            msg.msg_controllen = sizeof(control.bytes);
+            ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+            if (n < 0 && errno == EINTR && !g_stop)
+                continue;
+            if (n <= 0)
+                return false;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                    continue;
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    int received;
+                    memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    fds.push_back(received);
+                }
+            }
+            buffer.append(chunk, (size_t)n);
+        }
+    }
+};
+
+static bool sendAll(int fd, const std::string& text)
+{
+    size_t sent = 0;
+    while (sent < text.size())
+    {
+        ssize_t n = write(fd, text.data() + sent, text.size() - sent);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// Sends text with fd attached to its first byte.
+static bool sendWithFd(int socket, const std::string& text, int fd)
+{
+    iovec iov = { (void*)text.data(), text.size() };
+    union
+    {
+        cmsghdr header;
+        char bytes[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = sizeof(control.bytes);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n;
+    do
+    {
+        n = sendmsg(socket, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    return n > 0 && sendAll(socket, text.substr((size_t)n));
+}
+
+static bool socketAddress(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    {
+        printf("Invalid socket path %s\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static int connectSocket(const sockaddr_un& addr)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct Server
+{
+    TaskScheduler scheduler;
+    MaterialCache materials;
+    uint64_t started;
+    uint64_t requests = 0;
+    uint64_t files = 0;
+    uint64_t busyNs = 0;
+
+    Server(uint32_t workers)
+        : scheduler(workers), started(profileNow())
+    {
+    }
+
+    // For export, fds gets one memfd (or -1) per input, for the reply line
+    // of that input; the caller closes them.
+    std::string handle(const std::string& command, const std::vector<std::string>& paths, bool& shutdown, std::vector<int>& fds)
+    {
+        std::string reply;
+        ++requests;
+        if (command == "convert" || command == "decode" || command == "export")
+        {
+            BatchOptions options;
+            options.jobs = scheduler.numWorkers();
+            options.write = command == "convert";
+            options.scheduler = &scheduler;
+            options.materials = &materials;
+            if (command == "export")
+            {
+                fds.assign(paths.size(), -1);
+                options.decoded = [&fds](const FileJob& job)
+                {
+                    fds[job.index] = exportToMemfd("geomparse.gpx", *job.geom, *job.mat);
+                    return fds[job.index] >= 0;
+                };
+            }
+            uint64_t start = profileNow();
+            std::vector<FileResult> results = runBatch(paths, options);
+            uint64_t ns = profileNow() - start;
+            fflush(stdout);
+
+            for (size_t i = 0; i < paths.size(); ++i)
+            {
+                const FileResult& r = results[i];
+                appendf(reply, "%s\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t", fileStatusName(r.status), r.meshes, r.vertices, r.triangles, r.ns);
+                reply += paths[i];
+                if (options.write && r.status == FileStatus::Converted)
+                {
+                    for (uint32_t m = 0; m < r.meshes; ++m)
+                        reply += "\t" + meshObjPath(paths[i], m);
+                }
+                if (!fds.empty())
+                {
+                    struct stat st;
+                    uint64_t bytes = fds[i] >= 0 && fstat(fds[i], &st) == 0 ? (uint64_t)st.st_size : 0;
+                    appendf(reply, "\t%" PRIu64, bytes);
+                }
+                reply += "\n";
+            }
+            files += paths.size();
+            busyNs += ns;
+            appendf(reply, "done %zu %" PRIu64 "\n\n", paths.size(), ns);
+        }
+        else if (command == "stats")
+        {
+            appendf(reply, "workers %u\n", scheduler.numWorkers());
+            appendf(reply, "requests %" PRIu64 "\n", requests);
+            appendf(reply, "files %" PRIu64 "\n", files);
+            appendf(reply, "busy_ns %" PRIu64 "\n", busyNs);
+            appendf(reply, "uptime_ns %" PRIu64 "\n", profileNow() - started);
+            appendf(reply, "materials_cached %zu\n", materials.size());
+            appendf(reply, "material_hits %" PRIu64 "\n", materials.hits());
+            appendf(reply, "material_misses %" PRIu64 "\n", materials.misses());
+            reply += "done 0 0\n\n";
+        }
+        else if (command == "shutdown")
+        {
+            shutdown = true;
+            reply = "done 0 0\n\n";
+        }
+        else
+        {
+            reply = "error unknown command " + command + "\n\n";
+        }
+        return reply;
+    }
+};
+
+static void printServeUsage()
+{
+    printf("Usage geomparse serve --socket path [--jobs N]\n");
+    printf("  --socket path  Unix domain socket to listen on\n");
+    printf("  --jobs N       worker threads kept for all requests (default one per core)\n");
+}
+
+int serveMain(int argc, char* argv[])
+{
+    std::string path;
+    uint32_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc)
+        {
+            jobs = (uint32_t)std::max(1, atoi(argv[++i]));
+        }
+        else
+        {
+            printServeUsage();
+            return -1;
+        }
+    }
+    sockaddr_un addr;
+    if (path.empty())
+    {
+        printServeUsage();
+        return -1;
+    }
+    if (!socketAddress(path, addr))
+        return -1;
+
+    // A socket left behind by a server that is gone is replaced, a live
+    // one isn't.
+    int probe = connectSocket(addr);
+    if (probe >= 0)
+    {
+        close(probe);
+        printf("A server is already listening on %s\n", path.c_str());
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+        printf("Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    // No SA_RESTART, so a signal gets the server out of accept().
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // The workers start with the signals blocked, so they always land on
+    // this thread and interrupt accept().
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    Server server(jobs);
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+    printf("listening on %s with %u workers\n", path.c_str(), jobs);
+    fflush(stdout);
+
+    bool shutdown = false;
+    while (!shutdown && !g_stop)
+    {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("accept failed: %s\n", strerror(errno));
+            break;
+        }
+
+        LineReader reader(client);
+        reader.deadline = profileNow() + REQUEST_TIMEOUT_NS;
+        std::string command;
+        while (!shutdown && reader.readLine(command))
+        {
+            if (command.empty())
+                continue;
+            std::vector<std::string> paths;
+            std::string line;
+            bool complete = false;
+            while (reader.readLine(line))
+            {
+                if (line.empty())
+                {
+                    complete = true;
+                    break;
+                }
+                paths.push_back(line);
+            }
+            if (!complete)
+                break;
+            std::vector<int> fds;
+            std::string reply = server.handle(command, paths, shutdown, fds);
+            bool sent = true;
+            size_t at = 0;
+            for (int fd : fds)
+            {
+                size_t end = reply.find('\n', at) + 1;
+                std::string line = reply.substr(at, end - at);
+                sent = sent && (fd < 0 ? sendAll(client, line) : sendWithFd(client, line, fd));
+                if (fd >= 0)
+                    close(fd);
+                at = end;
+            }
+            if (!sent || !sendAll(client, reply.substr(at)))
+                break;
+            reader.deadline = profileNow() + REQUEST_TIMEOUT_NS;
+        }
+        if (reader.timedOut)
+        {
+            printf("dropped a client that sent no complete request in %" PRIu64 " s\n", REQUEST_TIMEOUT_NS / 1000000000);
+            fflush(stdout);
+        }
+        close(client);
+    }
+
+    close(fd);
+    unlink(path.c_str());
+    return 0;
+}
+
+static void printClientUsage()
+{
+    printf("Usage geomparse client --socket path convert|decode|export|stats|shutdown [mesh|dir|list.txt...]\n");
+    printf("  Sends one request to a geomparse serve and prints the reply. Inputs\n");
+    printf("  are sent as absolute paths. Exported blocks are mapped and summarized.\n");
+    printf("  Exits non-zero if a file wasn't converted.\n");
+}
+
+int clientMain(int argc, char* argv[])
+{
+    std::string path;
+    std::string command;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+        else if (arg[0] == '-')
+        {
+            printClientUsage();
+            return -1;
+        }
+        else if (command.empty())
+        {
+            command = arg;
+        }
+        else if (!collectInputs(arg, files))
+        {
+            return -1;
+        }
+    }
+    sockaddr_un addr;
+    if (path.empty() || command.empty())
+    {
+        printClientUsage();
+        return -1;
+    }
+    if (!socketAddress(path, addr))
+        return -1;
+
+    signal(SIGPIPE, SIG_IGN);
+    int fd = connectSocket(addr);
+    if (fd < 0)
+    {
+        printf("Could not connect to %s: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    std::string request = command + "\n";
+    for (const std::string& file : files)
+    {
+        std::error_code ec;
+        std::filesystem::path absolute = std::filesystem::absolute(file, ec);
+        request += (ec ? file : absolute.generic_string()) + "\n";
+    }
+    request += "\n";
+
+    int result = -1;
+    bool replied = false;
+    if (sendAll(fd, request))
+    {
+        LineReader reader(fd);
+        std::string line;
+        bool failed = false;
+        while (reader.readLine(line) && !line.empty())
+        {
+            printf("%s\n", line.c_str());
+            size_t tab = line.find_last_of('\t');
+            if (command == "export" && tab != std::string::npos && strtoull(line.c_str() + tab + 1, nullptr, 10) > 0 && !reader.fds.empty())
+            {
+                int exported = reader.fds.front();
+                reader.fds.pop_front();
+                ExportMapping mapping;
+                if (mapping.mapFd(exported))
+                {
+                    const ExportHeader* h = exportHeader(mapping.data);
+                    uint64_t vertices = 0;
+                    for (uint32_t m = 0; m < h->numMeshes; ++m)
+                        vertices += exportMeshes(mapping.data)[m].numVertices;
+                    printf("  mapped %" PRIu64 " bytes: %u meshes, %u materials, %" PRIu64 " vertices, aabb (%g %g %g) (%g %g %g)\n", mapping.size,
+                        h->numMeshes, h->numMaterials, vertices, h->aabbMin[0], h->aabbMin[1], h->aabbMin[2], h->aabbMax[0], h->aabbMax[1], h->aabbMax[2]);
+                }
+                else
+                {
+                    printf("  could not map the exported block\n");
+                    failed = true;
+                }
+                close(exported);
+            }
+            if (line.compare(0, 5, "done ") == 0)
+                result = failed ? 1 : 0;
+            else if (line.find('\t') != std::string::npos && line.compare(0, 10, "converted\t") != 0)
+                failed = true;
+            replied = line.compare(0, 5, "done ") == 0 || line.compare(0, 6, "error ") == 0;
+        }
+    }
+    if (!replied)
+        printf("No reply from %s\n", path.c_str());
+    close(fd);
+    return result;
+}
+
+#else
+
+int serveMain(int, char*[])
+{
+    printf("geomparse serve needs Unix domain sockets, which this build doesn't support\n");
+    return -1;
+}
+
+int clientMain(int, char*[])
+{
+    printf("geomparse client needs Unix domain sockets, which this build doesn't support\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Resident converter for tools that convert a few files at a time, so they
+// don't pay process startup and cold caches per call. `geomparse serve`
+// listens on a Unix domain socket and keeps its worker threads and the
+// parsed .mat.edge files between requests; `geomparse client` is the
+// command line end of it.
+//
+// The protocol is plain text. A request is a command line, then one input
+// path per line, then an empty line:
+//
+//     convert | decode | export | stats | shutdown
+//
+// convert writes the usual .obj/.mtl files, decode only decodes, export
+// hands back each Geom as a sealed memfd holding an export block (see
+// export.hpp). Relative paths are resolved against the server's working
+// directory. The reply has one line per input, tab separated:
+//
+//     status  meshes  vertices  triangles  ns  input  [obj...]
+//
+// with status as in a manifest, then "done <files> <ns>" (or "error
+// <message>") and an empty line. stats replies with "key value" lines.
+// Requests on a connection are answered in order; connections are served
+// one at a time, each batch using every worker.
+//
+// For export the last field is the block size instead of the OBJ files;
+// when it isn't 0 the memfd comes with the line as SCM_RIGHTS.
+
+int serveMain(int argc, char* argv[]);
+int clientMain(int argc, char* argv[]);
@@ -0,0 +1,587 @@
+#include "export.hpp"
+#include "batch.hpp"
+#include "geom.hpp"
+
+#include <cerrno>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A source mesh within an export mesh: where its vertices, meshlets,
+// meshlet vertices and meshlet triangles start there, and the bound its
+// indices must stay under (none when it is exported on its own).
+struct ExportPart
+{
+    const GeomMeshHeader* mesh;
+    uint32_t vertexBase;
+    uint32_t meshletBase;
+    uint32_t meshletVertexBase;
+    uint32_t meshletTriangleBase;
+    uint32_t limit;
+};
+
+struct ExportLayout
+{
+    ExportHeader header;
+    std::vector<ExportMesh> meshes;
+    std::vector<std::vector<ExportPart>> parts; // per mesh
+    std::vector<std::vector<ExportLod>> lods;   // per mesh
+    std::vector<ExportMaterial> materials;
+    std::string strings;
+};
+
+static uint64_t alignExport(uint64_t offset)
+{
+    return (offset + EXPORT_ALIGNMENT - 1) & ~(uint64_t)(EXPORT_ALIGNMENT - 1);
+}
+
+static uint32_t addString(std::string& strings, const std::string& str)
+{
+    uint32_t offset = (uint32_t)strings.size();
+    strings += str;
+    strings += '\0';
+    return offset;
+}
+
+static uint32_t exportVertices(const GeomMeshHeader& h)
+{
+    return std::min<uint32_t>(h.num_vertices, (uint32_t)h.meshBlock1.size());
+}
+
+// Level l of a source mesh for a merged export mesh with more levels than
+// it has: its coarsest one, or LOD0 when it has none.
+static const std::vector<MeshTriangle>& exportLod(const GeomMeshHeader& h, size_t level)
+{
+    if (h.lods.empty())
+        return h.outputTriangles();
+    return h.lods[std::min(level, h.lods.size() - 1)];
+}
+
+// The source meshes of each export mesh: one each, or all of a material's
+// in order of first use.
+static std::vector<std::vector<uint32_t>> exportGroups(const Geom& geom, bool mergeMaterials)
+{
+    std::vector<std::vector<uint32_t>> groups;
+    std::vector<int32_t> groupOfMaterial(256, -1);
+    for (uint32_t i = 0; i < (uint32_t)geom.meshHeaders.size(); ++i)
+    {
+        if (!mergeMaterials)
+        {
+            groups.push_back(std::vector<uint32_t>(1, i));
+            continue;
+        }
+        int32_t& group = groupOfMaterial[geom.meshHeaders[i].materialId];
+        if (group < 0)
+        {
+            group = (int32_t)groups.size();
+            groups.emplace_back();
+        }
+        groups[group].push_back(i);
+    }
+    return groups;
+}
+
+// The triangles of tris the part keeps, raising maxIndex to their largest
+// rebased index.
+static uint32_t countTriangles(const std::vector<MeshTriangle>& tris, const ExportPart& part, uint32_t& maxIndex)
+{
+    uint32_t count = 0;
+    for (const MeshTriangle& tri : tris)
+    {
+        uint32_t top = std::max(tri.t_, std::max(tri.tt_, tri.ttt_));
+        if (top >= part.limit)
+            continue;
+        maxIndex = std::max(maxIndex, part.vertexBase + top);
+        ++count;
+    }
+    return count;
+}
+
+static void boundMesh(const std::vector<ExportPart>& parts, ExportMesh& m)
+{
+    if (m.numVertices == 0)
+        return;
+    for (uint32_t c = 0; c < 3; ++c)
+    {
+        m.aabbMin[c] = FLT_MAX;
+        m.aabbMax[c] = -FLT_MAX;
+    }
+    for (const ExportPart& part : parts)
+    {
+        uint32_t numVertices = exportVertices(*part.mesh);
+        for (uint32_t v = 0; v < numVertices; ++v)
+        {
+            const MeshVertex& vertex = part.mesh->meshBlock1[v];
+            const float position[3] = { vertex.vx, vertex.vy, vertex.vz };
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                m.aabbMin[c] = std::min(m.aabbMin[c], position[c]);
+                m.aabbMax[c] = std::max(m.aabbMax[c], position[c]);
+            }
+        }
+    }
+}
+
+static ExportLayout layoutExport(const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+    ExportLayout layout;
+    for (const GeomMaterialEntry& e : material.materialEntries)
+    {
+        ExportMaterial m;
+        m.id = e.id;
+        m.name = e.textures.size() > 0 ? addString(layout.strings, e.textures[0].name) : EXPORT_NO_STRING;
+        m.diffuse = e.textures.size() > 0 ? addString(layout.strings, e.textures[0].texfile) : EXPORT_NO_STRING;
+        m.normal = e.textures.size() > 1 ? addString(layout.strings, e.textures[1].texfile) : EXPORT_NO_STRING;
+        layout.materials.push_back(m);
+    }
+
+    std::vector<std::vector<uint32_t>> groups = exportGroups(geom, options.mergeMaterials);
+
+    ExportHeader& h = layout.header;
+    memset(&h, 0, sizeof(h));
+    h.magic = EXPORT_MAGIC;
+    h.version = EXPORT_VERSION;
+    h.numMeshes = (uint32_t)groups.size();
+    h.numMaterials = (uint32_t)layout.materials.size();
+    h.aabbMin[0] = geom.aabb.minX;
+    h.aabbMin[1] = geom.aabb.minY;
+    h.aabbMin[2] = geom.aabb.minZ;
+    h.aabbMax[0] = geom.aabb.maxX;
+    h.aabbMax[1] = geom.aabb.maxY;
+    h.aabbMax[2] = geom.aabb.maxZ;
+
+    uint64_t offset = sizeof(ExportHeader);
+    h.meshTable = offset;
+    offset += sizeof(ExportMesh) * h.numMeshes;
+    h.materialTable = offset;
+    offset += sizeof(ExportMaterial) * h.numMaterials;
+    h.strings = offset;
+    h.stringsSize = layout.strings.size();
+    offset += h.stringsSize;
+
+    for (const std::vector<uint32_t>& group : groups)
+    {
+        ExportMesh m;
+        memset(&m, 0, sizeof(m));
+        m.materialId = geom.meshHeaders[group[0]].materialId;
+
+        std::vector<ExportPart> parts;
+        uint32_t maxIndex = 0;
+        for (uint32_t i : group)
+        {
+            const GeomMeshHeader& src = geom.meshHeaders[i];
+            ExportPart part;
+            part.mesh = &src;
+            part.vertexBase = m.numVertices;
+            part.meshletBase = m.numMeshlets;
+            part.meshletVertexBase = m.numMeshletVertices;
+            part.meshletTriangleBase = m.numMeshletTriangles;
+            part.limit = group.size() > 1 ? exportVertices(src) : UINT32_MAX;
+            m.numVertices += exportVertices(src);
+            m.numTriangles += countTriangles(src.outputTriangles(), part, maxIndex);
+            m.numMeshlets += (uint32_t)src.meshlets.size();
+            m.numMeshletVertices += (uint32_t)src.meshletVertices.size();
+            m.numMeshletTriangles += (uint32_t)(src.meshletTriangles.size() / 3);
+            m.numLods = std::max(m.numLods, (uint32_t)src.lods.size());
+            parts.push_back(part);
+        }
+        boundMesh(parts, m);
+
+        // The LODs index the same vertices, with the same index size.
+        std::vector<ExportLod> lods(m.numLods);
+        for (uint32_t l = 0; l < m.numLods; ++l)
+        {
+            for (const ExportPart& part : parts)
+                lods[l].numTriangles += countTriangles(exportLod(*part.mesh, l), part, maxIndex);
+        }
+
+        m.indexSize = maxIndex > 0xFFFF ? 4 : 2;
+        for (uint32_t s = 0; s < (uint32_t)ExportStream::Count; ++s)
+        {
+            offset = alignExport(offset);
+            m.streams[s] = offset;
+            offset += sizeof(float) * (uint64_t)m.numVertices;
+        }
+        offset = alignExport(offset);
+        m.indices = offset;
+        offset += (uint64_t)m.indexSize * 3 * m.numTriangles;
+
+        offset = alignExport(offset);
+        m.meshlets = offset;
+        offset += sizeof(ExportMeshlet) * (uint64_t)m.numMeshlets;
+        offset = alignExport(offset);
+        m.meshletVertices = offset;
+        offset += sizeof(uint32_t) * (uint64_t)m.numMeshletVertices;
+        offset = alignExport(offset);
+        m.meshletTriangles = offset;
+        offset += 3 * (uint64_t)m.numMeshletTriangles;
+
+        offset = alignExport(offset);
+        m.lods = offset;
+        offset += sizeof(ExportLod) * (uint64_t)m.numLods;
+        for (ExportLod& l : lods)
+        {
+            offset = alignExport(offset);
+            l.indices = offset;
+            offset += (uint64_t)m.indexSize * 3 * l.numTriangles;
+        }
+        layout.meshes.push_back(m);
+        layout.parts.push_back(parts);
+        layout.lods.push_back(lods);
+    }
+    h.size = alignExport(offset);
+    return layout;
+}
+
+uint64_t exportSize(const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+    return layoutExport(geom, material, options).header.size;
+}
+
+// The triangles of tris the part keeps, rebased; returns the end.
+template <typename Index>
+static uint8_t* writeIndicesAs(const std::vector<MeshTriangle>& tris, const ExportPart& part, uint8_t* out)
+{
+    Index* indices = (Index*)out;
+    for (const MeshTriangle& tri : tris)
+    {
+        if (std::max(tri.t_, std::max(tri.tt_, tri.ttt_)) >= part.limit)
+            continue;
+        *indices++ = (Index)(part.vertexBase + tri.t_);
+        *indices++ = (Index)(part.vertexBase + tri.tt_);
+        *indices++ = (Index)(part.vertexBase + tri.ttt_);
+    }
+    return (uint8_t*)indices;
+}
+
+static uint8_t* writeIndices(const std::vector<MeshTriangle>& tris, const ExportPart& part, uint32_t indexSize, uint8_t* out)
+{
+    return indexSize == 2 ? writeIndicesAs<uint16_t>(tris, part, out) : writeIndicesAs<uint32_t>(tris, part, out);
+}
+
+void writeExport(const Geom& geom, const GeomMaterial& material, uint8_t* out, uint64_t size, const ExportOptions& options)
+{
+    ExportLayout layout = layoutExport(geom, material, options);
+    const ExportHeader& h = layout.header;
+    if (size < h.size)
+        throw std::runtime_error("export block too small");
+
+    memset(out, 0, h.size);
+    memcpy(out, &h, sizeof(h));
+    memcpy(out + h.meshTable, layout.meshes.data(), sizeof(ExportMesh) * layout.meshes.size());
+    memcpy(out + h.materialTable, layout.materials.data(), sizeof(ExportMaterial) * layout.materials.size());
+    memcpy(out + h.strings, layout.strings.data(), layout.strings.size());
+
+    for (size_t i = 0; i < layout.meshes.size(); ++i)
+    {
+        const ExportMesh& m = layout.meshes[i];
+        const std::vector<ExportLod>& lods = layout.lods[i];
+        memcpy(out + m.lods, lods.data(), sizeof(ExportLod) * lods.size());
+
+        float* streams[(uint32_t)ExportStream::Count];
+        for (uint32_t s = 0; s < (uint32_t)ExportStream::Count; ++s)
+            streams[s] = (float*)(out + m.streams[s]);
+        uint8_t* indices = out + m.indices;
+        std::vector<uint8_t*> lodIndices;
+        for (const ExportLod& l : lods)
+            lodIndices.push_back(out + l.indices);
+        ExportMeshlet* meshlets = (ExportMeshlet*)(out + m.meshlets);
+        uint32_t* meshletVertices = (uint32_t*)(out + m.meshletVertices);
+
+        for (const ExportPart& part : layout.parts[i])
+        {
+            const GeomMeshHeader& src = *part.mesh;
+
+            // Vertices past the texture block decode with zero UVs, and
+            // keep them when weld or optimize renumber them.
+            uint32_t numVertices = exportVertices(src);
+            for (uint32_t v = 0; v < numVertices; ++v)
+            {
+                const MeshVertex& vertex = src.meshBlock1[v];
+                uint32_t dst = part.vertexBase + v;
+                streams[(uint32_t)ExportStream::PositionX][dst] = vertex.vx;
+                streams[(uint32_t)ExportStream::PositionY][dst] = vertex.vy;
+                streams[(uint32_t)ExportStream::PositionZ][dst] = vertex.vz;
+                streams[(uint32_t)ExportStream::NormalX][dst] = vertex.nx;
+                streams[(uint32_t)ExportStream::NormalY][dst] = vertex.ny;
+                streams[(uint32_t)ExportStream::NormalZ][dst] = vertex.nz;
+                streams[(uint32_t)ExportStream::TexCoordU][dst] = vertex.tx;
+                streams[(uint32_t)ExportStream::TexCoordV][dst] = vertex.ty;
+            }
+
+            indices = writeIndices(src.outputTriangles(), part, m.indexSize, indices);
+
+            for (size_t j = 0; j < src.meshlets.size(); ++j)
+            {
+                const Meshlet& meshlet = src.meshlets[j];
+                ExportMeshlet& e = meshlets[part.meshletBase + j];
+                e.vertexOffset = part.meshletVertexBase + meshlet.vertexOffset;
+                e.triangleOffset = part.meshletTriangleBase + meshlet.triangleOffset;
+                e.vertexCount = meshlet.vertexCount;
+                e.triangleCount = meshlet.triangleCount;
+                memcpy(e.center, meshlet.center, sizeof(e.center));
+                e.radius = meshlet.radius;
+                memcpy(e.coneAxis, meshlet.coneAxis, sizeof(e.coneAxis));
+                e.coneCutoff = meshlet.coneCutoff;
+                memcpy(e.coneApex, meshlet.coneApex, sizeof(e.coneApex));
+            }
+            for (size_t j = 0; j < src.meshletVertices.size(); ++j)
+                meshletVertices[part.meshletVertexBase + j] = part.vertexBase + src.meshletVertices[j];
+            memcpy(out + m.meshletTriangles + 3 * (uint64_t)part.meshletTriangleBase, src.meshletTriangles.data(), src.meshletTriangles.size() / 3 * 3);
+
+            for (size_t l = 0; l < lods.size(); ++l)
+                lodIndices[l] = writeIndices(exportLod(src, l), part, m.indexSize, lodIndices[l]);
+        }
+    }
+}
+
+static bool inside(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+    return offset <= size && bytes <= size - offset;
+}
+
+bool exportValid(const void* data, uint64_t size)
+{
+    if (data == nullptr || size < sizeof(ExportHeader))
+        return false;
+    const ExportHeader& h = *exportHeader(data);
+    if (h.magic != EXPORT_MAGIC || h.version != EXPORT_VERSION || h.size > size)
+        return false;
+    size = h.size;
+    if (h.meshTable % 8 != 0 || h.materialTable % 4 != 0 ||
+        !inside(h.meshTable, (uint64_t)h.numMeshes * sizeof(ExportMesh), size) ||
+        !inside(h.materialTable, (uint64_t)h.numMaterials * sizeof(ExportMaterial), size) ||
+        !inside(h.strings, h.stringsSize, size))
+        return false;
+    const char* strings = (const char*)data + h.strings;
+    if (h.stringsSize > 0 && strings[h.stringsSize - 1] != '\0')
+        return false;
+
+    const ExportMaterial* materials = exportMaterials(data);
+    for (uint32_t i = 0; i < h.numMaterials; ++i)
+    {
+        const uint32_t offsets[3] = { materials[i].name, materials[i].diffuse, materials[i].normal };
+        for (uint32_t offset : offsets)
+        {
+            if (offset != EXPORT_NO_STRING && offset >= h.stringsSize)
+                return false;
+        }
+    }
+
+    const ExportMesh* meshes = exportMeshes(data);
+    for (uint32_t i = 0; i < h.numMeshes; ++i)
+    {
+        const ExportMesh& m = meshes[i];
+        if (m.indexSize != 2 && m.indexSize != 4)
+            return false;
+        for (uint64_t offset : m.streams)
+        {
+            if (offset % sizeof(float) != 0 || !inside(offset, sizeof(float) * (uint64_t)m.numVertices, size))
+                return false;
+        }
+        if (m.indices % m.indexSize != 0 || !inside(m.indices, (uint64_t)m.indexSize * 3 * m.numTriangles, size))
+            return false;
+        if (m.meshlets % 4 != 0 || m.meshletVertices % 4 != 0 ||
+            !inside(m.meshlets, sizeof(ExportMeshlet) * (uint64_t)m.numMeshlets, size) ||
+            !inside(m.meshletVertices, sizeof(uint32_t) * (uint64_t)m.numMeshletVertices, size) ||
+            !inside(m.meshletTriangles, 3 * (uint64_t)m.numMeshletTriangles, size))
+            return false;
+        if (m.lods % 8 != 0 || !inside(m.lods, sizeof(ExportLod) * (uint64_t)m.numLods, size))
+            return false;
+        const ExportLod* lods = exportLods(data, m);
+        for (uint32_t l = 0; l < m.numLods; ++l)
+        {
+            if (lods[l].indices % m.indexSize != 0 || !inside(lods[l].indices, (uint64_t)m.indexSize * 3 * lods[l].numTriangles, size))
+                return false;
+        }
+        const ExportMeshlet* meshlets = exportMeshlets(data, m);
+        for (uint32_t j = 0; j < m.numMeshlets; ++j)
+        {
+            const ExportMeshlet& e = meshlets[j];
+            if ((uint64_t)e.vertexOffset + e.vertexCount > m.numMeshletVertices ||
+                (uint64_t)e.triangleOffset + e.triangleCount > m.numMeshletTriangles)
+                return false;
+        }
+    }
+    return true;
+}
+
+static std::string shmName(const std::string& name)
+{
+    return name[0] == '/' ? name : "/" + name;
+}
+
+bool exportToFile(const std::string& filename, const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+    std::vector<uint8_t> block(exportSize(geom, material, options));
+    writeExport(geom, material, block.data(), block.size(), options);
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+    bool ok = fwrite(block.data(), 1, block.size(), fp) == block.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+        printf("Could not write %s\n", filename.c_str());
+    return ok;
+}
+
+#ifndef _WIN32
+
+static bool fillFd(int fd, const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+    uint64_t size = exportSize(geom, material, options);
+    if (ftruncate(fd, (off_t)size) != 0)
+        return false;
+    void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (block == MAP_FAILED)
+        return false;
+    writeExport(geom, material, (uint8_t*)block, size, options);
+    munmap(block, size);
+    return true;
+}
+
+bool exportToShm(const std::string& name, const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+    // A fresh object each time, so a consumer still mapping the previous
+    // one keeps a consistent view.
+    std::string object = shmName(name);
+    shm_unlink(object.c_str());
+    int fd = shm_open(object.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        printf("Could not create shared memory %s: %s\n", object.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fillFd(fd, geom, material, options);
+    if (!ok)
+    {
+        printf("Could not write shared memory %s: %s\n", object.c_str(), strerror(errno));
+        shm_unlink(object.c_str());
+    }
+    close(fd);
+    return ok;
+}
+
+ExportMapping::~ExportMapping()
+{
+    if (data)
+        munmap((void*)data, size);
+}
+
+bool ExportMapping::mapFd(int fd)
+{
+    struct stat st;
+    if (data || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ExportHeader))
+        return false;
+    void* block = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (block == MAP_FAILED)
+        return false;
+    if (!exportValid(block, (uint64_t)st.st_size))
+    {
+        munmap(block, (size_t)st.st_size);
+        return false;
+    }
+    data = (const uint8_t*)block;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+bool ExportMapping::mapShm(const std::string& name)
+{
+    int fd = shm_open(shmName(name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    bool ok = mapFd(fd);
+    close(fd);
+    return ok;
+}
+
+#else
+
+bool exportToShm(const std::string& name, const Geom&, const GeomMaterial&, const ExportOptions&)
+{
+    printf("Could not create shared memory %s: not supported in this build\n", name.c_str());
+    return false;
+}
+
+ExportMapping::~ExportMapping()
+{
+}
+
+bool ExportMapping::mapFd(int)
+{
+    return false;
+}
+
+bool ExportMapping::mapShm(const std::string&)
+{
+    return false;
+}
+
+#endif
+
+int exportToMemfd(const std::string& name, const Geom& geom, const GeomMaterial& material, const ExportOptions& options)
+{
+#ifdef __linux__
+    int fd = memfd_create(name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+    {
+        printf("memfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+    // Sealed once written, so the consumer can trust the contents without
+    // copying them.
+    if (!fillFd(fd, geom, material, options) || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0)
+    {
+        printf("Could not write memfd %s: %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    printf("Could not create memfd %s: not supported in this build\n", name.c_str());
+    return -1;
+#endif
+}
+
+bool parseExport(const std::string& text, ExportKind& kind, std::string& prefix)
+{
+    if (text == "gpx")
+    {
+        kind = ExportKind::File;
+        return true;
+    }
+    if (text.compare(0, 4, "shm:") == 0 && text.size() > 4)
+    {
+        kind = ExportKind::Shm;
+        prefix = text.substr(4);
+        return true;
+    }
+    return false;
+}
+
+bool exportJob(const FileJob& job, ExportKind kind, const std::string& prefix, const ExportOptions& options)
+{
+    if (kind == ExportKind::File)
+        return exportToFile(job.file + ".gpx", *job.geom, *job.mat, options);
+    if (kind == ExportKind::Shm)
+    {
+        std::string name = prefix + "." + std::to_string(job.corpusIndex);
+        if (!exportToShm(name, *job.geom, *job.mat, options))
+            return false;
+        printf("%s -> shared memory %s\n", job.file.c_str(), shmName(name).c_str());
+        return true;
+    }
+    return true;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct FileJob;
+struct Geom;
+struct GeomMaterial;
+
+// A decoded Geom in one flat block, for consumers that map it instead of
+// parsing OBJ. Everything is addressed by byte offsets from the start of
+// the block, in native (little-endian) byte order and aligned for direct
+// use, so it reads the same from a file, a memfd or a shared-memory object:
+//
+//   ExportHeader
+//   ExportMesh[numMeshes]
+//   ExportMaterial[numMaterials]
+//   strings, zero-terminated
+//   per mesh: one float[numVertices] per ExportStream, the indices, then
+//   the meshlets, their vertices and their triangles (empty unless built
+//   with --meshlets), the ExportLod table and each LOD's indices (none
+//   without --lods), each on an EXPORT_ALIGNMENT boundary
+//
+// Texture coordinates are stored as decoded; the OBJ writer negates v.
+// Version 2 added the meshlets, version 3 the LODs, version 4 the mesh
+// bounds.
+
+const uint32_t EXPORT_MAGIC = 0x31585047; // "GPX1"
+const uint32_t EXPORT_VERSION = 4;
+const uint32_t EXPORT_ALIGNMENT = 64;
+const uint32_t EXPORT_NO_STRING = 0xFFFFFFFF;
+
+enum class ExportStream : uint32_t
+{
+    PositionX,
+    PositionY,
+    PositionZ,
+    NormalX,
+    NormalY,
+    NormalZ,
+    TexCoordU,
+    TexCoordV,
+    Count
+};
+
+struct ExportHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // of the whole block
+    uint32_t numMeshes;
+    uint32_t numMaterials;
+    uint64_t meshTable;
+    uint64_t materialTable;
+    uint64_t strings;
+    uint64_t stringsSize;
+    float aabbMin[3]; // the AABB at the end of the .geom.edge
+    float aabbMax[3];
+};
+
+struct ExportMesh
+{
+    uint32_t materialId; // not necessarily below numMaterials, as in the source
+    uint32_t numVertices;
+    uint32_t numTriangles;
+    uint32_t indexSize; // bytes per index, 2 or 4
+    uint64_t streams[(uint32_t)ExportStream::Count];
+    uint64_t indices; // 3 per triangle
+    uint32_t numMeshlets;
+    uint32_t numMeshletVertices;
+    uint32_t numMeshletTriangles;
+    uint32_t numLods; // besides this one
+    uint64_t meshlets;         // ExportMeshlet[numMeshlets]
+    uint64_t meshletVertices;  // uint32_t[numMeshletVertices], vertices of the mesh
+    uint64_t meshletTriangles; // 3 uint8_t per triangle, vertices of its meshlet
+    uint64_t lods;             // ExportLod[numLods], LOD1 first
+    float aabbMin[3]; // of the vertex positions, zero without vertices
+    float aabbMax[3];
+};
+
+// A simplified triangle list over the mesh's vertices, with its indexSize.
+struct ExportLod
+{
+    uint32_t numTriangles;
+    uint32_t reserved;
+    uint64_t indices;
+};
+
+// Culled from a point p when dot(normalize(coneApex - p), coneAxis) >=
+// coneCutoff.
+struct ExportMeshlet
+{
+    uint32_t vertexOffset;   // into the mesh's meshlet vertices
+    uint32_t triangleOffset; // into its meshlet triangles, in triangles
+    uint32_t vertexCount;    // up to 64
+    uint32_t triangleCount;  // up to 124
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff;
+    float coneApex[3];
+    uint32_t reserved;
+};
+
+struct ExportMaterial
+{
+    uint32_t id;
+    // Offsets into the strings, EXPORT_NO_STRING when absent.
+    uint32_t name;
+    uint32_t diffuse;
+    uint32_t normal;
+};
+
+static_assert(sizeof(ExportHeader) == 80, "ExportHeader layout");
+static_assert(sizeof(ExportMesh) == 160, "ExportMesh layout");
+static_assert(sizeof(ExportLod) == 16, "ExportLod layout");
+static_assert(sizeof(ExportMeshlet) == 64, "ExportMeshlet layout");
+static_assert(sizeof(ExportMaterial) == 16, "ExportMaterial layout");
+
+struct ExportOptions
+{
+    // One ExportMesh per material instead of per source mesh, in order of
+    // first use: the vertex streams are concatenated, the indices (LODs
+    // included) rebased, and 4-byte indices used only when a merged mesh
+    // needs them. Triangles pointing past their own mesh's vertices are
+    // dropped rather than rebased into the next one's.
+    bool mergeMaterials = false;
+};
+
+// Bytes the block for geom takes.
+uint64_t exportSize(const Geom& geom, const GeomMaterial& material, const ExportOptions& options = ExportOptions());
+// Lays geom out in out[0, size), size as returned by exportSize with the
+// same options.
+void writeExport(const Geom& geom, const GeomMaterial& material, uint8_t* out, uint64_t size, const ExportOptions& options = ExportOptions());
+
+// Checks magic, version and that every table, stream and string lies
+// within size. Anything mapped from another process should pass this first.
+bool exportValid(const void* data, uint64_t size);
+
+inline const ExportHeader* exportHeader(const void* data)
+{
+    return (const ExportHeader*)data;
+}
+
+inline const ExportMesh* exportMeshes(const void* data)
+{
+    return (const ExportMesh*)((const uint8_t*)data + exportHeader(data)->meshTable);
+}
+
+inline const ExportMaterial* exportMaterials(const void* data)
+{
+    return (const ExportMaterial*)((const uint8_t*)data + exportHeader(data)->materialTable);
+}
+
+inline const char* exportString(const void* data, uint32_t offset)
+{
+    return offset == EXPORT_NO_STRING ? nullptr : (const char*)data + exportHeader(data)->strings + offset;
+}
+
+inline const float* exportStream(const void* data, const ExportMesh& mesh, ExportStream stream)
+{
+    return (const float*)((const uint8_t*)data + mesh.streams[(uint32_t)stream]);
+}
+
+inline const void* exportIndices(const void* data, const ExportMesh& mesh)
+{
+    return (const uint8_t*)data + mesh.indices;
+}
+
+inline const ExportMeshlet* exportMeshlets(const void* data, const ExportMesh& mesh)
+{
+    return (const ExportMeshlet*)((const uint8_t*)data + mesh.meshlets);
+}
+
+inline const uint32_t* exportMeshletVertices(const void* data, const ExportMesh& mesh)
+{
+    return (const uint32_t*)((const uint8_t*)data + mesh.meshletVertices);
+}
+
+inline const uint8_t* exportMeshletTriangles(const void* data, const ExportMesh& mesh)
+{
+    return (const uint8_t*)data + mesh.meshletTriangles;
+}
+
+inline const ExportLod* exportLods(const void* data, const ExportMesh& mesh)
+{
+    return (const ExportLod*)((const uint8_t*)data + mesh.lods);
+}
+
+// Where the block goes. Each returns false (after saying why) on failure.
+bool exportToFile(const std::string& filename, const Geom& geom, const GeomMaterial& material, const ExportOptions& options = ExportOptions());
+// A POSIX shared-memory object, replacing one of the same name. The
+// consumer shm_unlink()s it when done.
+bool exportToShm(const std::string& name, const Geom& geom, const GeomMaterial& material, const ExportOptions& options = ExportOptions());
+// A memfd sealed against writes and resizing, or -1. Linux only.
+int exportToMemfd(const std::string& name, const Geom& geom, const GeomMaterial& material, const ExportOptions& options = ExportOptions());
+
+// A read-only mapping of an export block.
+struct ExportMapping
+{
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+
+    ExportMapping() = default;
+    ExportMapping(const ExportMapping&) = delete;
+    ExportMapping& operator=(const ExportMapping&) = delete;
+    ~ExportMapping();
+
+    // Map an open file, memfd or shared-memory descriptor; the descriptor
+    // can be closed afterwards. Both fail on anything exportValid rejects.
+    bool mapFd(int fd);
+    bool mapShm(const std::string& name);
+};
+
+enum class ExportKind : uint8_t
+{
+    None,
+    File, // <input>.gpx next to the OBJ files
+    Shm   // shared-memory object <prefix>.<corpus index>, see BatchOptions::corpusIndices
+};
+
+// "gpx" or "shm:prefix"
+bool parseExport(const std::string& text, ExportKind& kind, std::string& prefix);
+// Exports a decoded job as kind says; for BatchOptions::decoded.
+bool exportJob(const FileJob& job, ExportKind kind, const std::string& prefix, const ExportOptions& options = ExportOptions());
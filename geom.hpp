@@ -0,0 +1,1055 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <assert.h>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <regex>
+#include <stdexcept>
+#include "attributes.hpp"
+#include "half.hpp"
+#include "kernels.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+
+inline uint32_t Reverse32(uint32_t value)
+{
+    return (((value & 0x000000FF) << 24) |
+        ((value & 0x0000FF00) << 8) |
+        ((value & 0x00FF0000) >> 8) |
+        ((value & 0xFF000000) >> 24));
+}
+
+inline uint16_t Reverse16(uint16_t value)
+{
+    return (((value & 0x00FF) << 8) |
+        ((value & 0xFF00) >> 8));
+}
+
+inline int16_t Reversei16(int16_t value)
+{
+    return (((value & 0x00FF) << 8) |
+        ((value & 0xFF00) >> 8));
+}
+
+
+inline uint8_t* readfile(const std::string& file, int& size)
+{
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (fp)
+    {
+        fseek(fp, 0L, SEEK_END);
+        size = ftell(fp);
+        fseek(fp, 0L, SEEK_SET);
+        uint8_t* data = new uint8_t[size];
+        fread(data, 1, size, fp);
+        fclose(fp);
+        return data;
+    }
+
+    size = 0;
+    return nullptr;
+}
+
+// Where dump_meshes writes mesh of geomFile.
+inline std::string meshObjPath(const std::string& geomFile, size_t mesh)
+{
+    return geomFile + std::to_string(mesh) + ".obj";
+}
+
+// printf onto the end of out.
+inline void appendf(std::string& out, const char* format, ...)
+{
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+        return;
+    if ((size_t)length < sizeof(buffer))
+    {
+        out.append(buffer, (size_t)length);
+        return;
+    }
+
+    size_t size = out.size();
+    out.resize(size + length + 1);
+    va_start(args, format);
+    vsnprintf(&out[size], (size_t)length + 1, format, args);
+    va_end(args);
+    out.resize(size + length);
+}
+
+// Same text as printf("%u").
+inline void appendUint(std::string& out, uint32_t value)
+{
+    char buffer[10];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    do
+    {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    out.append(p, end - p);
+}
+
+inline float ReverseFloat(const float inFloat)
+{
+    float retVal;
+    char* floatToConvert = (char*)&inFloat;
+    char* returnFloat = (char*)&retVal;
+
+    // swap the bytes into a temporary buffer
+    returnFloat[0] = floatToConvert[3];
+    returnFloat[1] = floatToConvert[2];
+    returnFloat[2] = floatToConvert[1];
+    returnFloat[3] = floatToConvert[0];
+
+    return retVal;
+}
+
+inline uint32_t parse32(uint8_t* data, uint32_t& offset)
+{
+    uint32_t* buf = (uint32_t*)&data[offset];
+    offset += sizeof(uint32_t);
+    return Reverse32(*buf);
+}
+
+inline uint16_t parse16(uint8_t* data, uint32_t& offset)
+{
+    uint16_t* buf = (uint16_t*)&data[offset];
+    offset += sizeof(uint16_t);
+    return Reverse16(*buf);
+}
+
+inline int16_t parsei16(uint8_t* data, uint32_t& offset)
+{
+    int16_t* buf = (int16_t*)&data[offset];
+    offset += sizeof(int16_t);
+    return Reverse16(*buf);
+}
+
+static thread_local int min = 0;
+static thread_local int max = 0;
+
+inline float parsef8(uint8_t* data, uint32_t& offset)
+{
+    const float scale = 1.0f / 127.0f;
+    int8_t ival = data[offset];
+    if (ival < min)
+        min = ival;
+    if (ival > max)
+        max = ival;
+    float val = ival * scale;
+    ++offset;
+    return val;
+}
+
+
+inline uint8_t parse8(uint8_t* data, uint32_t& offset)
+{
+    uint8_t val = data[offset];
+    ++offset;
+    return val;
+}
+
+inline float parsef32(uint8_t* data, uint32_t& offset)
+{
+    uint32_t be = parse32(data, offset);
+    float f;
+    std::memcpy(&f, &be, sizeof(float));
+    return f;
+}
+
+inline float parsef16(uint8_t* data, uint32_t& offset)
+{
+    uint32_t be = parse16(data, offset);
+
+    uint32_t floatval = (((uint32_t)be & 0x8000) << 16) | (((uint32_t)be & 0x7FFF) << 13) + 0x38000000;
+    float fv;
+    std::memcpy(&fv, &floatval, sizeof(float));
+
+    half_float::half f;
+    std::memcpy(&f.data_, &be, sizeof(uint16_t));
+    float ff = float(f);
+    return ff;
+}
+
+struct GeomTexture
+{
+    std::string name;
+    std::string texfile;
+};
+
+struct GeomMaterialEntry
+{
+    uint32_t texcount;
+    std::vector<GeomTexture> textures;
+    uint32_t id;
+    std::string filename;
+
+    std::string name()
+    {
+        if (textures.size() > 0)
+            return textures[0].name;
+
+        return "NO_TEXTURE";
+    }
+
+    std::string getfilename()
+    {
+        size_t lastslash = filename.find_last_of("/");
+        if (lastslash != std::string::npos)
+        {
+            filename = filename.substr(lastslash + 1, filename.length() - lastslash - 1);
+        }
+
+        std::string material = std::regex_replace(filename, std::regex(".mat.edge"), "");
+        std::stringstream ss;
+        assert(textures.size() > 0);
+        ss << id << "_" << material << ".mtl";
+        return ss.str();
+    }
+
+    void dumpMaterial(const std::string& path)
+    {
+        if (textures.size() > 0)
+        {
+            std::string filename = path + getfilename();
+            FILE* fp = fopen(filename.c_str(), "w+");
+            std::regex dds("\\.dds");
+            std::string tex = std::regex_replace(textures[0].texfile, dds, ".png");
+            fprintf(fp, "newmtl %s\n", textures[0].name.c_str());
+            fprintf(fp, "Ka 1.000000 1.000000 1.000000\n");
+            fprintf(fp, "Kd 1.000000 1.000000 1.000000\n");
+            fprintf(fp, "Ks 0.000000 0.000000 0.000000\n");
+            fprintf(fp, "map_Kd %s\n", tex.c_str());
+            if (textures.size() > 1)
+            {
+                tex = std::regex_replace(textures[1].texfile, dds, ".png");
+
+                fprintf(fp, "norm %s\n", tex.c_str());
+            }
+
+            if (textures.size() > 2)
+            {
+                printf("More than 2 textures, investigate!\n");
+            }
+            fclose(fp);
+        }
+    }
+};
+
+inline std::string parseString(uint8_t* data, uint32_t& offset)
+{
+    char str[64];
+    memset(str, 0, sizeof(str));
+    memcpy(str, data + offset, 64);
+    offset += 64;
+    str[63] = 0;
+    return std::string(str);
+}
+struct GeomMaterial
+{
+    uint32_t num_materials;
+    std::vector<GeomMaterialEntry> materialEntries;
+    
+    GeomMaterial(const std::string& filename)
+    : m_filename(filename)
+    {
+    }
+
+
+    void parse(uint8_t* data)
+    {
+        uint32_t offset = 0u;
+        num_materials = parse32(data, offset);
+        for (uint32_t m = 0; m < num_materials; ++m)
+        {
+            GeomMaterialEntry e;
+            e.texcount = parse32(data, offset);
+            e.id = m;
+            e.filename = m_filename;
+            for (uint32_t tex = 0; tex < e.texcount; ++tex)
+            {
+                GeomTexture t;
+                t.name = parseString(data, offset);
+                t.texfile = parseString(data, offset);
+                e.textures.push_back(t);
+            }
+            materialEntries.push_back(e);
+        }
+    }
+
+    void dumpMaterials(const std::string& path)
+    {
+        for (auto& e : materialEntries)
+        {
+            e.dumpMaterial(path);
+        }
+    }
+    std::string m_filename;
+};
+
+struct GeomHeader
+{
+    uint32_t num_meshes;
+    uint32_t unk1;
+    uint32_t unk2;
+    uint32_t filesize;
+};
+
+struct GeomAABB
+{
+    float minX;
+    float minY;
+    float minZ;
+    float maxX;
+    float maxY;
+    float maxZ;
+};
+
+struct MeshTriangle
+{
+    uint32_t t_, tt_, ttt_;
+    MeshTriangle(uint32_t v1, uint32_t v2, uint32_t v3)
+        : t_(v1), tt_(v2), ttt_(v3)
+    {}
+
+    std::string v1()
+    {
+        std::stringstream ss;
+        ss << (t_ + 1) << "/" << (t_ + 1) << "/" << (t_ + 1);
+        return ss.str();
+    }
+    std::string v2()
+    {
+        std::stringstream ss;
+        ss << (tt_ + 1) << "/" << (tt_ + 1) << "/" << (tt_ + 1);
+        return ss.str();
+    }
+    std::string v3()
+    {
+        std::stringstream ss;
+        ss << (ttt_ + 1) << "/" << (ttt_ + 1) << "/" << (ttt_ + 1);
+        return ss.str();
+    }
+
+    bool operator == (const MeshTriangle& t2) const
+    {
+        return (t_ == t2.t_) &&
+               (tt_ == t2.tt_) &&
+               (ttt_ == t2.ttt_);
+    }
+};
+
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+// A cluster of a mesh's triangles for culling, as built by buildMeshlets.
+// Seen from a point p it can be culled when
+// dot(normalize(coneApex - p), coneAxis) >= coneCutoff.
+struct Meshlet
+{
+    uint32_t vertexOffset;   // into meshletVertices
+    uint32_t triangleOffset; // into meshletTriangles, in triangles
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff; // 1 when the normals are too spread out to ever cull
+    float coneApex[3];
+};
+
+struct MeshVertex
+{
+    float vx, vy, vz;
+    float tx, ty;
+    float nx, ny, nz;
+    uint32_t id_;
+    // UVs and normals start at zero: vertices past the texture block never
+    // get UVs, and a trailing partial vertex gets no normal either.
+    MeshVertex(uint32_t id, float x, float y, float z, GeomAABB& aabb)
+        : vx(x), vy(y), vz(z), tx(0.0f), ty(0.0f), nx(0.0f), ny(0.0f), nz(0.0f), id_(id)
+    {
+        if ((vx < aabb.minX || vx > aabb.maxX))
+            isValid = false;
+        if ((vy < aabb.minY || vy > aabb.maxY))
+            isValid = false;
+        if ((vz < aabb.minZ || vz > aabb.maxZ))
+            isValid = false;
+    }
+
+    static constexpr float EPSILON = 0.00001f;
+
+    bool operator == (const MeshVertex& v) const
+    {
+        float xd = abs(vx - v.vx);
+        float yd = abs(vy - v.vy);
+        float zd = abs(vz - v.vz);
+        return (xd < EPSILON) &&
+               (yd < EPSILON) &&
+               (zd < EPSILON);
+    }
+
+    bool isValid = true;
+    std::vector<uint32_t> duplicates;
+};
+
+struct vec3
+{
+    float x_;
+    float y_;
+    float z_;
+
+    vec3(float x, float y, float z)
+    : x_(x), y_(y), z_(z)
+    {
+    }
+
+    float magnitude()
+    {
+        return sqrt((x_ * x_) + (y_ * y_) + (z_ * z_));
+    }
+
+    void normalize()
+    {
+        float length = magnitude();
+        if (length > 0)
+        {
+            x_ /= length;
+            y_ /= length;
+            z_ /= length;
+        }
+    }
+};
+
+struct GeomMeshHeader
+{
+    uint32_t signature;
+    uint16_t unk1;
+    uint8_t unk2;
+    uint8_t materialId;
+    uint16_t unk3;
+    uint16_t numIndices;
+    uint32_t allFF;
+
+    uint32_t meshTrianglesAddress;
+    uint16_t meshTrianglesSize;
+    uint8_t* m_triangle_data;
+
+    uint16_t padding1;
+
+    uint32_t meshBlock1Address;
+    uint32_t meshBlock1EndAddress;
+    uint16_t meshBlock1Length;
+    uint16_t padding2;
+
+    uint32_t normalBlockLength;
+    uint32_t unk32_2;
+
+    uint32_t textureBlock1Address;
+    uint32_t textureBlock1Length;
+
+    static const uint32_t NUM_OFFSETS = 19;
+
+    uint32_t offsets[NUM_OFFSETS];
+
+    uint32_t num_vertices;
+    uint32_t num_tex_coords;
+
+    AttributeStream positionStream;
+    AttributeStream normalStream;
+    AttributeStream texCoordStream;
+
+    GeomAABB aabb_;
+
+    std::vector<vec3> normals;
+
+    struct MeshFloat
+    {
+        float m_val;
+        uint32_t m_addr;
+        MeshFloat(uint32_t addr, float val)
+        {
+            m_val = val;
+            m_addr = addr;
+        }
+    };
+
+    std::vector<MeshVertex> meshBlock1;
+    std::vector<MeshTriangle> triangles;
+    std::vector<MeshTriangle> parsedTriangles;
+
+    // Built on request: the meshlets, the mesh vertex of each of their
+    // vertices, and 3 meshlet-local vertices per triangle.
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint8_t> meshletTriangles;
+    // Also on request: simplified triangle lists over the same vertices,
+    // LOD1 first.
+    std::vector<std::vector<MeshTriangle>> lods;
+
+    void parse(GeomAABB& aabb, uint8_t* data, uint32_t& offset)
+    {
+        aabb_ = aabb;
+        signature = parse32(data, offset);
+        unk1 = parse16(data, offset);
+        unk2 = parse8(data, offset);
+        materialId = parse8(data, offset);
+        unk3 = parse16(data, offset);
+        numIndices = parse16(data, offset);
+        allFF = parse32(data, offset);
+
+        meshTrianglesAddress = parse32(data, offset);
+        meshTrianglesSize = parse16(data, offset);
+        padding1 = parse16(data, offset);
+
+        meshBlock1Address = parse32(data, offset);
+        meshBlock1EndAddress = parse32(data, offset);
+        meshBlock1Length = parse16(data, offset);
+        
+        num_vertices = meshBlock1Length / 4 / 3;
+
+        padding2 = parse16(data, offset);
+
+        normalBlockLength = parse32(data, offset);
+        unk32_2 = parse32(data, offset);
+
+        textureBlock1Address = parse32(data, offset);
+        textureBlock1Length = parse32(data, offset);
+        num_tex_coords = textureBlock1Length / 2 / 2;
+
+        for (uint32_t i = 0; i < NUM_OFFSETS; ++i)
+        {
+            offsets[i] = parse32(data, offset);
+        }
+        describeStreams();
+    }
+
+    // The streams as the blocks have always been read: float positions,
+    // int8 normals in 6-byte records and half UVs. offsets[] and the unk
+    // fields are zero in every file seen so far; a variant that uses them
+    // to describe other streams gets mapped here.
+    void describeStreams()
+    {
+        positionStream = attributeStream(AttributeFormat::F32, 3, 12);
+        normalStream = attributeStream(AttributeFormat::EdgeNormal, 3, 6);
+        texCoordStream = attributeStream(AttributeFormat::F16, 2, 4);
+    }
+
+    std::vector<uint16_t> readVariableBitArray(uint8_t* variableBitIndices, uint32_t numBitsPerValue, uint32_t numVarBitIndices) const
+    {
+        uint32_t total = (numVarBitIndices + 0x1F) & 0xFFFFFFE0;
+        std::vector<uint16_t> parsedVariableBitIndices(total);
+        if (total == 0)
+            return parsedVariableBitIndices;
+
+        // Values are read through a 24-bit window; anything wider is corrupt.
+        if (numBitsPerValue == 0 || numBitsPerValue > 17)
+            throw std::runtime_error("invalid index bit width");
+
+        g_kernels.unpackBits(variableBitIndices, numBitsPerValue, total, parsedVariableBitIndices.data());
+        return parsedVariableBitIndices;
+    }
+
+    std::vector<uint16_t> read1bArray(const std::vector<uint16_t>& variableBitIndices, const uint8_t* prefaceData, uint32_t numIndices) const
+    {
+        std::vector<uint16_t> decodedIndices;
+        const uint8_t MASK_INITIAL = 0x80;
+
+        uint16_t indexValue = 0;
+
+        uint8_t mask = MASK_INITIAL;
+        uint32_t index = 0;
+        uint32_t prefaceDataIndex = 0;
+        const uint32_t count = (numIndices + 0x0F) & 0xFFFFFFF0;
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint8_t currentPrefaceByte = prefaceData[prefaceDataIndex];
+
+            if ((currentPrefaceByte & mask) == 0)
+            {
+                decodedIndices.push_back(indexValue++);
+            }
+            else
+            {
+                decodedIndices.push_back(variableBitIndices[index++]);
+            }
+
+            mask >>= 1;
+
+            if (mask == 0)
+            {
+                mask = MASK_INITIAL;
+                prefaceDataIndex++;
+                if (prefaceDataIndex >= (numIndices / 8))
+                {
+                    break;
+                }
+            }
+        }
+
+        return decodedIndices;
+    }
+
+    void readBackRefIndices(std::vector<uint16_t>& indices, uint32_t numIndices, uint16_t backRefOffset) const
+    {
+        size_t count = std::min<size_t>((numIndices + 0x1F) & 0xFFFFFFE0, indices.size() & ~(size_t)7);
+        g_kernels.decodeBackRefs(indices.data(), count, backRefOffset);
+    }
+
+    std::vector<uint16_t> buildFaces(const std::vector<uint16_t>& indices, uint8_t* faceData, uint32_t numTris) const
+    {
+        const uint32_t TOTALTRIS = (numTris + 7) & 0xFFFFFFF8;
+        std::vector<uint16_t> indexArray(TOTALTRIS * 3);
+        indexArray.resize(g_kernels.buildFaces(indices.data(), indices.size(), faceData, numTris, indexArray.data()));
+        return indexArray;
+    }
+
+    // The triangle block at triangleData, with 8 zeroed bytes of slack for
+    // the word-sized loads of the bit unpacking kernels, as 3 indices per
+    // triangle. Stops early, like the reference decoder, when the index
+    // stream runs out.
+    std::vector<uint16_t> decodeIndexArray(uint8_t* triangleData) const
+    {
+        uint32_t readOffset = 0;
+        uint32_t numVarBitIndices = parse16(triangleData, readOffset);
+        uint16_t backRefOffset = parse16(triangleData, readOffset);
+        uint32_t num1BitIndices = parse16(triangleData, readOffset) * 8;
+        uint8_t variableIndexBitSize = parse8(triangleData, readOffset);
+
+        uint32_t numTriangles = numIndices / 3;
+        uint32_t offsetFaceBytes = ((num1BitIndices + 7) / 8) + 8;
+        uint32_t numFaceBytes = (((numTriangles + numTriangles) + 7) / 8);
+        uint32_t offsetArrayVarBit = offsetFaceBytes + numFaceBytes;
+
+        std::vector<uint16_t> variableBitIndices = readVariableBitArray(triangleData + offsetArrayVarBit, variableIndexBitSize, numVarBitIndices);
+        readBackRefIndices(variableBitIndices, numVarBitIndices, backRefOffset);
+        std::vector<uint16_t> decodedIndices = read1bArray(variableBitIndices, triangleData + 8, num1BitIndices);
+        return buildFaces(decodedIndices, triangleData + offsetFaceBytes, numTriangles);
+    }
+
+    void parseIndexArray(const uint8_t* data)
+    {
+        // Zeroed slack for the word-sized loads of the bit unpacking kernels.
+        const uint32_t PADDING = 8;
+        m_triangle_data = new uint8_t[meshTrianglesSize + PADDING];
+        memset(m_triangle_data, 0, meshTrianglesSize + PADDING);
+        memcpy(m_triangle_data, data + meshTrianglesAddress, meshTrianglesSize);
+
+        std::vector<uint16_t> indexArray = decodeIndexArray(m_triangle_data);
+        uint32_t numTriangles = std::min<uint32_t>(numIndices / 3, indexArray.size() / 3);
+
+        for (uint32_t i = 0; i < numTriangles; ++i)
+        {
+            uint32_t i1 = i * 3;
+            uint32_t i2 = (i * 3) + 1;
+            uint32_t i3 = (i * 3) + 2;
+            triangles.push_back(MeshTriangle(indexArray[i1], indexArray[i2], indexArray[i3]));
+        }
+        delete[] m_triangle_data;
+    }
+
+    void readTriangleDataFromIndexArray(const std::string& filename, int number)
+    {
+        std::stringstream ss;
+        ss << filename << ".idx." << number;
+
+        int idxsize;
+        uint8_t* idxdata = readfile(ss.str(), idxsize);
+        if (idxdata != nullptr)
+        {
+            uint32_t offset = 0;
+            while (offset < idxsize)
+            {
+                uint16_t i1 = parse16(idxdata, offset);
+                uint16_t i2 = parse16(idxdata, offset);
+                uint16_t i3 = parse16(idxdata, offset);
+                parsedTriangles.push_back(MeshTriangle(i1, i2, i3));
+            }
+        }
+
+    }
+
+    void parseFloatBlock(uint8_t* data)
+    {
+        std::vector<float> decoded(num_vertices * 3);
+        decodeAttributes(data + meshBlock1EndAddress, normalStream, num_vertices, decoded.data());
+
+        normals.reserve(num_vertices);
+        for (uint32_t i = 0; i < num_vertices; ++i)
+        {
+            normals.push_back(vec3(decoded[i * 3], decoded[i * 3 + 1], decoded[i * 3 + 2]));
+        }
+
+        for (uint32_t i = 0; i < num_vertices; ++i)
+        {
+            meshBlock1[i].nx = normals[i].x_;
+            meshBlock1[i].ny = normals[i].y_;
+            meshBlock1[i].nz = normals[i].z_;
+        }
+    }
+
+    // markDuplicates finds the duplicate-of comments of the OBJ output,
+    // comparing every pair of vertices.
+    void parseBlock1(uint8_t* data, bool markDuplicates = true)
+    {
+        uint32_t length = meshBlock1EndAddress - meshBlock1Address;
+        assert(length == meshBlock1Length);
+
+        // A trailing partial vertex still counts, as it always has.
+        uint32_t numPositions = (meshBlock1Length / 4 + 2) / 3;
+        std::vector<float> positions(numPositions * 3);
+        decodeAttributes(data + meshBlock1Address, positionStream, numPositions, positions.data());
+
+        meshBlock1.reserve(numPositions);
+        for (uint32_t v = 0; v < numPositions; ++v)
+        {
+            meshBlock1.push_back(MeshVertex(v, positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2], aabb_));
+        }
+
+        uint32_t numTexCoords = std::min<uint32_t>(num_tex_coords, numPositions);
+        std::vector<float> uvs(numTexCoords * 2);
+        decodeAttributes(data + textureBlock1Address, texCoordStream, numTexCoords, uvs.data());
+        for (uint32_t t = 0; t < numTexCoords; t++)
+        {
+            meshBlock1[t].tx = uvs[t * 2];
+            meshBlock1[t].ty = uvs[t * 2 + 1];
+        }
+
+        if (markDuplicates)
+            findDuplicates();
+    }
+
+    void findDuplicates()
+    {
+        const uint32_t PARALLEL_VERTICES = 2048;
+        uint32_t numVertices = (uint32_t)meshBlock1.size();
+        uint32_t workers = schedulerWorkers();
+        if (workers > 1 && numVertices >= PARALLEL_VERTICES)
+        {
+            findDuplicatesParallel(workers * 4);
+            return;
+        }
+
+        uint32_t v = 0;
+        while (v < meshBlock1.size())
+        {
+            MeshVertex& vertex = meshBlock1[v];
+            ++v;
+            for (uint32_t dup = v; dup < meshBlock1.size(); ++dup)
+            {
+                MeshVertex& vertex2 = meshBlock1[dup];
+                if (vertex == vertex2)
+                {
+                    vertex.duplicates.push_back(vertex2.id_);
+                    vertex2.duplicates.push_back(vertex.id_);
+                }
+            }
+            
+        }
+    }
+
+    // Same comparisons as findDuplicates, with the rows split into chunks
+    // of about equal pair counts. Matches are collected per chunk and then
+    // recorded in the order the serial loop finds them, so every duplicates
+    // list comes out identical.
+    void findDuplicatesParallel(uint32_t numChunks)
+    {
+        uint32_t numVertices = (uint32_t)meshBlock1.size();
+        uint64_t totalPairs = (uint64_t)numVertices * (numVertices - 1) / 2;
+        std::vector<uint32_t> firstRow(numChunks + 1, numVertices);
+        firstRow[0] = 0;
+        uint64_t pairs = 0;
+        uint32_t chunk = 1;
+        for (uint32_t v = 0; v < numVertices && chunk < numChunks; ++v)
+        {
+            while (chunk < numChunks && pairs >= totalPairs * chunk / numChunks)
+                firstRow[chunk++] = v;
+            pairs += numVertices - 1 - v;
+        }
+
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> matches(numChunks);
+        parallelFor(numChunks, 1, Stage::Vertex, [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; ++c)
+            {
+                for (uint32_t v = firstRow[c]; v < firstRow[c + 1]; ++v)
+                {
+                    const MeshVertex& vertex = meshBlock1[v];
+                    for (uint32_t dup = v + 1; dup < numVertices; ++dup)
+                    {
+                        if (vertex == meshBlock1[dup])
+                            matches[c].push_back(std::make_pair(v, dup));
+                    }
+                }
+            }
+        });
+
+        for (const std::vector<std::pair<uint32_t, uint32_t>>& chunkMatches : matches)
+        {
+            for (const std::pair<uint32_t, uint32_t>& match : chunkMatches)
+            {
+                MeshVertex& vertex = meshBlock1[match.first];
+                MeshVertex& vertex2 = meshBlock1[match.second];
+                vertex.duplicates.push_back(vertex2.id_);
+                vertex2.duplicates.push_back(vertex.id_);
+            }
+        }
+    }
+
+
+    // Heap held by the decoded mesh, duplicate lists included.
+    uint64_t decodedBytes() const
+    {
+        uint64_t bytes = normals.capacity() * sizeof(vec3) + meshBlock1.capacity() * sizeof(MeshVertex) +
+            (triangles.capacity() + parsedTriangles.capacity()) * sizeof(MeshTriangle) + meshlets.capacity() * sizeof(Meshlet) +
+            meshletVertices.capacity() * sizeof(uint32_t) + meshletTriangles.capacity();
+        for (const std::vector<MeshTriangle>& lod : lods)
+            bytes += lod.capacity() * sizeof(MeshTriangle);
+        for (const MeshVertex& vertex : meshBlock1)
+            bytes += vertex.duplicates.capacity() * sizeof(uint32_t);
+        return bytes;
+    }
+
+    // Gives back the decoded vertices and triangles once they are written.
+    void freeDecoded()
+    {
+        std::vector<vec3>().swap(normals);
+        std::vector<MeshVertex>().swap(meshBlock1);
+        std::vector<MeshTriangle>().swap(triangles);
+        std::vector<MeshTriangle>().swap(parsedTriangles);
+        std::vector<Meshlet>().swap(meshlets);
+        std::vector<uint32_t>().swap(meshletVertices);
+        std::vector<uint8_t>().swap(meshletTriangles);
+        std::vector<std::vector<MeshTriangle>>().swap(lods);
+    }
+
+    // The triangles the OBJ writer uses: the .idx file's when one was read.
+    std::vector<MeshTriangle>& outputTriangles()
+    {
+        return parsedTriangles.size() > 0 ? parsedTriangles : triangles;
+    }
+
+    const std::vector<MeshTriangle>& outputTriangles() const
+    {
+        return parsedTriangles.size() > 0 ? parsedTriangles : triangles;
+    }
+
+    void dumpBlock1ToOBJ(const std::string& filename, const GeomMaterial& material)
+    {
+        FILE* dmp = fopen(filename.c_str(), "w+");
+        
+        if (dmp)
+        {
+            writeOBJ(dmp, material);
+            fclose(dmp);
+        }
+
+    }
+
+    void writeOBJ(FILE* dmp, const GeomMaterial& material)
+    {
+        if (materialId < material.materialEntries.size())
+        {
+            GeomMaterialEntry mat = material.materialEntries[materialId];
+
+            fprintf(dmp, "mtllib %s\n", mat.getfilename().c_str());
+            fprintf(dmp, "usemtl %s\n", mat.name().c_str());
+        }
+
+        std::vector<MeshTriangle>& tris = outputTriangles();
+
+        // Vertices and faces are formatted in blocks, several at a time in
+        // parallel on a scheduler worker, and written in order.
+        const size_t BLOCK_SIZE = 1024;
+        size_t vertexBlocks = (num_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        size_t triangleBlocks = (tris.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        size_t numBlocks = vertexBlocks + triangleBlocks;
+        size_t blocksPerRound = (size_t)schedulerWorkers() * 4;
+        std::vector<std::string> text(blocksPerRound);
+        for (size_t round = 0; round < numBlocks; round += blocksPerRound)
+        {
+            size_t count = std::min(blocksPerRound, numBlocks - round);
+            parallelFor(count, 1, Stage::Write, [&](size_t begin, size_t end)
+            {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    size_t block = round + i;
+                    text[i].clear();
+                    if (block < vertexBlocks)
+                        formatVertices(text[i], block * BLOCK_SIZE, std::min<size_t>((block + 1) * BLOCK_SIZE, num_vertices));
+                    else
+                        formatTriangles(text[i], tris, (block - vertexBlocks) * BLOCK_SIZE, std::min((block - vertexBlocks + 1) * BLOCK_SIZE, tris.size()));
+                }
+            });
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (round + i == vertexBlocks)
+                    fprintf(dmp, "\n");
+                fwrite(text[i].data(), 1, text[i].size(), dmp);
+            }
+        }
+        if (triangleBlocks == 0)
+            fprintf(dmp, "\n");
+    }
+
+    void formatVertices(std::string& out, size_t begin, size_t end) const
+    {
+        for (size_t v = begin; v < end; ++v)
+        {
+            const MeshVertex& vertex = meshBlock1[v];
+            out += '#';
+            appendUint(out, (uint32_t)v + 1);
+            out += ' ';
+
+
+            if (vertex.duplicates.size() > 0)
+            {
+                out += "duplicate of (";
+                for (uint32_t dup : vertex.duplicates)
+                {
+                    appendUint(out, dup + 1);
+                    out += ", ";
+                }
+                out += ")";
+            }
+            out += "\n";
+
+            if (!vertex.isValid)
+            {
+                out += "INVALID, outside AABB\n";
+            }
+
+            appendf(out, "v %f %f %f\n", vertex.vx, vertex.vy, vertex.vz);
+            appendf(out, "vt %f %f\n", vertex.tx, vertex.ty * -1);
+            appendf(out, "vn %f %f %f\n\n", vertex.nx, vertex.ny, vertex.nz);
+        }
+    }
+
+    // Every second face is followed by an empty line, counted from the
+    // first face of the mesh.
+    static void formatTriangles(std::string& out, const std::vector<MeshTriangle>& tris, size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; ++t)
+        {
+            const MeshTriangle& tri = tris[t];
+            uint32_t corners[3] = { tri.t_ + 1, tri.tt_ + 1, tri.ttt_ + 1 };
+            out += 'f';
+            for (uint32_t corner : corners)
+            {
+                out += ' ';
+                appendUint(out, corner);
+                out += '/';
+                appendUint(out, corner);
+                out += '/';
+                appendUint(out, corner);
+            }
+            out += '\n';
+            if (t % 2 == 1)
+            {
+                out += "\n";
+            }
+        }
+    }
+};
+
+struct Geom
+{
+    Geom(const std::string& filename, uint32_t filesize)
+    {
+        m_filename = filename;
+        m_filesize = filesize;
+    }
+
+    GeomHeader geomheader;
+    std::vector<GeomMeshHeader> meshHeaders;
+
+    uint32_t offset = 0u;
+    void parse(uint8_t* data)
+    {
+        
+        geomheader.num_meshes = parse32(data, offset);
+        geomheader.unk1 = parse32(data, offset);
+        geomheader.unk2 = parse32(data, offset);
+        geomheader.filesize = parse32(data, offset);
+
+        uint32_t aabboffset = m_filesize - (6 * sizeof(float));
+        aabb.maxX = parsef32(data, aabboffset);
+        aabb.maxY = parsef32(data, aabboffset);
+        aabb.maxZ = parsef32(data, aabboffset);
+        aabb.minX = parsef32(data, aabboffset);
+        aabb.minY = parsef32(data, aabboffset);
+        aabb.minZ = parsef32(data, aabboffset);
+    }
+
+    void parseMeshHeaders(uint8_t* data)
+    {
+        for (uint32_t i = 0; i < geomheader.num_meshes; ++i)
+        {
+            GeomMeshHeader h;
+            h.parse(aabb, data, offset);
+            meshHeaders.push_back(h);
+        }
+    }
+
+    void parseMesh(uint8_t* data, bool readIdx, bool markDuplicates = true)
+    {
+        // Meshes don't share anything, so on a scheduler worker each can be
+        // stolen by another.
+        parallelFor(meshHeaders.size(), 1, Stage::Count, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                {
+                    StageScope scope(Stage::Vertex, (int32_t)i);
+                    scope.setItems(meshHeaders[i].num_vertices);
+                    meshHeaders[i].parseBlock1(data, markDuplicates);
+                    meshHeaders[i].parseFloatBlock(data);
+                }
+                StageScope scope(Stage::Index, (int32_t)i);
+                scope.setItems(meshHeaders[i].numIndices / 3);
+                if (readIdx)
+                    meshHeaders[i].readTriangleDataFromIndexArray(m_filename, (int)i);
+                meshHeaders[i].parseIndexArray(data);
+            }
+        });
+    }
+
+    uint64_t decodedBytes() const
+    {
+        uint64_t bytes = 0;
+        for (const GeomMeshHeader& h : meshHeaders)
+            bytes += h.decodedBytes();
+        return bytes;
+    }
+
+    void dump_meshes(const GeomMaterial& material)
+    {
+        parallelFor(meshHeaders.size(), 1, Stage::Count, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                StageScope scope(Stage::Write, (int32_t)i);
+                scope.setItems(meshHeaders[i].num_vertices);
+                meshHeaders[i].dumpBlock1ToOBJ(meshObjPath(m_filename, i), material);
+                meshHeaders[i].freeDecoded();
+            }
+        });
+    }
+
+    std::string m_filename;
+    uint32_t m_filesize;
+    GeomAABB aabb;
+};
@@ -1,924 +1,359 @@
-#include <iostream>
-#include <vector>
-#include <assert.h>
-#include <sstream>
-#include <regex>
-#include "half.hpp"
-#include <fstream>
-#include <regex>
-
-inline uint32_t Reverse32(uint32_t value)
-{
-    return (((value & 0x000000FF) << 24) |
-        ((value & 0x0000FF00) << 8) |
-        ((value & 0x00FF0000) >> 8) |
-        ((value & 0xFF000000) >> 24));
-}
-
-inline uint16_t Reverse16(uint16_t value)
-{
-    return (((value & 0x00FF) << 8) |
-        ((value & 0xFF00) >> 8));
-}
-
-inline int16_t Reversei16(int16_t value)
-{
-    return (((value & 0x00FF) << 8) |
-        ((value & 0xFF00) >> 8));
-}
-
-
-uint8_t* readfile(const std::string& file, int& size)
-{
-    FILE* fp = fopen(file.c_str(), "rb");
-    if (fp)
-    {
-        fseek(fp, 0L, SEEK_END);
-        size = ftell(fp);
-        fseek(fp, 0L, SEEK_SET);
-        uint8_t* data = new uint8_t[size];
-        fread(data, 1, size, fp);
-        fclose(fp);
-        return data;
-    }
-
-    size = 0;
-    return nullptr;
-}
-
-float ReverseFloat(const float inFloat)
-{
-    float retVal;
-    char* floatToConvert = (char*)&inFloat;
-    char* returnFloat = (char*)&retVal;
-
-    // swap the bytes into a temporary buffer
-    returnFloat[0] = floatToConvert[3];
-    returnFloat[1] = floatToConvert[2];
-    returnFloat[2] = floatToConvert[1];
-    returnFloat[3] = floatToConvert[0];
-
-    return retVal;
-}
-
-uint32_t parse32(uint8_t* data, uint32_t& offset)
-{
-    uint32_t* buf = (uint32_t*)&data[offset];
-    offset += sizeof(uint32_t);
-    return Reverse32(*buf);
-}
-
-uint16_t parse16(uint8_t* data, uint32_t& offset)
-{
-    uint16_t* buf = (uint16_t*)&data[offset];
-    offset += sizeof(uint16_t);
-    return Reverse16(*buf);
-}
-
-int16_t parsei16(uint8_t* data, uint32_t& offset)
-{
-    int16_t* buf = (int16_t*)&data[offset];
-    offset += sizeof(int16_t);
-    return Reverse16(*buf);
-}
-
-static int min = 0;
-static int max = 0;
-
-float parsef8(uint8_t* data, uint32_t& offset)
-{
-    const float scale = 1.0f / 127.0f;
-    int8_t ival = data[offset];
-    if (ival < min)
-        min = ival;
-    if (ival > max)
-        max = ival;
-    float val = ival * scale;
-    ++offset;
-    return val;
-}
-
-
-uint8_t parse8(uint8_t* data, uint32_t& offset)
-{
-    uint8_t val = data[offset];
-    ++offset;
-    return val;
-}
-
-float parsef32(uint8_t* data, uint32_t& offset)
-{
-    uint32_t be = parse32(data, offset);
-    float f;
-    std::memcpy(&f, &be, sizeof(float));
-    return f;
-}
-
-float parsef16(uint8_t* data, uint32_t& offset)
-{
-    uint32_t be = parse16(data, offset);
-
-    uint32_t floatval = (((uint32_t)be & 0x8000) << 16) | (((uint32_t)be & 0x7FFF) << 13) + 0x38000000;
-    float fv;
-    std::memcpy(&fv, &floatval, sizeof(float));
-
-    half_float::half f;
-    std::memcpy(&f.data_, &be, sizeof(uint16_t));
-    float ff = float(f);
-    return ff;
-}
-
-struct GeomTexture
-{
-    std::string name;
-    std::string texfile;
-};
-
-struct GeomMaterialEntry
-{
-    uint32_t texcount;
-    std::vector<GeomTexture> textures;
-    uint32_t id;
-    std::string filename;
-
-    std::string name()
-    {
-        if (textures.size() > 0)
-            return textures[0].name;
-
-        return "NO_TEXTURE";
-    }
-
-    std::string getfilename()
-    {
-        size_t lastslash = filename.find_last_of("/");
-        if (lastslash != std::string::npos)
-        {
-            filename = filename.substr(lastslash + 1, filename.length() - lastslash - 1);
-        }
-
-        std::string material = std::regex_replace(filename, std::regex(".mat.edge"), "");
-        std::stringstream ss;
-        assert(textures.size() > 0);
-        ss << id << "_" << material << ".mtl";
-        return ss.str();
-    }
-
-    void dumpMaterial(const std::string& path)
-    {
-        if (textures.size() > 0)
-        {
-            std::string filename = path + getfilename();
-            FILE* fp = fopen(filename.c_str(), "w+");
-            std::regex dds("\\.dds");
-            std::string tex = std::regex_replace(textures[0].texfile, dds, ".png");
-            fprintf(fp, "newmtl %s\n", textures[0].name.c_str());
-            fprintf(fp, "Ka 1.000000 1.000000 1.000000\n");
-            fprintf(fp, "Kd 1.000000 1.000000 1.000000\n");
-            fprintf(fp, "Ks 0.000000 0.000000 0.000000\n");
-            fprintf(fp, "map_Kd %s\n", tex.c_str());
-            if (textures.size() > 1)
-            {
-                tex = std::regex_replace(textures[1].texfile, dds, ".png");
-
-                fprintf(fp, "norm %s\n", tex.c_str());
-            }
-
-            if (textures.size() > 2)
-            {
-                printf("More than 2 textures, investigate!\n");
-            }
-            fclose(fp);
-        }
-    }
-};
-
-std::string parseString(uint8_t* data, uint32_t& offset)
-{
-    char str[64];
-    memset(str, 0, sizeof(str));
-    memcpy(str, data + offset, 64);
-    offset += 64;
-    str[63] = 0;
-    return std::string(str);
-}
-struct GeomMaterial
-{
-    uint32_t num_materials;
-    std::vector<GeomMaterialEntry> materialEntries;
-    
-    GeomMaterial(const std::string& filename)
-    : m_filename(filename)
-    {
-    }
-
-
-    void parse(uint8_t* data)
-    {
-        uint32_t offset = 0u;
-        num_materials = parse32(data, offset);
-        for (uint32_t m = 0; m < num_materials; ++m)
-        {
-            GeomMaterialEntry e;
-            e.texcount = parse32(data, offset);
-            e.id = m;
-            e.filename = m_filename;
-            for (uint32_t tex = 0; tex < e.texcount; ++tex)
-            {
-                GeomTexture t;
-                t.name = parseString(data, offset);
-                t.texfile = parseString(data, offset);
-                e.textures.push_back(t);
-            }
-            materialEntries.push_back(e);
-        }
-    }
-
-    void dumpMaterials(const std::string& path)
-    {
-        for (auto& e : materialEntries)
-        {
-            e.dumpMaterial(path);
-        }
-    }
-    std::string m_filename;
-};
-
-GeomMaterial geommaterial("");
-
-struct GeomHeader
-{
-    uint32_t num_meshes;
-    uint32_t unk1;
-    uint32_t unk2;
-    uint32_t filesize;
-};
-
-struct GeomAABB
-{
-    float minX;
-    float minY;
-    float minZ;
-    float maxX;
-    float maxY;
-    float maxZ;
-};
-
-struct MeshTriangle
-{
-    uint32_t t_, tt_, ttt_;
-    MeshTriangle(uint32_t v1, uint32_t v2, uint32_t v3)
-        : t_(v1), tt_(v2), ttt_(v3)
-    {}
-
-    std::string v1()
-    {
-        std::stringstream ss;
-        ss << (t_ + 1) << "/" << (t_ + 1) << "/" << (t_ + 1);
-        return ss.str();
-    }
-    std::string v2()
-    {
-        std::stringstream ss;
-        ss << (tt_ + 1) << "/" << (tt_ + 1) << "/" << (tt_ + 1);
-        return ss.str();
-    }
-    std::string v3()
-    {
-        std::stringstream ss;
-        ss << (ttt_ + 1) << "/" << (ttt_ + 1) << "/" << (ttt_ + 1);
-        return ss.str();
-    }
-
-    bool operator == (const MeshTriangle& t2) const
-    {
-        return (t_ == t2.t_) &&
-               (tt_ == t2.tt_) &&
-               (ttt_ == t2.ttt_);
-    }
-};
-
-struct MeshVertex
-{
-    float vx, vy, vz;
-    float tx, ty;
-    float nx, ny, nz;
-    uint32_t id_;
-    MeshVertex(uint32_t id, float x, float y, float z, GeomAABB& aabb)
-        : id_(id), vx(x), vy(y), vz(z)
-    {
-        if ((vx < aabb.minX || vx > aabb.maxX))
-            isValid = false;
-        if ((vy < aabb.minY || vy > aabb.maxY))
-            isValid = false;
-        if ((vz < aabb.minZ || vz > aabb.maxZ))
-            isValid = false;
-    }
-
-    const float EPSILON = 0.00001f;
-
-    bool operator == (const MeshVertex& v) const
-    {
-        float xd = abs(vx - v.vx);
-        float yd = abs(vy - v.vy);
-        float zd = abs(vz - v.vz);
-        return (xd < EPSILON) &&
-               (yd < EPSILON) &&
-               (zd < EPSILON);
-    }
-
-    bool isValid = true;
-    std::vector<uint32_t> duplicates;
-};
-
-struct vec3
-{
-    float x_;
-    float y_;
-    float z_;
-
-    vec3(float x, float y, float z)
-    : x_(x), y_(y), z_(z)
-    {
-    }
-
-    float magnitude()
-    {
-        return sqrt((x_ * x_) + (y_ * y_) + (z_ * z_));
-    }
-
-    void normalize()
-    {
-        float length = magnitude();
-        if (length > 0)
-        {
-            x_ /= length;
-            y_ /= length;
-            z_ /= length;
-        }
-    }
-};
-
-struct GeomMeshHeader
-{
-    uint32_t signature;
-    uint16_t unk1;
-    uint8_t unk2;
-    uint8_t materialId;
-    uint16_t unk3;
-    uint16_t numIndices;
-    uint32_t allFF;
-
-    uint32_t meshTrianglesAddress;
-    uint16_t meshTrianglesSize;
-    uint8_t* m_triangle_data;
-
-    uint16_t padding1;
-
-    uint32_t meshBlock1Address;
-    uint32_t meshBlock1EndAddress;
-    uint16_t meshBlock1Length;
-    uint16_t padding2;
-
-    uint32_t normalBlockLength;
-    uint32_t unk32_2;
-
-    uint32_t textureBlock1Address;
-    uint32_t textureBlock1Length;
-
-    static const uint32_t NUM_OFFSETS = 19;
-
-    uint32_t offsets[NUM_OFFSETS];
-
-    uint32_t num_vertices;
-    uint32_t num_tex_coords;
-
-    GeomAABB aabb_;
-
-    std::vector<vec3> normals;
-
-    struct MeshFloat
-    {
-        float m_val;
-        uint32_t m_addr;
-        MeshFloat(uint32_t addr, float val)
-        {
-            m_val = val;
-            m_addr = addr;
-        }
-    };
-
-    std::vector<MeshVertex> meshBlock1;
-    std::vector<MeshTriangle> triangles;
-    std::vector<MeshTriangle> parsedTriangles;
-
-    void parse(GeomAABB& aabb, uint8_t* data, uint32_t& offset)
-    {
-        aabb_ = aabb;
-        signature = parse32(data, offset);
-        unk1 = parse16(data, offset);
-        unk2 = parse8(data, offset);
-        materialId = parse8(data, offset);
-        unk3 = parse16(data, offset);
-        numIndices = parse16(data, offset);
-        allFF = parse32(data, offset);
-
-        meshTrianglesAddress = parse32(data, offset);
-        meshTrianglesSize = parse16(data, offset);
-        padding1 = parse16(data, offset);
-
-        meshBlock1Address = parse32(data, offset);
-        meshBlock1EndAddress = parse32(data, offset);
-        meshBlock1Length = parse16(data, offset);
-        
-        num_vertices = meshBlock1Length / 4 / 3;
-
-        padding2 = parse16(data, offset);
-
-        normalBlockLength = parse32(data, offset);
-        unk32_2 = parse32(data, offset);
-
-        textureBlock1Address = parse32(data, offset);
-        textureBlock1Length = parse32(data, offset);
-        num_tex_coords = textureBlock1Length / 2 / 2;
-
-        for (uint32_t i = 0; i < NUM_OFFSETS; ++i)
-        {
-            offsets[i] = parse32(data, offset);
-        }
-    }
-
-    std::vector<uint16_t> readVariableBitArray(uint8_t* variableBitIndices, uint32_t numBitsPerValue, uint32_t numVarBitIndices)
-    {
-        std::vector<uint16_t> parsedVariableBitIndices;
-        uint32_t total = (numVarBitIndices + 0x1F) & 0xFFFFFFE0;
-        uint32_t offset = (total - 1) * numBitsPerValue;
-        for (uint32_t i = total; i > 0; --i)
-        {
-            uint8_t* start = variableBitIndices + (offset / 8);
-
-            uint32_t first = start[0];
-            uint32_t second = start[1];
-            uint32_t third = start[2];
-
-            uint32_t output = (first << 24) |
-                (second << 16) |
-                (third << 8);
-
-            output <<= (offset & 0x07);
-
-            parsedVariableBitIndices.insert(parsedVariableBitIndices.begin(), output >> (32 - numBitsPerValue));
-            offset -= numBitsPerValue;
-        }
-
-        return parsedVariableBitIndices;
-    }
-
-    std::vector<uint16_t> read1bArray(const std::vector<uint16_t>& variableBitIndices, const uint8_t* prefaceData, uint32_t numIndices)
-    {
-        std::vector<uint16_t> decodedIndices;
-        const uint8_t MASK_INITIAL = 0x80;
-
-        uint16_t indexValue = 0;
-
-        uint8_t mask = MASK_INITIAL;
-        uint32_t index = 0;
-        uint32_t prefaceDataIndex = 0;
-        const uint32_t count = (numIndices + 0x0F) & 0xFFFFFFF0;
-
-        for (uint32_t i = 0; i < count; ++i)
-        {
-            uint8_t currentPrefaceByte = prefaceData[prefaceDataIndex];
-
-            if ((currentPrefaceByte & mask) == 0)
-            {
-                decodedIndices.push_back(indexValue++);
-            }
-            else
-            {
-                decodedIndices.push_back(variableBitIndices[index++]);
-            }
-
-            mask >>= 1;
-
-            if (mask == 0)
-            {
-                mask = MASK_INITIAL;
-                prefaceDataIndex++;
-                if (prefaceDataIndex >= (numIndices / 8))
-                {
-                    break;
-                }
-            }
-        }
-
-        return decodedIndices;
-    }
-
-    void readBackRefIndices(std::vector<uint16_t>& indices, uint32_t numIndices, uint16_t backRefOffset)
-    {
-        const uint8_t NUM_BACKREFS = 8;
-
-        uint16_t backRefs[NUM_BACKREFS];
-        memset(backRefs, 0, sizeof(backRefs));
-
-        uint32_t count = ((numIndices + 0x1F) & 0xFFFFFFE0) / 8;
-        for (uint32_t i = 0; i < count; i++)
-        {
-            for (uint32_t backref = 0; backref < NUM_BACKREFS; backref++)
-            {
-                backRefs[backref] = indices[(i * NUM_BACKREFS) + backref] - backRefOffset + backRefs[backref];
-                indices[(i * NUM_BACKREFS) + backref] = backRefs[backref];
-            }
-        }
-    }
-
-    std::vector<uint16_t> buildFaces(const std::vector<uint16_t>& indices, uint8_t* faceData, uint32_t numTris)
-    {
-        std::vector<uint16_t> indexArray;
-        const uint8_t TRIS_PER_BYTE = 4;
-        const uint8_t BITS_PER_TRIANGLE = 2;
-        const uint32_t TOTALTRIS = (numTris + 7) & 0xFFFFFFF8;
-
-        uint32_t index = 0;
-        uint32_t faceIndex = 0;
-        uint32_t faceDataSize = TOTALTRIS / TRIS_PER_BYTE;
-        for (uint32_t face = 0; face < faceDataSize; face++)
-        {
-            uint8_t faceByte = faceData[faceIndex++];
-            for (uint32_t tri = 0; tri < TRIS_PER_BYTE; ++tri)
-            {
-                uint8_t operation = faceByte & 0xC0;
-                uint32_t last = indexArray.size();
-                switch (operation)
-                {
-                case 0xC0: // new triangle
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    break;
-
-                case 0x0: // backref -3 -1 0
-                    indexArray.push_back(indexArray[last - 3]);
-                    indexArray.push_back(indexArray[last - 1]);
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    break;
-
-                case 0x40: // backref -1 -2 0
-                    indexArray.push_back(indexArray[last - 1]);
-                    indexArray.push_back(indexArray[last - 2]);
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    break;
-
-                case 0x80: // backref -2 -3 0
-                    indexArray.push_back(indexArray[last - 2]);
-                    indexArray.push_back(indexArray[last - 3]);
-                    indexArray.push_back(indices[index++]); if (index >= indices.size()) return indexArray;
-                    break;
-
-                }
-
-                faceByte <<= BITS_PER_TRIANGLE;
-            }
-        }
-
-        return indexArray;
-    }
-
-    void parseIndexArray(const uint8_t* data)
-    {
-        m_triangle_data = new uint8_t[meshTrianglesSize];
-        memset(m_triangle_data, 0, meshTrianglesSize);
-        memcpy(m_triangle_data, data + meshTrianglesAddress, meshTrianglesSize);
-
-        uint32_t readOffset = 0;
-        uint32_t numVarBitIndices = parse16(m_triangle_data, readOffset);
-        uint16_t backRefOffset = parse16(m_triangle_data, readOffset);
-        uint32_t num1BitIndices = parse16(m_triangle_data, readOffset) * 8;
-        uint8_t variableIndexBitSize = parse8(m_triangle_data, readOffset);
-
-        uint32_t numTriangles = numIndices / 3;
-        uint32_t offsetFaceBytes = ((num1BitIndices + 7) / 8) + 8;
-        uint32_t numFaceBytes = (((numTriangles + numTriangles) + 7) / 8);
-        uint32_t offsetArrayVarBit = offsetFaceBytes + numFaceBytes;
-
-        std::vector<uint16_t> variableBitIndices = readVariableBitArray(m_triangle_data + offsetArrayVarBit, variableIndexBitSize, numVarBitIndices);
-        readBackRefIndices(variableBitIndices, numVarBitIndices, backRefOffset);
-        std::vector<uint16_t> decodedIndices = read1bArray(variableBitIndices, m_triangle_data + 8, num1BitIndices);
-        std::vector<uint16_t> indexArray = buildFaces(decodedIndices, m_triangle_data + offsetFaceBytes, numTriangles);
-
-        for (uint32_t i = 0; i < numTriangles; ++i)
-        {
-            uint32_t i1 = i * 3;
-            uint32_t i2 = (i * 3) + 1;
-            uint32_t i3 = (i * 3) + 2;
-            triangles.push_back(MeshTriangle(indexArray[i1], indexArray[i2], indexArray[i3]));
-        }
-        delete[] m_triangle_data;
-    }
-
-    void readTriangleDataFromIndexArray(const std::string& filename, int number)
-    {
-        std::stringstream ss;
-        ss << filename << ".idx." << number;
-
-        int idxsize;
-        uint8_t* idxdata = readfile(ss.str(), idxsize);
-        if (idxdata != nullptr)
-        {
-            uint32_t offset = 0;
-            while (offset < idxsize)
-            {
-                uint16_t i1 = parse16(idxdata, offset);
-                uint16_t i2 = parse16(idxdata, offset);
-                uint16_t i3 = parse16(idxdata, offset);
-                parsedTriangles.push_back(MeshTriangle(i1, i2, i3));
-            }
-        }
-
-    }
-
-    void parseFloatBlock(uint8_t* data)
-    {
-        uint32_t offset = meshBlock1EndAddress;
-
-        for (uint32_t i = 0; i < num_vertices; ++i)
-        {
-            
-
-            float nx = parsef8(data, offset) -0.5f;
-            float ny = parsef8(data, offset) - 0.5f;
-            float nz = parsef8(data, offset) - 0.5f;
-            offset += 3;
-
-            //float nx = parsef8(data, offset);
-            //float ny = parsef8(data, offset);
-            //float nz = parsef8(data, offset);
-
-            vec3 normal(nx, ny, nz);
-            normal.normalize();
-            normals.push_back(normal);
-        }
-
-        for (uint32_t i = 0; i < num_vertices; ++i)
-        {
-            meshBlock1[i].nx = normals[i].x_;
-            meshBlock1[i].ny = normals[i].y_;
-            meshBlock1[i].nz = normals[i].z_;
-        }
-    }
-
-    void parseBlock1(uint8_t* data)
-    {
-        uint32_t offset = meshBlock1Address;
-        uint32_t length = meshBlock1EndAddress - meshBlock1Address;
-        assert(length == meshBlock1Length);
-        uint32_t id = 0;
-        for (uint16_t v = 0; v < meshBlock1Length / 4; v += 3)
-        {
-            float x = parsef32(data, offset);
-            float y = parsef32(data, offset);
-            float z = parsef32(data, offset);
-            meshBlock1.push_back(MeshVertex(id++, x, y, z, aabb_));
-        }
-
-        offset = textureBlock1Address;
-        
-        for (uint16_t t = 0; t < (textureBlock1Length / 2 / 2); t++)
-        {
-            float t1 = parsef16(data, offset);
-            float t2 = parsef16(data, offset);
-            meshBlock1[t].tx = t1;
-            meshBlock1[t].ty = t2;
-        }
-
-        uint32_t v = 0;
-        while (v < meshBlock1.size())
-        {
-            MeshVertex& vertex = meshBlock1[v];
-            ++v;
-            for (uint32_t dup = v; dup < meshBlock1.size(); ++dup)
-            {
-                MeshVertex& vertex2 = meshBlock1[dup];
-                if (vertex == vertex2)
-                {
-                    vertex.duplicates.push_back(vertex2.id_);
-                    vertex2.duplicates.push_back(vertex.id_);
-                }
-            }
-            
-        }
-    }
-
-
-    void dumpBlock1ToOBJ(const std::string& filename)
-    {
-        FILE* dmp = fopen(filename.c_str(), "w+");
-        
-        if (dmp)
-        {
-            if (materialId < geommaterial.materialEntries.size())
-            {
-                GeomMaterialEntry mat = geommaterial.materialEntries[materialId];
-
-                fprintf(dmp, "mtllib %s\n", mat.getfilename().c_str());
-                fprintf(dmp, "usemtl %s\n", mat.name().c_str());
-            }
-            uint32_t index = 1;
-            for (uint32_t v = 0; v < num_vertices; ++v)
-            {
-                MeshVertex& vertex = meshBlock1[v];
-                fprintf(dmp, "#%u ", v + 1);
-
-
-                if (vertex.duplicates.size() > 0)
-                {
-                    fprintf(dmp, "duplicate of (");
-                    for (uint32_t dup : vertex.duplicates)
-                    {
-                        fprintf(dmp, "%u, ", dup + 1);
-                    }
-                   fprintf(dmp, ")");
-                }
-                fprintf(dmp, "\n");
-
-                if (!vertex.isValid)
-                {
-                    fprintf(dmp, "INVALID, outside AABB\n");
-                }
-
-                fprintf(dmp, "v %f %f %f\n", vertex.vx, vertex.vy, vertex.vz);
-                fprintf(dmp, "vt %f %f\n", vertex.tx, vertex.ty * -1);
-                fprintf(dmp, "vn %f %f %f\n\n", vertex.nx, vertex.ny, vertex.nz);
-                index++;
-            }
-
-            fprintf(dmp, "\n");
-
-            uint32_t n_tri = 0;
-
-            std::vector<MeshTriangle>& tris = parsedTriangles.size() > 0 ? parsedTriangles : triangles;
-
-            int count = 0;
-            for (MeshTriangle& tri : tris)
-            {
-                fprintf(dmp, "f %s %s %s\n", tri.v1().c_str(), tri.v2().c_str(), tri.v3().c_str());
-                count++;
-                if (count % 2 == 0)
-                {
-                    fprintf(dmp, "\n");
-                }
-            }
-
-            fclose(dmp);
-        }
-
-    }
-};
-
-struct Geom
-{
-    Geom(const std::string& filename, uint32_t filesize)
-    {
-        m_filename = filename;
-        m_filesize = filesize;
-    }
-
-    GeomHeader geomheader;
-    std::vector<GeomMeshHeader> meshHeaders;
-
-    uint32_t offset = 0u;
-    void parse(uint8_t* data)
-    {
-        
-        geomheader.num_meshes = parse32(data, offset);
-        geomheader.unk1 = parse32(data, offset);
-        geomheader.unk2 = parse32(data, offset);
-        geomheader.filesize = parse32(data, offset);
-
-        uint32_t aabboffset = m_filesize - (6 * sizeof(float));
-        aabb.maxX = parsef32(data, aabboffset);
-        aabb.maxY = parsef32(data, aabboffset);
-        aabb.maxZ = parsef32(data, aabboffset);
-        aabb.minX = parsef32(data, aabboffset);
-        aabb.minY = parsef32(data, aabboffset);
-        aabb.minZ = parsef32(data, aabboffset);
-    }
-
-    void parseMeshHeaders(uint8_t* data)
-    {
-        for (uint32_t i = 0; i < geomheader.num_meshes; ++i)
-        {
-            GeomMeshHeader h;
-            h.parse(aabb, data, offset);
-            meshHeaders.push_back(h);
-        }
-    }
-
-    void parseMesh(uint8_t* data, bool readIdx)
-    {
-        for (int i = 0; i < meshHeaders.size(); ++i)
-        {
-            meshHeaders[i].parseBlock1(data);
-            meshHeaders[i].parseFloatBlock(data);
-            if (readIdx)
-                meshHeaders[i].readTriangleDataFromIndexArray(m_filename, i);
-            meshHeaders[i].parseIndexArray(data);
-        }
-    }
-
-    void dump_meshes()
-    {
-        for (size_t i = 0; i < meshHeaders.size(); ++i)
-        {
-            std::stringstream str;
-            str << m_filename << i << ".obj";
-            meshHeaders[i].dumpBlock1ToOBJ(str.str());
-        }
-        
-    }
-
-    std::string m_filename;
-    uint32_t m_filesize;
-    GeomAABB aabb;
-};
-
-int main(int argc, char* argv[])
-{
-#ifndef _DEBUG
-    if (argc != 2)
-    {
-        printf("Usage geomparse mesh\n");
-        return -1;
-    }
-    std::string file = argv[1];
-#else
-    std::vector<std::string> files;
-    //files.push_back("D:/trash panic/reveng/Stage2_Geom.dmp/Bluerayrecoder/Bluerayrecoder_damage_Mesh.geom.edge");
-    //files.push_back("D:/trash panic/reveng/Stage2_Geom.dmp/Bluerayrecoder/Bluerayrecoder_break_Mesh5.geom.edge");
-    //files.push_back("D:/trash panic/reveng/Stage5_Geom.dmp/Yuden/YUDEN_MASTER.geom.edge");
-    //files.push_back("D:/trash panic/reveng/Stage4_Geom.dmp/RES_MDL_S_STAGE/gomibako_gomibako_1.geom.edge");
-    //files.push_back("D:/trash panic/reveng/Stage4_Geom.dmp/RES_MDL_S_STAGE/huta_huta_3.geom.edge");
-    //files.push_back("d:/trash panic/reveng/Stage5_Geom.dmp/RES_MDL_S_UI/tmp_tmp_Default.geom.edge");
-    //files.push_back("d:/trash panic/reveng/Stage2_Geom.dmp/LCTV/LCTV_MASTER.geom.edge");
-    //files.push_back("d:/trash panic/reveng/Stage1_Geom.dmp/BaboCoin/BaboCoin_MASTER.geom.edge");
-    //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/SMM/SMM_SLIP_anim.geom.edge");
-    
-    //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/Post/Post_break_stone.geom.edge");
-    //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/Post/Post_damage_damage.geom.edge");
-    files.push_back("D:/trash panic/reveng/Stage1_Geom.dmp/Humberger/HUMBURGER_break_Mesh2.geom.edge");
-    //files.push_back("d:/trash panic/reveng/Stage1_Geom.dmp/Teapot/Teapot_MASTER.geom.edge");
-    //files.push_back("D:/trash panic/reveng/Title_Geom.dmp/PressStart/PRESS_START_Default.geom.edge");
-    
-    //files.push_back("D:/trash panic/test/Piggybank/piggybank_MASTER.geom.edge");
-
-//#define DECODE_ONLY
-#define MULTIPLE
-
-#endif    
-
-
-#ifdef MULTIPLE
-    for (const std::string& file: files)
-    {
-#endif
-        try
-        {
-            std::string path = file;
-            if (path.find_last_of("/") != std::string::npos)
-            {
-                path = path.substr(0, path.find_last_of("/")) + "/";
-            }
-
-            int geomsize;
-            uint8_t* data = readfile(file, geomsize);
-            std::string material = std::regex_replace(file, std::regex("geom.edge"), "mat.edge");
-
-            int matsize;
-            uint8_t* matdata = readfile(material, matsize);
-
-            GeomMaterial m(material);
-            m.parse(matdata);
-            m.dumpMaterials(path);
-            geommaterial = m;
-
-            Geom g(file, geomsize);
-            g.parse(data);
-            g.parseMeshHeaders(data);
-            bool readIdx = false;
-            g.parseMesh(data, readIdx);
-
-        
-#ifndef DECODE_ONLY
-            g.dump_meshes();
-#endif
-        }
-        catch (...)
-        {
-            printf("Exception thrown when parsing %s\n", file.c_str());
-        }
-
-#ifdef MULTIPLE
-        }
-#endif
-}
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include "batch.hpp"
+#include "bench.hpp"
+#include "daemon.hpp"
+#include "export.hpp"
+#include "kernels.hpp"
+#include "profile.hpp"
+#include "shard.hpp"
+#include "synth.hpp"
+#include "watch.hpp"
+
+void printUsage()
+{
+    printf("Usage geomparse [options] mesh|dir|list.txt...\n");
+    printf("      geomparse synth outdir [options]\n");
+    printf("      geomparse bench [--compare baseline.json] [options]\n");
+    printf("      geomparse merge [-o merged.json] part.json...\n");
+    printf("      geomparse serve --socket path [--jobs N]\n");
+    printf("      geomparse client --socket path convert|decode|stats|shutdown [mesh|dir|list.txt...]\n");
+    printf("  --jobs N       convert files on N worker threads\n");
+    printf("  --pipeline     separate reader, decoder (--jobs of them) and writer threads\n");
+    printf("  --queue-depth N files buffered between pipeline stages (default 4)\n");
+    printf("  --reader kind  sync|pread|io_uring, pipeline input reader (default sync)\n");
+    printf("  --reads N      file pairs the pread/io_uring reader keeps in flight (default 16)\n");
+    printf("  --schedule s   lpt|fifo, order of files across --jobs (default lpt, largest first)\n");
+    printf("  --memory-budget size  cap the estimated memory of files in flight, e.g. 512M or 2G\n");
+    printf("  --shard K/N    convert only shard K of N of the inputs (0 <= K < N)\n");
+    printf("  --shard-by s   hash|cost, split by path hash or balance estimated cost (default hash)\n");
+    printf("  --manifest f   write the status and stats of every converted file to f\n");
+    printf("  --export e     also export decoded meshes: gpx (<input>.gpx) or shm:NAME (POSIX shm NAME.<index>)\n");
+    printf("                 where index counts all inputs, before --shard picks its files\n");
+    printf("  --merge-materials  with --export, merge the meshes sharing a material into one, indices rebased\n");
+    printf("  --no-obj       skip the OBJ/MTL output\n");
+    printf("  --weld         merge vertices with equal position (within epsilon), UV and normal; drop degenerate triangles\n");
+    printf("  --optimize     reorder triangles for the vertex cache and vertices by first use; prints ACMR/ATVR\n");
+    printf("  --meshlets     build meshlets (64 vertices, 124 triangles) with bounds and normal cones for --export\n");
+    printf("  --lods list    simplified levels for --export, as decreasing fractions of the triangles, e.g. 0.5,0.25,0.1\n");
+    printf("  --watch        keep running and convert inputs again when they change (Linux)\n");
+    printf("  --trace file   write a Chrome trace-event timeline (open in Perfetto)\n");
+    printf("  --profile      print per-stage timings when done\n");
+    printf("  --alloc-stats  count allocations, bytes and peak live bytes per stage\n");
+    printf("  --counters     sample hardware counters per stage (Linux perf_event_open)\n");
+    printf("  --isa level    force the decode kernels to scalar|sse|avx2|avx512 (default best supported)\n");
+}
+
+// Bytes, with an optional K, M or G suffix (powers of 1024).
+static bool parseSize(const char* text, uint64_t& size)
+{
+    char* end = nullptr;
+    double value = strtod(text, &end);
+    if (end == text || value < 0)
+        return false;
+    const char* SUFFIXES = "KMG";
+    uint64_t scale = 1;
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        if (toupper(*end) == SUFFIXES[i])
+        {
+            scale = 1ull << (10 * (i + 1));
+            ++end;
+            break;
+        }
+    }
+    if (*end == 'B' || *end == 'b')
+        ++end;
+    if (*end != '\0')
+        return false;
+    size = (uint64_t)(value * scale);
+    return true;
+}
+
+// Comma-separated fractions in (0, 1), decreasing, at most MAX_LODS.
+static bool parseLods(const char* text, std::vector<float>& lods)
+{
+    lods.clear();
+    const char* p = text;
+    while (true)
+    {
+        char* end = nullptr;
+        double value = strtod(p, &end);
+        if (end == p || !(value > 0.0 && value < 1.0) || (!lods.empty() && value >= lods.back()) || lods.size() == MAX_LODS)
+            return false;
+        lods.push_back((float)value);
+        if (*end == '\0')
+            return true;
+        if (*end != ',')
+            return false;
+        p = end + 1;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "synth")
+        return synthMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "bench")
+        return benchMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "merge")
+        return mergeMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "serve")
+        return serveMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "client")
+        return clientMain(argc - 1, argv + 1);
+
+    std::vector<std::string> inputs;
+    std::vector<std::string> files;
+    std::string traceFile;
+    bool profile = false;
+    bool allocStats = false;
+    bool counters = false;
+    bool watch = false;
+    ExportKind exportKind = ExportKind::None;
+    std::string exportPrefix;
+    ExportOptions exportOptions;
+    BatchOptions batch;
+    ShardSpec shard;
+    std::string manifestFile;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc)
+        {
+            batch.jobs = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--pipeline")
+        {
+            batch.pipeline = true;
+        }
+        else if (arg == "--queue-depth" && i + 1 < argc)
+        {
+            batch.queueDepth = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--reader" && i + 1 < argc)
+        {
+            if (!readerFromName(argv[++i], batch.reader))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--reads" && i + 1 < argc)
+        {
+            batch.readsInFlight = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--schedule" && i + 1 < argc)
+        {
+            std::string schedule = argv[++i];
+            if (schedule != "lpt" && schedule != "fifo")
+            {
+                printUsage();
+                return -1;
+            }
+            batch.largestFirst = schedule == "lpt";
+        }
+        else if (arg == "--memory-budget" && i + 1 < argc)
+        {
+            if (!parseSize(argv[++i], batch.memoryBudget))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--shard" && i + 1 < argc)
+        {
+            if (!parseShard(argv[++i], shard))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--shard-by" && i + 1 < argc)
+        {
+            if (!shardByFromName(argv[++i], shard.by))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--manifest" && i + 1 < argc)
+        {
+            manifestFile = argv[++i];
+        }
+        else if (arg == "--export" && i + 1 < argc)
+        {
+            if (!parseExport(argv[++i], exportKind, exportPrefix))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--merge-materials")
+        {
+            exportOptions.mergeMaterials = true;
+        }
+        else if (arg == "--no-obj")
+        {
+            batch.write = false;
+        }
+        else if (arg == "--weld")
+        {
+            batch.mesh.weld = true;
+        }
+        else if (arg == "--optimize")
+        {
+            batch.mesh.optimize = true;
+        }
+        else if (arg == "--meshlets")
+        {
+            batch.mesh.meshlets = true;
+        }
+        else if (arg == "--lods" && i + 1 < argc)
+        {
+            if (!parseLods(argv[++i], batch.mesh.lods))
+            {
+                printUsage();
+                return -1;
+            }
+        }
+        else if (arg == "--watch")
+        {
+            watch = true;
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+        }
+        else if (arg == "--profile")
+        {
+            profile = true;
+        }
+        else if (arg == "--alloc-stats")
+        {
+            allocStats = true;
+        }
+        else if (arg == "--counters")
+        {
+            counters = true;
+        }
+        else if (arg == "--isa" && i + 1 < argc)
+        {
+            if (!kernelsSelect(argv[++i]))
+                return -1;
+        }
+        else if (arg.compare(0, 6, "--isa=") == 0)
+        {
+            if (!kernelsSelect(arg.c_str() + 6))
+                return -1;
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            printUsage();
+            return -1;
+        }
+        else if (!collectInputs(arg, files))
+        {
+            return -1;
+        }
+        else
+        {
+            inputs.push_back(arg);
+        }
+    }
+
+#ifdef _DEBUG
+    if (files.empty())
+    {
+        //files.push_back("D:/trash panic/reveng/Stage2_Geom.dmp/Bluerayrecoder/Bluerayrecoder_damage_Mesh.geom.edge");
+        //files.push_back("D:/trash panic/reveng/Stage2_Geom.dmp/Bluerayrecoder/Bluerayrecoder_break_Mesh5.geom.edge");
+        //files.push_back("D:/trash panic/reveng/Stage5_Geom.dmp/Yuden/YUDEN_MASTER.geom.edge");
+        //files.push_back("D:/trash panic/reveng/Stage4_Geom.dmp/RES_MDL_S_STAGE/gomibako_gomibako_1.geom.edge");
+        //files.push_back("D:/trash panic/reveng/Stage4_Geom.dmp/RES_MDL_S_STAGE/huta_huta_3.geom.edge");
+        //files.push_back("d:/trash panic/reveng/Stage5_Geom.dmp/RES_MDL_S_UI/tmp_tmp_Default.geom.edge");
+        //files.push_back("d:/trash panic/reveng/Stage2_Geom.dmp/LCTV/LCTV_MASTER.geom.edge");
+        //files.push_back("d:/trash panic/reveng/Stage1_Geom.dmp/BaboCoin/BaboCoin_MASTER.geom.edge");
+        //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/SMM/SMM_SLIP_anim.geom.edge");
+
+        //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/Post/Post_break_stone.geom.edge");
+        //files.push_back("D:/trash panic/reveng/2P_vs_Geom.dmp/Post/Post_damage_damage.geom.edge");
+        files.push_back("D:/trash panic/reveng/Stage1_Geom.dmp/Humberger/HUMBURGER_break_Mesh2.geom.edge");
+        //files.push_back("d:/trash panic/reveng/Stage1_Geom.dmp/Teapot/Teapot_MASTER.geom.edge");
+        //files.push_back("D:/trash panic/reveng/Title_Geom.dmp/PressStart/PRESS_START_Default.geom.edge");
+
+        //files.push_back("D:/trash panic/test/Piggybank/piggybank_MASTER.geom.edge");
+    }
+#endif
+
+    if (files.empty())
+    {
+        printUsage();
+        return -1;
+    }
+
+    if (exportKind != ExportKind::None)
+    {
+        batch.decoded = [exportKind, exportPrefix, exportOptions](const FileJob& job)
+        {
+            return exportJob(job, exportKind, exportPrefix, exportOptions);
+        };
+    }
+
+    Manifest manifest;
+    manifest.corpus = corpusId(files);
+    manifest.corpusFiles = (uint32_t)files.size();
+    manifest.shard = shard;
+    std::vector<uint32_t> corpusIndices = shardFiles(files, shard);
+    std::vector<std::string> corpus = files;
+    if (shard.count > 1)
+    {
+        std::vector<std::string> shardInputs;
+        for (uint32_t i : corpusIndices)
+            shardInputs.push_back(files[i]);
+        files.swap(shardInputs);
+        batch.corpusIndices = corpusIndices;
+        printf("shard %u/%u: %zu of %u files\n", shard.index, shard.count, files.size(), manifest.corpusFiles);
+    }
+
+    profileEnable(!traceFile.empty(), profile, allocStats, counters);
+    profileSetFiles(files);
+
+    uint64_t start = profileNow();
+    std::vector<FileResult> results = runBatch(files, batch);
+    manifest.wallNs = profileNow() - start;
+
+    if (batch.mesh.any())
+    {
+        MeshProcessStats process;
+        for (const FileResult& r : results)
+            process.add(r.process);
+        printMeshProcessStats(process, batch.mesh);
+    }
+
+    if (!manifestFile.empty())
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            ManifestEntry e;
+            e.index = corpusIndices[i];
+            e.path = files[i];
+            e.result = results[i];
+            manifest.files.push_back(e);
+        }
+        if (!writeManifest(manifestFile, manifest))
+            return -1;
+    }
+
+    if (!traceFile.empty())
+        profileWriteTrace(traceFile);
+    profilePrintSummary();
+
+    if (watch)
+    {
+        profileEnable(false, false, false, false);
+        return watchInputs(inputs, corpus, batch);
+    }
+    return 0;
+}
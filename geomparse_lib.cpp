@@ -0,0 +1,521 @@
+#include "geomparse_lib.h"
+#include "geom.hpp"
+#include "vertexlayout.hpp"
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+
+struct GpGeom
+{
+    uint8_t* data; // the parsers take non-const pointers but only read
+    size_t size;
+    Geom geom;
+
+    GpGeom(const void* data_, size_t size_)
+        : data((uint8_t*)data_), size(size_), geom(std::string(), (uint32_t)size_)
+    {
+    }
+};
+
+static const uint32_t MESH_HEADER_SIZE = 128;
+static const uint32_t AABB_SIZE = 6 * sizeof(float);
+
+static bool inside(uint64_t offset, uint64_t bytes, uint64_t size)
+{
+    return offset <= size && bytes <= size - offset;
+}
+
+// Vertices with a decoded texture coordinate; the rest get 0, as in an
+// export block.
+static uint32_t texCoordCount(const GeomMeshHeader& h)
+{
+    return std::min(h.num_tex_coords, h.num_vertices);
+}
+
+static bool meshValid(const GeomMeshHeader& h, uint64_t size)
+{
+    return inside(h.meshBlock1Address, attributeSpan(h.positionStream, h.num_vertices), size) &&
+        inside(h.meshBlock1EndAddress, attributeSpan(h.normalStream, h.num_vertices), size) &&
+        inside(h.textureBlock1Address, attributeSpan(h.texCoordStream, texCoordCount(h)), size) &&
+        inside(h.meshTrianglesAddress, h.meshTrianglesSize, size);
+}
+
+static AttributeStream& meshStream(GeomMeshHeader& h, uint32_t attribute)
+{
+    return attribute == GP_ATTRIBUTE_POSITION ? h.positionStream : attribute == GP_ATTRIBUTE_NORMAL ? h.normalStream : h.texCoordStream;
+}
+
+static const AttributeStream& meshStream(const GeomMeshHeader& h, uint32_t attribute)
+{
+    return attribute == GP_ATTRIBUTE_POSITION ? h.positionStream : attribute == GP_ATTRIBUTE_NORMAL ? h.normalStream : h.texCoordStream;
+}
+
+static_assert(GP_STREAM_EDGE_NORMAL == (uint32_t)AttributeFormat::EdgeNormal, "GpStreamFormat follows AttributeFormat");
+
+// The kernels of a mesh's streams, picked once per decode.
+struct StreamKernels
+{
+    AttributeKernel position;
+    AttributeKernel normal;
+    AttributeKernel texCoord;
+
+    StreamKernels(const GeomMeshHeader& h)
+        : position(attributeKernel(h.positionStream)), normal(attributeKernel(h.normalStream)), texCoord(attributeKernel(h.texCoordStream))
+    {
+    }
+};
+
+// The bit streams decodeIndexArray walks must lie within the triangle
+// block, and the 1-bit array can't ask for more values than were unpacked.
+static bool indexDataValid(const GeomMeshHeader& h, uint8_t* triangleData)
+{
+    if (h.meshTrianglesSize < 8)
+        return false;
+    uint32_t readOffset = 0;
+    uint32_t numVarBitIndices = parse16(triangleData, readOffset);
+    parse16(triangleData, readOffset);
+    uint32_t num1BitIndices = parse16(triangleData, readOffset) * 8;
+    uint32_t bits = parse8(triangleData, readOffset);
+
+    uint32_t numTriangles = h.numIndices / 3;
+    uint64_t offsetFaceBytes = ((num1BitIndices + 7) / 8) + 8;
+    uint64_t numFaceBytes = (((numTriangles + numTriangles) + 7) / 8);
+    uint64_t offsetArrayVarBit = offsetFaceBytes + numFaceBytes;
+    uint64_t total = (numVarBitIndices + 0x1F) & 0xFFFFFFE0;
+    if (total > 0 && (bits == 0 || bits > 17))
+        return false;
+    if (!inside(offsetArrayVarBit, (total * bits + 7) / 8, h.meshTrianglesSize))
+        return false;
+
+    uint64_t fromStream = 0;
+    for (uint32_t i = 0; i < num1BitIndices / 8; ++i)
+    {
+        for (uint8_t byte = triangleData[8 + i]; byte != 0; byte &= byte - 1)
+            ++fromStream;
+    }
+    return fromStream <= total;
+}
+
+static const uint32_t ATTRIBUTE_COMPONENTS[GP_ATTRIBUTE_COUNT] = { 3, 3, 2 };
+
+static bool layoutValid(const GpVertexLayout& layout)
+{
+    for (uint32_t a = 0; a < GP_ATTRIBUTE_COUNT; ++a)
+    {
+        const GpVertexElement& element = layout.elements[a];
+        if (element.format == GP_FORMAT_NONE)
+            continue;
+        uint32_t size = vertexFormatSize((GpFormat)element.format);
+        if (size == 0)
+            return false;
+        if ((element.format == GP_FORMAT_SNORM16 || element.format == GP_FORMAT_SNORM8) && a != GP_ATTRIBUTE_NORMAL)
+            return false;
+        if (!inside(element.offset, (uint64_t)size * ATTRIBUTE_COMPONENTS[a], layout.stride))
+            return false;
+    }
+    return true;
+}
+
+template <GpFormat Format>
+static void store(uint8_t* dst, float value)
+{
+    if (Format == GP_FORMAT_FLOAT32)
+    {
+        memcpy(dst, &value, 4);
+    }
+    else if (Format == GP_FORMAT_FLOAT16)
+    {
+        uint16_t half = half_float::half(value).data_;
+        memcpy(dst, &half, 2);
+    }
+    else if (Format == GP_FORMAT_SNORM16)
+    {
+        int16_t snorm = (int16_t)lrintf(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+        memcpy(dst, &snorm, 2);
+    }
+    else if (Format == GP_FORMAT_SNORM8)
+    {
+        *dst = (uint8_t)(int8_t)lrintf(std::min(std::max(value, -1.0f), 1.0f) * 127.0f);
+    }
+}
+
+// Count consecutive components.
+template <GpFormat Format, uint32_t Count>
+static void store(uint8_t* dst, const float* values)
+{
+    if (Format == GP_FORMAT_FLOAT32)
+    {
+        memcpy(dst, values, Count * 4);
+        return;
+    }
+    for (uint32_t c = 0; c < Count; ++c)
+        store<Format>(dst + c * vertexFormatSize(Format), values[c]);
+}
+
+// One attribute of count vertices, component c of vertex v at
+// components[c][v * step], into element of each vertex at dst.
+template <GpFormat Format>
+static void writeElement(const float* const* components, uint32_t numComponents, uint32_t step, size_t count, uint8_t* dst, uint32_t stride)
+{
+    for (size_t v = 0; v < count; ++v, dst += stride)
+    {
+        for (uint32_t c = 0; c < numComponents; ++c)
+            store<Format>(dst + c * vertexFormatSize(Format), components[c][v * step]);
+    }
+}
+
+static void writeElement(const float* const* components, uint32_t numComponents, uint32_t step, size_t count, uint32_t format,
+    uint8_t* dst, uint32_t stride)
+{
+    switch (format)
+    {
+    case GP_FORMAT_FLOAT32: writeElement<GP_FORMAT_FLOAT32>(components, numComponents, step, count, dst, stride); break;
+    case GP_FORMAT_FLOAT16: writeElement<GP_FORMAT_FLOAT16>(components, numComponents, step, count, dst, stride); break;
+    case GP_FORMAT_SNORM16: writeElement<GP_FORMAT_SNORM16>(components, numComponents, step, count, dst, stride); break;
+    case GP_FORMAT_SNORM8: writeElement<GP_FORMAT_SNORM8>(components, numComponents, step, count, dst, stride); break;
+    }
+}
+
+const uint32_t VERTEX_CHUNK = 256;
+
+// Decodes vertices [begin, begin + count) with decoded texture coordinates
+// for the first numTexCoords of the mesh.
+static void decodeTexCoords(const GpGeom& gp, const GeomMeshHeader& h, AttributeKernel kernel, uint32_t begin, uint32_t count, float* uvs)
+{
+    uint32_t numTexCoords = texCoordCount(h);
+    uint32_t decoded = begin < numTexCoords ? std::min(count, numTexCoords - begin) : 0;
+    kernel(gp.data + h.textureBlock1Address + (size_t)begin * h.texCoordStream.stride, h.texCoordStream, decoded, uvs);
+    std::fill(uvs + decoded * 2, uvs + count * 2, 0.0f);
+}
+
+static void decodePositions(const GpGeom& gp, const GeomMeshHeader& h, AttributeKernel kernel, uint32_t begin, uint32_t count, float* positions)
+{
+    kernel(gp.data + h.meshBlock1Address + (size_t)begin * h.positionStream.stride, h.positionStream, count, positions);
+}
+
+static void decodeNormals(const GpGeom& gp, const GeomMeshHeader& h, AttributeKernel kernel, uint32_t begin, uint32_t count, float* normals)
+{
+    kernel(gp.data + h.meshBlock1EndAddress + (size_t)begin * h.normalStream.stride, h.normalStream, count, normals);
+}
+
+// Any layout: each attribute is decoded a chunk at a time by the kernels
+// into a small buffer that stays in L1, and written from there.
+static void decodeVertices(const GpGeom& gp, const GeomMeshHeader& h, const GpVertexLayout& layout, uint8_t* out)
+{
+    StreamKernels kernels(h);
+    float x[VERTEX_CHUNK * 3];
+    for (uint32_t begin = 0; begin < h.num_vertices; begin += VERTEX_CHUNK)
+    {
+        uint32_t count = std::min(VERTEX_CHUNK, h.num_vertices - begin);
+        uint8_t* dst = out + (size_t)begin * layout.stride;
+
+        const GpVertexElement& position = layout.elements[GP_ATTRIBUTE_POSITION];
+        if (position.format != GP_FORMAT_NONE)
+        {
+            decodePositions(gp, h, kernels.position, begin, count, x);
+            const float* components[3] = { x, x + 1, x + 2 };
+            writeElement(components, 3, 3, count, position.format, dst + position.offset, layout.stride);
+        }
+
+        const GpVertexElement& normal = layout.elements[GP_ATTRIBUTE_NORMAL];
+        if (normal.format != GP_FORMAT_NONE)
+        {
+            decodeNormals(gp, h, kernels.normal, begin, count, x);
+            const float* components[3] = { x, x + 1, x + 2 };
+            writeElement(components, 3, 3, count, normal.format, dst + normal.offset, layout.stride);
+        }
+
+        const GpVertexElement& texCoord = layout.elements[GP_ATTRIBUTE_TEXCOORD];
+        if (texCoord.format != GP_FORMAT_NONE)
+        {
+            decodeTexCoords(gp, h, kernels.texCoord, begin, count, x);
+            const float* components[2] = { x, x + 1 };
+            writeElement(components, 2, 2, count, texCoord.format, dst + texCoord.offset, layout.stride);
+        }
+    }
+}
+
+// A layout from vertexlayout.hpp: the attributes of a chunk are decoded
+// first, then every vertex is written whole with its formats and offsets
+// fixed at compile time.
+template <class Layout>
+static void decodeVertices(const GpGeom& gp, const GeomMeshHeader& h, uint8_t* out)
+{
+    const bool hasNormals = Layout::NORMAL_FORMAT != GP_FORMAT_NONE;
+    const bool hasTexCoords = Layout::TEXCOORD_FORMAT != GP_FORMAT_NONE;
+    StreamKernels kernels(h);
+    float positions[VERTEX_CHUNK * 3], normals[VERTEX_CHUNK * 3], uvs[VERTEX_CHUNK * 2];
+    for (uint32_t begin = 0; begin < h.num_vertices; begin += VERTEX_CHUNK)
+    {
+        uint32_t count = std::min(VERTEX_CHUNK, h.num_vertices - begin);
+        decodePositions(gp, h, kernels.position, begin, count, positions);
+        if (hasNormals)
+            decodeNormals(gp, h, kernels.normal, begin, count, normals);
+        if (hasTexCoords)
+            decodeTexCoords(gp, h, kernels.texCoord, begin, count, uvs);
+
+        uint8_t* dst = out + (size_t)begin * Layout::STRIDE;
+        for (uint32_t v = 0; v < count; ++v, dst += Layout::STRIDE)
+        {
+            store<Layout::POSITION_FORMAT, 3>(dst + Layout::POSITION_OFFSET, positions + v * 3);
+            if (hasNormals)
+                store<Layout::NORMAL_FORMAT, 3>(dst + Layout::NORMAL_OFFSET, normals + v * 3);
+            if (hasTexCoords)
+                store<Layout::TEXCOORD_FORMAT, 2>(dst + Layout::TEXCOORD_OFFSET, uvs + v * 2);
+        }
+    }
+}
+
+typedef void (*VertexWriter)(const GpGeom& gp, const GeomMeshHeader& h, uint8_t* out);
+
+struct LayoutWriter
+{
+    GpVertexLayout layout;
+    VertexWriter write;
+};
+
+template <class Layout>
+static LayoutWriter layoutWriter()
+{
+    LayoutWriter writer = { Layout::descriptor(), decodeVertices<Layout> };
+    return writer;
+}
+
+static const LayoutWriter LAYOUT_WRITERS[] =
+{
+    layoutWriter<VertexLayoutP>(),
+    layoutWriter<VertexLayoutPN>(),
+    layoutWriter<VertexLayoutPNT>(),
+    layoutWriter<VertexLayoutPNTh>(),
+    layoutWriter<VertexLayoutPN16Th>(),
+    layoutWriter<VertexLayoutPN8Th>(),
+    layoutWriter<VertexLayoutPhN8Th>(),
+};
+
+static bool sameLayout(const GpVertexLayout& a, const GpVertexLayout& b)
+{
+    if (a.stride != b.stride)
+        return false;
+    for (uint32_t e = 0; e < GP_ATTRIBUTE_COUNT; ++e)
+    {
+        if (a.elements[e].format != b.elements[e].format)
+            return false;
+        if (a.elements[e].format != GP_FORMAT_NONE && a.elements[e].offset != b.elements[e].offset)
+            return false;
+    }
+    return true;
+}
+
+static VertexWriter findWriter(const GpVertexLayout& layout)
+{
+    for (const LayoutWriter& writer : LAYOUT_WRITERS)
+    {
+        if (sameLayout(writer.layout, layout))
+            return writer.write;
+    }
+    return nullptr;
+}
+
+static GpResult decodeIndices(const GpGeom& gp, const GeomMeshHeader& h, void* out, uint32_t indexSize, size_t outSize, uint32_t& written)
+{
+    const uint32_t PADDING = 8;
+    std::vector<uint8_t> triangleData(h.meshTrianglesSize + PADDING, 0);
+    memcpy(triangleData.data(), gp.data + h.meshTrianglesAddress, h.meshTrianglesSize);
+    if (!indexDataValid(h, triangleData.data()))
+        return GP_INVALID_DATA;
+
+    std::vector<uint16_t> indices = h.decodeIndexArray(triangleData.data());
+    size_t count = std::min<size_t>(h.numIndices / 3, indices.size() / 3) * 3;
+    if (count * indexSize > outSize)
+        return GP_BUFFER_TOO_SMALL;
+    if (indexSize == 2)
+    {
+        memcpy(out, indices.data(), count * 2);
+    }
+    else
+    {
+        uint32_t* out32 = (uint32_t*)out;
+        for (size_t i = 0; i < count; ++i)
+            out32[i] = indices[i];
+    }
+    written = (uint32_t)count;
+    return GP_OK;
+}
+
+const char* gpResultName(GpResult result)
+{
+    switch (result)
+    {
+    case GP_OK: return "ok";
+    case GP_INVALID_ARGUMENT: return "invalid argument";
+    case GP_INVALID_DATA: return "invalid data";
+    case GP_BUFFER_TOO_SMALL: return "buffer too small";
+    case GP_OUT_OF_MEMORY: return "out of memory";
+    }
+    return "unknown";
+}
+
+GpResult gpOpenGeom(const void* data, size_t size, GpGeom** geom)
+{
+    if (geom == nullptr)
+        return GP_INVALID_ARGUMENT;
+    *geom = nullptr;
+    if (data == nullptr)
+        return GP_INVALID_ARGUMENT;
+    if (size < sizeof(GeomHeader) + AABB_SIZE || size > UINT32_MAX)
+        return GP_INVALID_DATA;
+
+    try
+    {
+        std::unique_ptr<GpGeom> gp(new GpGeom(data, size));
+        uint32_t offset = 0;
+        uint32_t numMeshes = parse32(gp->data, offset);
+        if (!inside(sizeof(GeomHeader), (uint64_t)numMeshes * MESH_HEADER_SIZE, size - AABB_SIZE))
+            return GP_INVALID_DATA;
+        gp->geom.parse(gp->data);
+        gp->geom.parseMeshHeaders(gp->data);
+        for (const GeomMeshHeader& h : gp->geom.meshHeaders)
+        {
+            if (!meshValid(h, size))
+                return GP_INVALID_DATA;
+        }
+        *geom = gp.release();
+        return GP_OK;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return GP_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return GP_INVALID_DATA;
+    }
+}
+
+void gpCloseGeom(GpGeom* geom)
+{
+    delete geom;
+}
+
+uint32_t gpMeshCount(const GpGeom* geom)
+{
+    return geom ? (uint32_t)geom->geom.meshHeaders.size() : 0;
+}
+
+GpResult gpMeshInfo(const GpGeom* geom, uint32_t mesh, GpMeshInfo* info)
+{
+    if (geom == nullptr || info == nullptr || mesh >= geom->geom.meshHeaders.size())
+        return GP_INVALID_ARGUMENT;
+    const GeomMeshHeader& h = geom->geom.meshHeaders[mesh];
+    info->materialId = h.materialId;
+    info->numVertices = h.num_vertices;
+    info->numIndices = h.numIndices / 3 * 3;
+    return GP_OK;
+}
+
+void gpGeomAABB(const GpGeom* geom, float aabbMin[3], float aabbMax[3])
+{
+    if (geom == nullptr)
+        return;
+    const GeomAABB& aabb = geom->geom.aabb;
+    aabbMin[0] = aabb.minX;
+    aabbMin[1] = aabb.minY;
+    aabbMin[2] = aabb.minZ;
+    aabbMax[0] = aabb.maxX;
+    aabbMax[1] = aabb.maxY;
+    aabbMax[2] = aabb.maxZ;
+}
+
+GpResult gpMeshStream(const GpGeom* geom, uint32_t mesh, GpAttribute attribute, GpStream* stream)
+{
+    if (geom == nullptr || stream == nullptr || mesh >= geom->geom.meshHeaders.size() || (uint32_t)attribute >= GP_ATTRIBUTE_COUNT)
+        return GP_INVALID_ARGUMENT;
+    const AttributeStream& s = meshStream(geom->geom.meshHeaders[mesh], attribute);
+    stream->format = (uint32_t)s.format;
+    stream->components = s.components;
+    stream->stride = s.stride;
+    stream->offset = s.offset;
+    memcpy(stream->integerBits, s.integerBits, 4);
+    memcpy(stream->fractionBits, s.fractionBits, 4);
+    return GP_OK;
+}
+
+GpResult gpSetMeshStream(GpGeom* geom, uint32_t mesh, GpAttribute attribute, const GpStream* stream)
+{
+    if (geom == nullptr || stream == nullptr || mesh >= geom->geom.meshHeaders.size() || (uint32_t)attribute >= GP_ATTRIBUTE_COUNT)
+        return GP_INVALID_ARGUMENT;
+    if (stream->format >= NUM_ATTRIBUTE_FORMATS || stream->components != ATTRIBUTE_COMPONENTS[attribute] || stream->stride > 255 || stream->offset > 255)
+        return GP_INVALID_ARGUMENT;
+    AttributeStream s;
+    s.format = (AttributeFormat)stream->format;
+    s.components = (uint8_t)stream->components;
+    s.stride = (uint8_t)stream->stride;
+    s.offset = (uint8_t)stream->offset;
+    memcpy(s.integerBits, stream->integerBits, 4);
+    memcpy(s.fractionBits, stream->fractionBits, 4);
+    if (!attributeStreamValid(s))
+        return GP_INVALID_ARGUMENT;
+
+    // Vertex and texture coordinate counts come from the block lengths, so
+    // they follow the stride.
+    GeomMeshHeader h = geom->geom.meshHeaders[mesh];
+    meshStream(h, attribute) = s;
+    if (attribute == GP_ATTRIBUTE_POSITION)
+        h.num_vertices = h.meshBlock1Length / s.stride;
+    else if (attribute == GP_ATTRIBUTE_TEXCOORD)
+        h.num_tex_coords = h.textureBlock1Length / s.stride;
+    if (!meshValid(h, geom->size))
+        return GP_INVALID_DATA;
+    geom->geom.meshHeaders[mesh] = h;
+    return GP_OK;
+}
+
+GpResult gpDecodeMesh(const GpGeom* geom, uint32_t mesh, const GpVertexLayout* layout, void* vertices, size_t verticesSize,
+    void* indices, uint32_t indexSize, size_t indicesSize, uint32_t* numIndices)
+{
+    if (numIndices)
+        *numIndices = 0;
+    if (geom == nullptr || mesh >= geom->geom.meshHeaders.size())
+        return GP_INVALID_ARGUMENT;
+    if (vertices && (layout == nullptr || !layoutValid(*layout)))
+        return GP_INVALID_ARGUMENT;
+    if (indices && indexSize != 2 && indexSize != 4)
+        return GP_INVALID_ARGUMENT;
+
+    const GeomMeshHeader& h = geom->geom.meshHeaders[mesh];
+    if (vertices && (uint64_t)h.num_vertices * layout->stride > verticesSize)
+        return GP_BUFFER_TOO_SMALL;
+
+    try
+    {
+        // Indices first, so a corrupt mesh fails before anything is written.
+        uint32_t written = 0;
+        if (indices)
+        {
+            GpResult result = decodeIndices(*geom, h, indices, indexSize, indicesSize, written);
+            if (result != GP_OK)
+                return result;
+        }
+        if (vertices)
+        {
+            VertexWriter write = findWriter(*layout);
+            if (write)
+                write(*geom, h, (uint8_t*)vertices);
+            else
+                decodeVertices(*geom, h, *layout, (uint8_t*)vertices);
+        }
+        if (numIndices)
+            *numIndices = written;
+        return GP_OK;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return GP_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return GP_INVALID_DATA;
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embeddable decoder, for loaders that have a .geom.edge in memory and want
+// its meshes in their own vertex and index buffers. Nothing is written to
+// disk and nothing is decoded twice: each mesh goes straight from the
+// source bytes into the caller's buffers, in the layout the caller asks for.
+//
+//     GpGeom* geom;
+//     if (gpOpenGeom(data, size, &geom) != GP_OK) ...
+//     for (uint32_t m = 0; m < gpMeshCount(geom); ++m)
+//     {
+//         GpMeshInfo info;
+//         gpMeshInfo(geom, m, &info);
+//         // allocate info.numVertices * layout.stride bytes and
+//         // info.numIndices indices
+//         gpDecodeMesh(geom, m, &layout, vertices, verticesSize, indices, 4, indicesSize, &numIndices);
+//     }
+//     gpCloseGeom(geom);
+//
+// The GpGeom refers to the caller's data, which has to stay alive and
+// unchanged until it is closed. Different meshes of one GpGeom can be
+// decoded on different threads at the same time. No function throws or
+// prints.
+//
+// vertexlayout.hpp has the common layouts as compile-time descriptors,
+// which decode through writers specialized for them.
+//
+// Link geomparse_static, or geomparse_shared with GEOMPARSE_SHARED defined.
+
+#if defined(GEOMPARSE_SHARED)
+#if defined(_WIN32)
+#if defined(GEOMPARSE_BUILDING)
+#define GEOMPARSE_API __declspec(dllexport)
+#else
+#define GEOMPARSE_API __declspec(dllimport)
+#endif
+#else
+#define GEOMPARSE_API __attribute__((visibility("default")))
+#endif
+#else
+#define GEOMPARSE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct GpGeom GpGeom;
+
+typedef enum GpResult
+{
+    GP_OK,
+    GP_INVALID_ARGUMENT,
+    GP_INVALID_DATA,     // truncated, or blocks pointing outside the data
+    GP_BUFFER_TOO_SMALL,
+    GP_OUT_OF_MEMORY
+} GpResult;
+
+typedef enum GpAttribute
+{
+    GP_ATTRIBUTE_POSITION, // 3 components
+    GP_ATTRIBUTE_NORMAL,   // 3 components, unit length
+    GP_ATTRIBUTE_TEXCOORD, // 2 components, v as stored (not flipped like the OBJ output)
+    GP_ATTRIBUTE_COUNT
+} GpAttribute;
+
+typedef enum GpFormat
+{
+    GP_FORMAT_NONE,    // attribute not written
+    GP_FORMAT_FLOAT32,
+    GP_FORMAT_FLOAT16,
+    GP_FORMAT_SNORM16, // normals only, round(x * 32767)
+    GP_FORMAT_SNORM8   // normals only, round(x * 127)
+} GpFormat;
+
+// Where an attribute goes within a vertex. Components are packed, with no
+// alignment requirement.
+typedef struct GpVertexElement
+{
+    uint32_t format; // GpFormat
+    uint32_t offset;
+} GpVertexElement;
+
+typedef struct GpVertexLayout
+{
+    uint32_t stride;
+    GpVertexElement elements[GP_ATTRIBUTE_COUNT];
+} GpVertexLayout;
+
+// How an attribute is stored in the source, for asset variants whose
+// streams differ from the usual float positions, int8 normals and half
+// UVs. The block each stream lives in stays the one the mesh header names.
+typedef enum GpStreamFormat
+{
+    GP_STREAM_F32,         // big-endian float
+    GP_STREAM_F16,         // big-endian half
+    GP_STREAM_I16N,        // big-endian int16 / 32767
+    GP_STREAM_I16,         // big-endian int16
+    GP_STREAM_U8N,         // uint8 / 255
+    GP_STREAM_U8,          // uint8
+    GP_STREAM_X11Y11Z10N,  // big-endian word, x in the low 11 bits; 3 components
+    GP_STREAM_FIXED_POINT, // signed, integerBits + fractionBits per component, bit packed MSB first
+    GP_STREAM_EDGE_NORMAL  // int8 remapped to [-0.5, 0.5] and normalized; 3 components
+} GpStreamFormat;
+
+typedef struct GpStream
+{
+    uint32_t format;     // GpStreamFormat
+    uint32_t components; // 3 for positions and normals, 2 for texture coordinates
+    uint32_t stride;     // up to 255
+    uint32_t offset;
+    uint8_t integerBits[4];
+    uint8_t fractionBits[4];
+} GpStream;
+
+typedef struct GpMeshInfo
+{
+    uint32_t materialId; // index into the .mat.edge, not necessarily valid
+    uint32_t numVertices;
+    // An upper bound: decoding stops early when a mesh's index stream runs
+    // out, so gpDecodeMesh reports how many it wrote.
+    uint32_t numIndices;
+} GpMeshInfo;
+
+GEOMPARSE_API const char* gpResultName(GpResult result);
+
+// Checks the header and that every mesh's blocks lie within size.
+GEOMPARSE_API GpResult gpOpenGeom(const void* data, size_t size, GpGeom** geom);
+GEOMPARSE_API void gpCloseGeom(GpGeom* geom);
+
+GEOMPARSE_API uint32_t gpMeshCount(const GpGeom* geom);
+GEOMPARSE_API GpResult gpMeshInfo(const GpGeom* geom, uint32_t mesh, GpMeshInfo* info);
+// The AABB stored at the end of the file.
+GEOMPARSE_API void gpGeomAABB(const GpGeom* geom, float aabbMin[3], float aabbMax[3]);
+
+// The stream an attribute of mesh is read from. Setting one re-derives the
+// mesh's vertex or texture coordinate count from its block length and
+// checks the stream against the data; do it before decoding starts.
+GEOMPARSE_API GpResult gpMeshStream(const GpGeom* geom, uint32_t mesh, GpAttribute attribute, GpStream* stream);
+GEOMPARSE_API GpResult gpSetMeshStream(GpGeom* geom, uint32_t mesh, GpAttribute attribute, const GpStream* stream);
+
+// Writes numVertices vertices of layout->stride bytes to vertices and the
+// triangle list to indices, indexSize (2 or 4) bytes per index. Either
+// buffer may be null to skip it. Sizes are in bytes.
+GEOMPARSE_API GpResult gpDecodeMesh(const GpGeom* geom, uint32_t mesh, const GpVertexLayout* layout, void* vertices, size_t verticesSize,
+    void* indices, uint32_t indexSize, size_t indicesSize, uint32_t* numIndices);
+
+#ifdef __cplusplus
+}
+
+#include <memory>
+
+struct GpGeomDeleter
+{
+    void operator()(GpGeom* geom) const
+    {
+        gpCloseGeom(geom);
+    }
+};
+
+typedef std::unique_ptr<GpGeom, GpGeomDeleter> GpGeomPtr;
+
+#endif
@@ -0,0 +1,336 @@
+#include "kernels.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#if GEOMPARSE_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+static const char* ISA_NAMES[NUM_ISAS] = { "scalar", "sse", "avx2", "avx512" };
+
+const char* isaName(Isa isa)
+{
+    return (uint32_t)isa < NUM_ISAS ? ISA_NAMES[(uint32_t)isa] : "?";
+}
+
+bool isaFromName(const char* name, Isa& isa)
+{
+    for (uint32_t i = 0; i < NUM_ISAS; ++i)
+    {
+        if (strcmp(name, ISA_NAMES[i]) == 0)
+        {
+            isa = (Isa)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#if GEOMPARSE_X86
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (uint32_t i = 0; i < 4; ++i)
+        regs[i] = (uint32_t)r[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static CpuFeatures detectFeatures()
+{
+    CpuFeatures f;
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    uint32_t maxLeaf = regs[0];
+    if (maxLeaf < 1)
+        return f;
+
+    cpuid(1, 0, regs);
+    f.sse2 = (regs[3] >> 26) & 1;
+    f.ssse3 = (regs[2] >> 9) & 1;
+    bool osxsave = (regs[2] >> 27) & 1;
+    bool cpuAvx = (regs[2] >> 28) & 1;
+    bool cpuF16c = (regs[2] >> 29) & 1;
+
+    // The OS has to save the wider registers on context switch too.
+    uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+    bool osYmm = (xcr0 & 0x06) == 0x06;
+    bool osZmm = (xcr0 & 0xE6) == 0xE6;
+
+    f.avx = cpuAvx && osYmm;
+    f.f16c = cpuF16c && f.avx;
+
+    if (maxLeaf >= 7)
+    {
+        cpuid(7, 0, regs);
+        f.avx2 = f.avx && ((regs[1] >> 5) & 1);
+        f.bmi2 = (regs[1] >> 8) & 1;
+        f.avx512f = osZmm && ((regs[1] >> 16) & 1);
+        f.avx512bw = f.avx512f && ((regs[1] >> 30) & 1);
+        f.avx512vl = f.avx512f && ((regs[1] >> 31) & 1);
+    }
+    return f;
+}
+#else
+static CpuFeatures detectFeatures()
+{
+    return CpuFeatures();
+}
+#endif
+
+const CpuFeatures& cpuFeatures()
+{
+    static const CpuFeatures features = detectFeatures();
+    return features;
+}
+
+bool isaSupported(Isa isa)
+{
+    const CpuFeatures& f = cpuFeatures();
+    switch (isa)
+    {
+    case Isa::Scalar:
+        return true;
+    case Isa::SSE:
+        return GEOMPARSE_X86 && f.sse2 && f.ssse3;
+    case Isa::AVX2:
+        return isaSupported(Isa::SSE) && f.avx2 && f.bmi2 && f.f16c;
+    case Isa::AVX512:
+        return isaSupported(Isa::AVX2) && f.avx512f && f.avx512bw && f.avx512vl;
+    default:
+        return false;
+    }
+}
+
+Isa isaBest()
+{
+    for (uint32_t i = NUM_ISAS; i > 1; --i)
+    {
+        if (isaSupported((Isa)(i - 1)))
+            return (Isa)(i - 1);
+    }
+    return Isa::Scalar;
+}
+
+void scalarSwapFloats(const uint8_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t* p = src + i * 4;
+        uint32_t bits = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        memcpy(&dst[i], &bits, sizeof(float));
+    }
+}
+
+// Exact for every input including denormals, infinities and NaNs.
+static inline float halfBitsToFloat(uint32_t h)
+{
+    uint32_t bits = (h & 0x7FFF) << 13;
+    uint32_t exponent = bits & 0x0F800000;
+    bits += (127 - 15) << 23;
+    if (exponent == 0x0F800000)
+    {
+        // inf / NaN
+        bits += (128 - 16) << 23;
+    }
+    else if (exponent == 0)
+    {
+        // zero / denormal: renormalize through the FPU
+        const uint32_t magicBits = 113 << 23;
+        float magic;
+        memcpy(&magic, &magicBits, sizeof(float));
+        bits += 1 << 23;
+        float f;
+        memcpy(&f, &bits, sizeof(float));
+        f -= magic;
+        memcpy(&bits, &f, sizeof(float));
+    }
+    bits |= (h & 0x8000) << 16;
+    float result;
+    memcpy(&result, &bits, sizeof(float));
+    return result;
+}
+
+void scalarHalfToFloat(const uint8_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        dst[i] = halfBitsToFloat(((uint32_t)src[i * 2] << 8) | src[i * 2 + 1]);
+    }
+}
+
+void scalarDecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z)
+{
+    const float scale = 1.0f / 127.0f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t* p = src + i * 6;
+        float nx = (int8_t)p[0] * scale - 0.5f;
+        float ny = (int8_t)p[1] * scale - 0.5f;
+        float nz = (int8_t)p[2] * scale - 0.5f;
+        float length = std::sqrt((nx * nx) + (ny * ny) + (nz * nz));
+        if (length > 0)
+        {
+            nx /= length;
+            ny /= length;
+            nz /= length;
+        }
+        x[i] = nx;
+        y[i] = ny;
+        z[i] = nz;
+    }
+}
+
+void scalarUnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t* start = src + (offset / 8);
+        uint32_t output = ((uint32_t)start[0] << 24) | ((uint32_t)start[1] << 16) | ((uint32_t)start[2] << 8);
+        output <<= (offset & 0x07);
+        dst[i] = (uint16_t)(output >> (32 - bits));
+        offset += bits;
+    }
+}
+
+// One unaligned 32-bit load per value instead of three byte loads.
+void wordUnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t word;
+        memcpy(&word, src + (offset / 8), sizeof(word));
+        word = (word >> 24) | ((word >> 8) & 0xFF00) | ((word << 8) & 0xFF0000) | (word << 24);
+        dst[i] = (uint16_t)((word << (offset & 0x07)) >> (32 - bits));
+        offset += bits;
+    }
+}
+
+void scalarDecodeBackRefs(uint16_t* values, size_t count, uint16_t offset)
+{
+    const uint32_t NUM_BACKREFS = 8;
+    uint16_t backRefs[NUM_BACKREFS] = {};
+    for (size_t i = 0; i < count; i += NUM_BACKREFS)
+    {
+        for (uint32_t lane = 0; lane < NUM_BACKREFS; ++lane)
+        {
+            backRefs[lane] = values[i + lane] - offset + backRefs[lane];
+            values[i + lane] = backRefs[lane];
+        }
+    }
+}
+
+// Corners of the previous triangle reused by the backref ops 0x00, 0x40 and
+// 0x80 (-3 -1, -1 -2, -2 -3).
+static const uint8_t BACKREF_FIRST[4] = { 0, 2, 1, 0 };
+static const uint8_t BACKREF_SECOND[4] = { 2, 1, 0, 0 };
+
+static inline uint32_t faceOp(const uint8_t* faceData, uint32_t tri)
+{
+    return (faceData[tri / 4] >> (6 - 2 * (tri & 3))) & 3;
+}
+
+// Mirrors the original decoder, including returning as soon as the last
+// index has been consumed.
+size_t scalarBuildFaces(const uint16_t* indices, size_t numIndices, const uint8_t* faceData, uint32_t numTris, uint16_t* out)
+{
+    const uint32_t TOTALTRIS = (numTris + 7) & 0xFFFFFFF8;
+    size_t index = 0;
+    size_t written = 0;
+    if (numIndices == 0)
+        return written;
+
+    for (uint32_t tri = 0; tri < TOTALTRIS; ++tri)
+    {
+        uint32_t op = faceOp(faceData, tri);
+        if (op == 3)
+        {
+            // new triangle
+            out[written++] = indices[index++]; if (index >= numIndices) return written;
+            out[written++] = indices[index++]; if (index >= numIndices) return written;
+            out[written++] = indices[index++]; if (index >= numIndices) return written;
+        }
+        else
+        {
+            // A backref before the first triangle means the stream is corrupt.
+            if (written < 3)
+                return written;
+            const uint16_t* prev = out + written - 3;
+            uint16_t first = prev[BACKREF_FIRST[op]];
+            uint16_t second = prev[BACKREF_SECOND[op]];
+            out[written++] = first;
+            out[written++] = second;
+            out[written++] = indices[index++]; if (index >= numIndices) return written;
+        }
+    }
+    return written;
+}
+
+static const DecodeKernels KERNEL_TABLES[NUM_ISAS] =
+{
+    { Isa::Scalar, scalarSwapFloats, scalarHalfToFloat, scalarDecodeNormals, scalarUnpackBits, scalarDecodeBackRefs, scalarBuildFaces },
+#if GEOMPARSE_X86
+    { Isa::SSE, sseSwapFloats, sseHalfToFloat, sseDecodeNormals, wordUnpackBits, sseDecodeBackRefs, scalarBuildFaces },
+    { Isa::AVX2, avx2SwapFloats, avx2HalfToFloat, avx2DecodeNormals, avx2UnpackBits, avx2DecodeBackRefs, scalarBuildFaces },
+    // The back-ref chain is serial across 128-bit groups; AVX2 already
+    // covers two groups per step and 512 bits buys nothing more.
+    { Isa::AVX512, avx512SwapFloats, avx512HalfToFloat, avx512DecodeNormals, avx512UnpackBits, avx2DecodeBackRefs, scalarBuildFaces },
+#else
+    { Isa::SSE, scalarSwapFloats, scalarHalfToFloat, scalarDecodeNormals, scalarUnpackBits, scalarDecodeBackRefs, scalarBuildFaces },
+    { Isa::AVX2, scalarSwapFloats, scalarHalfToFloat, scalarDecodeNormals, scalarUnpackBits, scalarDecodeBackRefs, scalarBuildFaces },
+    { Isa::AVX512, scalarSwapFloats, scalarHalfToFloat, scalarDecodeNormals, scalarUnpackBits, scalarDecodeBackRefs, scalarBuildFaces },
+#endif
+};
+
+const DecodeKernels& kernelsFor(Isa isa)
+{
+    return KERNEL_TABLES[(uint32_t)isa < NUM_ISAS ? (uint32_t)isa : 0];
+}
+
+DecodeKernels g_kernels = kernelsFor(isaBest());
+
+bool kernelsSelect(Isa isa)
+{
+    if (!isaSupported(isa))
+        return false;
+    g_kernels = kernelsFor(isa);
+    return true;
+}
+
+bool kernelsSelect(const char* name)
+{
+    Isa isa;
+    if (!isaFromName(name, isa))
+    {
+        printf("Unknown ISA level %s, expected scalar, sse, avx2 or avx512\n", name);
+        return false;
+    }
+    if (!kernelsSelect(isa))
+    {
+        printf("This CPU does not support the %s kernels\n", name);
+        return false;
+    }
+    return true;
+}
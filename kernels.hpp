@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Decode kernels behind a runtime dispatch table. The best level the CPU
+// supports is bound at startup; --isa forces a lower one. Every level
+// produces bit-identical results, so OBJ output never depends on the ISA.
+//
+// The per-ISA translation units are built with their own -m / /arch flags.
+// They must stay free of inline functions and templates shared with the
+// rest of the program, otherwise the linker may pick a copy compiled for a
+// wider ISA than the machine running the scalar path.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GEOMPARSE_X86 1
+#else
+#define GEOMPARSE_X86 0
+#endif
+
+enum class Isa : uint8_t
+{
+    Scalar,
+    SSE,    // SSE2 + SSSE3
+    AVX2,   // AVX2 + BMI2 + F16C
+    AVX512, // AVX-512 F/BW/VL on top of AVX2
+    Count
+};
+
+static const uint32_t NUM_ISAS = (uint32_t)Isa::Count;
+
+const char* isaName(Isa isa);
+bool isaFromName(const char* name, Isa& isa);
+
+struct CpuFeatures
+{
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool avx = false; // including OS support for the YMM state
+    bool avx2 = false;
+    bool bmi2 = false;
+    bool f16c = false;
+    bool avx512f = false; // including OS support for the ZMM/opmask state
+    bool avx512bw = false;
+    bool avx512vl = false;
+};
+
+const CpuFeatures& cpuFeatures();
+
+bool isaSupported(Isa isa);
+Isa isaBest();
+
+struct DecodeKernels
+{
+    Isa isa;
+
+    // count big-endian float32 values
+    void (*swapFloats)(const uint8_t* src, float* dst, size_t count);
+    // count big-endian half values
+    void (*halfToFloat)(const uint8_t* src, float* dst, size_t count);
+    // count vertices of 6 bytes each (3 used int8 components), remapped to
+    // [-0.5, 0.5] and normalized into separate x/y/z streams
+    void (*decodeNormals)(const uint8_t* src, size_t count, float* x, float* y, float* z);
+    // count MSB-first values of bits (1..17) bits each. src must have 8
+    // readable bytes past the packed data.
+    void (*unpackBits)(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst);
+    // In place 8-lane running sum of (value - offset); count is a multiple of 8.
+    void (*decodeBackRefs)(uint16_t* values, size_t count, uint16_t offset);
+    // Expands the 2-bit face ops into out (room for numTris rounded up to 8,
+    // times 3). Stops like the reference decoder as soon as the index stream
+    // runs out; returns the number of indices written. Every op depends on
+    // the previous triangle, so all levels bind the scalar expansion.
+    size_t (*buildFaces)(const uint16_t* indices, size_t numIndices, const uint8_t* faceData, uint32_t numTris, uint16_t* out);
+};
+
+// Table used by the decoder. Bound to isaBest() before main runs.
+extern DecodeKernels g_kernels;
+
+const DecodeKernels& kernelsFor(Isa isa);
+
+// Binds g_kernels to isa. Returns false (and leaves the table alone) when
+// the CPU doesn't support it.
+bool kernelsSelect(Isa isa);
+
+// --isa=name: prints why the level can't be used and returns false.
+bool kernelsSelect(const char* name);
+
+// Reference implementations, also used for tails by the SIMD levels.
+void scalarSwapFloats(const uint8_t* src, float* dst, size_t count);
+void scalarHalfToFloat(const uint8_t* src, float* dst, size_t count);
+void scalarDecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z);
+void scalarUnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst);
+void scalarDecodeBackRefs(uint16_t* values, size_t count, uint16_t offset);
+size_t scalarBuildFaces(const uint16_t* indices, size_t numIndices, const uint8_t* faceData, uint32_t numTris, uint16_t* out);
+
+// Bit unpacking with one word load per value, for levels without gathers.
+void wordUnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst);
+
+#if GEOMPARSE_X86
+void sseSwapFloats(const uint8_t* src, float* dst, size_t count);
+void sseHalfToFloat(const uint8_t* src, float* dst, size_t count);
+void sseDecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z);
+void sseDecodeBackRefs(uint16_t* values, size_t count, uint16_t offset);
+
+void avx2SwapFloats(const uint8_t* src, float* dst, size_t count);
+void avx2HalfToFloat(const uint8_t* src, float* dst, size_t count);
+void avx2DecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z);
+void avx2UnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst);
+void avx2DecodeBackRefs(uint16_t* values, size_t count, uint16_t offset);
+
+void avx512SwapFloats(const uint8_t* src, float* dst, size_t count);
+void avx512HalfToFloat(const uint8_t* src, float* dst, size_t count);
+void avx512DecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z);
+void avx512UnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst);
+#endif
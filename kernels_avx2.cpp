@@ -0,0 +1,136 @@
+#include "kernels.hpp"
+
+#if GEOMPARSE_X86
+#include <immintrin.h>
+
+// AVX2 + BMI2 + F16C. The variable shifts in the scalar tails compile to
+// shlx/shrx.
+
+void avx2SwapFloats(const uint8_t* src, float* dst, size_t count)
+{
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(v, swap));
+    }
+    scalarSwapFloats(src + i * 4, dst + i, count - i);
+}
+
+void avx2HalfToFloat(const uint8_t* src, float* dst, size_t count)
+{
+    const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i h = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i * 2)), swap);
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    scalarHalfToFloat(src + i * 2, dst + i, count - i);
+}
+
+// Sign-extended components of 4 consecutive 6-byte normals (24 bytes),
+// same layout trick as kernels_sse.cpp.
+static void loadNormals4(const uint8_t* p, __m128i& x, __m128i& y, __m128i& z)
+{
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+    x = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 6, -1, -1, -1, 12, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10)));
+    y = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 1, -1, -1, -1, 7, -1, -1, -1, 13, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11)));
+    z = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 2, -1, -1, -1, 8, -1, -1, -1, 14, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12)));
+    x = _mm_srai_epi32(x, 24);
+    y = _mm_srai_epi32(y, 24);
+    z = _mm_srai_epi32(z, 24);
+}
+
+void avx2DecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z)
+{
+    const __m256 scale = _mm256_set1_ps(1.0f / 127.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 zero = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i x0, y0, z0, x1, y1, z1;
+        loadNormals4(src + i * 6, x0, y0, z0);
+        loadNormals4(src + i * 6 + 24, x1, y1, z1);
+        __m256 nx = _mm256_cvtepi32_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(x0), x1, 1));
+        __m256 ny = _mm256_cvtepi32_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(y0), y1, 1));
+        __m256 nz = _mm256_cvtepi32_ps(_mm256_inserti128_si256(_mm256_castsi128_si256(z0), z1, 1));
+        nx = _mm256_sub_ps(_mm256_mul_ps(nx, scale), half);
+        ny = _mm256_sub_ps(_mm256_mul_ps(ny, scale), half);
+        nz = _mm256_sub_ps(_mm256_mul_ps(nz, scale), half);
+        __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny)), _mm256_mul_ps(nz, nz)));
+        __m256 mask = _mm256_cmp_ps(length, zero, _CMP_GT_OQ);
+        _mm256_storeu_ps(x + i, _mm256_blendv_ps(nx, _mm256_div_ps(nx, length), mask));
+        _mm256_storeu_ps(y + i, _mm256_blendv_ps(ny, _mm256_div_ps(ny, length), mask));
+        _mm256_storeu_ps(z + i, _mm256_blendv_ps(nz, _mm256_div_ps(nz, length), mask));
+    }
+    scalarDecodeNormals(src + i * 6, count - i, x + i, y + i, z + i);
+}
+
+static void unpackTail(const uint8_t* src, uint32_t bits, size_t first, size_t count, uint16_t* dst)
+{
+    for (size_t i = first; i < count; ++i)
+    {
+        size_t offset = i * bits;
+        const uint8_t* p = src + (offset / 8);
+        uint32_t word = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        dst[i] = (uint16_t)((word << (offset & 0x07)) >> (32 - bits));
+    }
+}
+
+void avx2UnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst)
+{
+    // Each lane gathers the big-endian word holding its value, shifts the
+    // value to the top and back down.
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+    const __m256i step = _mm256_set1_epi32((int)(bits * 8));
+    const __m128i downShift = _mm_cvtsi32_si128((int)(32 - bits));
+    __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)bits));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i word = _mm256_i32gather_epi32((const int*)src, _mm256_srli_epi32(offsets, 3), 1);
+        word = _mm256_shuffle_epi8(word, swap);
+        word = _mm256_sllv_epi32(word, _mm256_and_si256(offsets, seven));
+        word = _mm256_and_si256(_mm256_srl_epi32(word, downShift), low16);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(word, word), 0x08);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(packed));
+        offsets = _mm256_add_epi32(offsets, step);
+    }
+    unpackTail(src, bits, i, count, dst);
+}
+
+void avx2DecodeBackRefs(uint16_t* values, size_t count, uint16_t offset)
+{
+    // Two groups of 8 lanes per step: the upper group also adds the lower
+    // one, then both add the running sums carried over from the last step.
+    const __m256i bias = _mm256_set1_epi16((short)offset);
+    __m256i backRefs = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i d = _mm256_sub_epi16(_mm256_loadu_si256((const __m256i*)(values + i)), bias);
+        d = _mm256_add_epi16(d, _mm256_permute2x128_si256(d, d, 0x08));
+        d = _mm256_add_epi16(d, backRefs);
+        _mm256_storeu_si256((__m256i*)(values + i), d);
+        backRefs = _mm256_permute2x128_si256(d, d, 0x11);
+    }
+    if (i + 8 <= count)
+    {
+        __m128i d = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(values + i)), _mm256_castsi256_si128(bias));
+        _mm_storeu_si128((__m128i*)(values + i), _mm_add_epi16(d, _mm256_castsi256_si128(backRefs)));
+    }
+}
+#endif
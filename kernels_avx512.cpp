@@ -0,0 +1,114 @@
+#include "kernels.hpp"
+
+#if GEOMPARSE_X86
+#include <immintrin.h>
+
+// AVX-512 F/BW/VL. Back-ref decoding stays on the AVX2 kernel, see
+// KERNEL_TABLES in kernels.cpp.
+
+void avx512SwapFloats(const uint8_t* src, float* dst, size_t count)
+{
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)(src + i * 4));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_shuffle_epi8(v, swap));
+    }
+    scalarSwapFloats(src + i * 4, dst + i, count - i);
+}
+
+void avx512HalfToFloat(const uint8_t* src, float* dst, size_t count)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                          1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i h = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i * 2)), swap);
+        _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(h));
+    }
+    scalarHalfToFloat(src + i * 2, dst + i, count - i);
+}
+
+// Sign-extended components of 4 consecutive 6-byte normals (24 bytes),
+// same layout trick as kernels_sse.cpp.
+static void loadNormals4(const uint8_t* p, __m128i& x, __m128i& y, __m128i& z)
+{
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+    x = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 6, -1, -1, -1, 12, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10)));
+    y = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 1, -1, -1, -1, 7, -1, -1, -1, 13, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11)));
+    z = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 2, -1, -1, -1, 8, -1, -1, -1, 14, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12)));
+    x = _mm_srai_epi32(x, 24);
+    y = _mm_srai_epi32(y, 24);
+    z = _mm_srai_epi32(z, 24);
+}
+
+static __m512 combine(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    __m512i v = _mm512_castsi128_si512(a);
+    v = _mm512_inserti32x4(v, b, 1);
+    v = _mm512_inserti32x4(v, c, 2);
+    v = _mm512_inserti32x4(v, d, 3);
+    return _mm512_cvtepi32_ps(v);
+}
+
+void avx512DecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z)
+{
+    const __m512 scale = _mm512_set1_ps(1.0f / 127.0f);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 zero = _mm512_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i ix[4], iy[4], iz[4];
+        for (uint32_t g = 0; g < 4; ++g)
+            loadNormals4(src + (i + g * 4) * 6, ix[g], iy[g], iz[g]);
+        __m512 nx = _mm512_sub_ps(_mm512_mul_ps(combine(ix[0], ix[1], ix[2], ix[3]), scale), half);
+        __m512 ny = _mm512_sub_ps(_mm512_mul_ps(combine(iy[0], iy[1], iy[2], iy[3]), scale), half);
+        __m512 nz = _mm512_sub_ps(_mm512_mul_ps(combine(iz[0], iz[1], iz[2], iz[3]), scale), half);
+        __m512 length = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, nx), _mm512_mul_ps(ny, ny)), _mm512_mul_ps(nz, nz)));
+        __mmask16 mask = _mm512_cmp_ps_mask(length, zero, _CMP_GT_OQ);
+        _mm512_storeu_ps(x + i, _mm512_mask_div_ps(nx, mask, nx, length));
+        _mm512_storeu_ps(y + i, _mm512_mask_div_ps(ny, mask, ny, length));
+        _mm512_storeu_ps(z + i, _mm512_mask_div_ps(nz, mask, nz, length));
+    }
+    scalarDecodeNormals(src + i * 6, count - i, x + i, y + i, z + i);
+}
+
+void avx512UnpackBits(const uint8_t* src, uint32_t bits, size_t count, uint16_t* dst)
+{
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+    const __m512i seven = _mm512_set1_epi32(7);
+    const __m512i step = _mm512_set1_epi32((int)(bits * 16));
+    const __m128i downShift = _mm_cvtsi32_si128((int)(32 - bits));
+    __m512i offsets = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32((int)bits));
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m512i word = _mm512_i32gather_epi32(_mm512_srli_epi32(offsets, 3), (const void*)src, 1);
+        word = _mm512_shuffle_epi8(word, swap);
+        word = _mm512_sllv_epi32(word, _mm512_and_si512(offsets, seven));
+        word = _mm512_srl_epi32(word, downShift);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm512_cvtepi32_epi16(word));
+        offsets = _mm512_add_epi32(offsets, step);
+    }
+
+    // Masked gather for the remainder instead of a scalar loop.
+    if (i < count)
+    {
+        __mmask16 mask = (__mmask16)((1u << (count - i)) - 1);
+        __m512i word = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, _mm512_srli_epi32(offsets, 3), (const void*)src, 1);
+        word = _mm512_shuffle_epi8(word, swap);
+        word = _mm512_sllv_epi32(word, _mm512_and_si512(offsets, seven));
+        word = _mm512_srl_epi32(word, downShift);
+        _mm256_mask_storeu_epi16((void*)(dst + i), mask, _mm512_cvtepi32_epi16(word));
+    }
+}
+#endif
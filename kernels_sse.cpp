@@ -0,0 +1,109 @@
+#include "kernels.hpp"
+
+#if GEOMPARSE_X86
+#include <immintrin.h>
+
+// SSE2 + SSSE3. Bit unpacking has no variable shifts or gathers at this
+// level and is bound to wordUnpackBits instead.
+
+void sseSwapFloats(const uint8_t* src, float* dst, size_t count)
+{
+    const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, swap));
+    }
+    scalarSwapFloats(src + i * 4, dst + i, count - i);
+}
+
+void sseHalfToFloat(const uint8_t* src, float* dst, size_t count)
+{
+    // Big-endian halves into the low 16 bits of each dword.
+    const __m128i swap = _mm_setr_epi8(1, 0, -1, -1, 3, 2, -1, -1, 5, 4, -1, -1, 7, 6, -1, -1);
+    const __m128i absMask = _mm_set1_epi32(0x7FFF);
+    const __m128i expMask = _mm_set1_epi32(0x0F800000);
+    const __m128i rebias = _mm_set1_epi32((127 - 15) << 23);
+    const __m128i infRebias = _mm_set1_epi32((128 - 16) << 23);
+    const __m128i denormBias = _mm_set1_epi32(1 << 23);
+    const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i h = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)(src + i * 2)), swap);
+        __m128i sign = _mm_slli_epi32(_mm_srli_epi32(h, 15), 31);
+        __m128i bits = _mm_slli_epi32(_mm_and_si128(h, absMask), 13);
+        __m128i exponent = _mm_and_si128(bits, expMask);
+        bits = _mm_add_epi32(bits, rebias);
+
+        __m128i infNan = _mm_cmpeq_epi32(exponent, expMask);
+        bits = _mm_add_epi32(bits, _mm_and_si128(infNan, infRebias));
+
+        __m128i denorm = _mm_cmpeq_epi32(exponent, zero);
+        __m128i renorm = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(bits, denormBias)), magic));
+        bits = _mm_or_si128(_mm_and_si128(denorm, renorm), _mm_andnot_si128(denorm, bits));
+
+        _mm_storeu_ps(dst + i, _mm_castsi128_ps(_mm_or_si128(bits, sign)));
+    }
+    scalarHalfToFloat(src + i * 2, dst + i, count - i);
+}
+
+// Sign-extended components of 4 consecutive 6-byte normals (24 bytes).
+static void loadNormals4(const uint8_t* p, __m128i& x, __m128i& y, __m128i& z)
+{
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i b = _mm_loadu_si128((const __m128i*)(p + 8));
+    // Component c of vertex v is byte 6v+c; vertex 3 comes from b.
+    x = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 6, -1, -1, -1, 12, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10)));
+    y = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 1, -1, -1, -1, 7, -1, -1, -1, 13, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 11)));
+    z = _mm_or_si128(_mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, 2, -1, -1, -1, 8, -1, -1, -1, 14, -1, -1, -1, -1)),
+                     _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12)));
+    x = _mm_srai_epi32(x, 24);
+    y = _mm_srai_epi32(y, 24);
+    z = _mm_srai_epi32(z, 24);
+}
+
+void sseDecodeNormals(const uint8_t* src, size_t count, float* x, float* y, float* z)
+{
+    const __m128 scale = _mm_set1_ps(1.0f / 127.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i ix, iy, iz;
+        loadNormals4(src + i * 6, ix, iy, iz);
+        __m128 nx = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(ix), scale), half);
+        __m128 ny = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(iy), scale), half);
+        __m128 nz = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(iz), scale), half);
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+        __m128 mask = _mm_cmpgt_ps(length, zero);
+        nx = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(nx, length)), _mm_andnot_ps(mask, nx));
+        ny = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(ny, length)), _mm_andnot_ps(mask, ny));
+        nz = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(nz, length)), _mm_andnot_ps(mask, nz));
+        _mm_storeu_ps(x + i, nx);
+        _mm_storeu_ps(y + i, ny);
+        _mm_storeu_ps(z + i, nz);
+    }
+    scalarDecodeNormals(src + i * 6, count - i, x + i, y + i, z + i);
+}
+
+void sseDecodeBackRefs(uint16_t* values, size_t count, uint16_t offset)
+{
+    // One 128-bit vector is exactly the 8 lanes.
+    const __m128i bias = _mm_set1_epi16((short)offset);
+    __m128i backRefs = _mm_setzero_si128();
+    for (size_t i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        backRefs = _mm_add_epi16(backRefs, _mm_sub_epi16(v, bias));
+        _mm_storeu_si128((__m128i*)(values + i), backRefs);
+    }
+}
+#endif
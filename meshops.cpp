@@ -0,0 +1,1057 @@
+#include "meshops.hpp"
+#include "geom.hpp"
+
+#include <cfloat>
+#include <cmath>
+
+static const float WELD_CELL = MeshVertex::EPSILON * 2;
+static const uint32_t NO_VERTEX = 0xFFFFFFFF;
+
+// Cell of one coordinate, and the neighbour a point within EPSILON of it
+// could be in. Anything too large to index lands in cell 0, where it is
+// still compared like the rest.
+static void weldCells(float value, int64_t cells[2])
+{
+    if (!(std::fabs(value) < 1e12f))
+    {
+        cells[0] = cells[1] = 0;
+        return;
+    }
+    double scaled = value / (double)WELD_CELL;
+    double cell = std::floor(scaled);
+    cells[0] = (int64_t)cell;
+    cells[1] = scaled - cell < 0.5 ? cells[0] - 1 : cells[0] + 1;
+}
+
+static uint32_t weldBucket(int64_t x, int64_t y, int64_t z, uint32_t mask)
+{
+    uint64_t hash = (uint64_t)x * 0x9E3779B97F4A7C15ull ^ (uint64_t)y * 0xC2B2AE3D27D4EB4Full ^ (uint64_t)z * 0x165667B19E3779F9ull;
+    return (uint32_t)(hash >> 32) & mask;
+}
+
+static bool weldable(const MeshVertex& a, const MeshVertex& b)
+{
+    return std::fabs(a.vx - b.vx) < MeshVertex::EPSILON && std::fabs(a.vy - b.vy) < MeshVertex::EPSILON &&
+        std::fabs(a.vz - b.vz) < MeshVertex::EPSILON && a.tx == b.tx && a.ty == b.ty && a.nx == b.nx && a.ny == b.ny && a.nz == b.nz;
+}
+
+WeldStats weldMesh(GeomMeshHeader& h)
+{
+    WeldStats stats;
+    uint32_t numVertices = std::min<uint32_t>(h.num_vertices, (uint32_t)h.meshBlock1.size());
+    std::vector<MeshTriangle>& tris = h.outputTriangles();
+    stats.vertices = numVertices;
+    stats.triangles = (uint32_t)tris.size();
+
+    uint32_t numBuckets = 16;
+    while (numBuckets < numVertices * 2)
+        numBuckets *= 2;
+    std::vector<uint32_t> buckets(numBuckets, NO_VERTEX);
+    std::vector<uint32_t> next(numVertices, NO_VERTEX);
+    std::vector<uint32_t> remap(numVertices);
+
+    // Unique vertices are compacted to the front as they are found, so the
+    // chains only ever hold kept vertices.
+    uint32_t kept = 0;
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        const MeshVertex& vertex = h.meshBlock1[v];
+        int64_t x[2], y[2], z[2];
+        weldCells(vertex.vx, x);
+        weldCells(vertex.vy, y);
+        weldCells(vertex.vz, z);
+
+        uint32_t match = NO_VERTEX;
+        for (uint32_t n = 0; n < 8 && match == NO_VERTEX; ++n)
+        {
+            uint32_t bucket = weldBucket(x[n & 1], y[(n >> 1) & 1], z[n >> 2], numBuckets - 1);
+            for (uint32_t u = buckets[bucket]; u != NO_VERTEX; u = next[u])
+            {
+                if (weldable(h.meshBlock1[u], vertex))
+                {
+                    match = u;
+                    break;
+                }
+            }
+        }
+
+        if (match != NO_VERTEX)
+        {
+            remap[v] = match;
+            ++stats.welded;
+            continue;
+        }
+
+        if (kept != v)
+            h.meshBlock1[kept] = std::move(h.meshBlock1[v]);
+        MeshVertex& unique = h.meshBlock1[kept];
+        unique.id_ = kept;
+        unique.duplicates.clear();
+        uint32_t bucket = weldBucket(x[0], y[0], z[0], numBuckets - 1);
+        next[kept] = buckets[bucket];
+        buckets[bucket] = kept;
+        remap[v] = kept++;
+    }
+
+    h.normals.clear();
+    for (uint32_t v = 0; v < kept; ++v)
+        h.normals.push_back(vec3(h.meshBlock1[v].nx, h.meshBlock1[v].ny, h.meshBlock1[v].nz));
+    // A trailing partial vertex past num_vertices is kept, right after the
+    // welded ones, as parseBlock1 keeps it.
+    uint32_t end = kept;
+    for (uint32_t v = numVertices; v < (uint32_t)h.meshBlock1.size(); ++v, ++end)
+    {
+        if (end != v)
+            h.meshBlock1[end] = std::move(h.meshBlock1[v]);
+        h.meshBlock1[end].id_ = end;
+        h.meshBlock1[end].duplicates.clear();
+    }
+    h.meshBlock1.erase(h.meshBlock1.begin() + end, h.meshBlock1.end());
+    h.num_vertices = kept;
+
+    size_t out = 0;
+    for (const MeshTriangle& tri : tris)
+    {
+        if (tri.t_ >= numVertices || tri.tt_ >= numVertices || tri.ttt_ >= numVertices)
+            continue;
+        uint32_t a = remap[tri.t_], b = remap[tri.tt_], c = remap[tri.ttt_];
+        if (a == b || b == c || a == c)
+            continue;
+        tris[out++] = MeshTriangle(a, b, c);
+    }
+    stats.dropped = stats.triangles - out;
+    tris.erase(tris.begin() + out, tris.end());
+    return stats;
+}
+
+CacheStats simulateVertexCache(const std::vector<MeshTriangle>& tris, uint32_t numVertices)
+{
+    CacheStats stats;
+    // A vertex is cached while fewer than VERTEX_CACHE_SIZE misses came after
+    // its own.
+    std::vector<uint64_t> missedAt(numVertices, 0);
+    std::vector<bool> used(numVertices, false);
+    uint64_t time = VERTEX_CACHE_SIZE + 1;
+    for (const MeshTriangle& tri : tris)
+    {
+        uint32_t corners[3] = { tri.t_, tri.tt_, tri.ttt_ };
+        if (corners[0] >= numVertices || corners[1] >= numVertices || corners[2] >= numVertices)
+            continue;
+        ++stats.triangles;
+        for (uint32_t v : corners)
+        {
+            if (!used[v])
+            {
+                used[v] = true;
+                ++stats.vertices;
+            }
+            if (time - missedAt[v] > VERTEX_CACHE_SIZE)
+            {
+                missedAt[v] = time++;
+                ++stats.misses;
+            }
+        }
+    }
+    return stats;
+}
+
+// The fanning vertex after a dead end: the most recent vertex on the stack
+// that still has triangles, or else the next one in index order.
+static uint32_t skipDeadEnd(const std::vector<uint32_t>& live, std::vector<uint32_t>& deadEnd, uint32_t& cursor)
+{
+    while (!deadEnd.empty())
+    {
+        uint32_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (live[v] > 0)
+            return v;
+    }
+    for (; cursor < live.size(); ++cursor)
+    {
+        if (live[cursor] > 0)
+            return cursor;
+    }
+    return NO_VERTEX;
+}
+
+// Triangle order, as indices into tris, for a FIFO cache of cacheSize.
+static std::vector<uint32_t> tipsify(const std::vector<MeshTriangle>& tris, uint32_t numVertices, uint32_t cacheSize)
+{
+    uint32_t numTriangles = (uint32_t)tris.size();
+    std::vector<uint32_t> live(numVertices, 0);
+    for (const MeshTriangle& tri : tris)
+    {
+        ++live[tri.t_];
+        ++live[tri.tt_];
+        ++live[tri.ttt_];
+    }
+    std::vector<uint32_t> first(numVertices + 1, 0);
+    for (uint32_t v = 0; v < numVertices; ++v)
+        first[v + 1] = first[v] + live[v];
+    std::vector<uint32_t> adjacency(first[numVertices]);
+    std::vector<uint32_t> filled(first.begin(), first.end() - 1);
+    for (uint32_t t = 0; t < numTriangles; ++t)
+    {
+        adjacency[filled[tris[t].t_]++] = t;
+        adjacency[filled[tris[t].tt_]++] = t;
+        adjacency[filled[tris[t].ttt_]++] = t;
+    }
+
+    std::vector<uint64_t> cachedAt(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> order;
+    order.reserve(numTriangles);
+    uint64_t time = cacheSize + 1;
+    uint32_t cursor = 0;
+    uint32_t fan = skipDeadEnd(live, deadEnd, cursor);
+    while (fan != NO_VERTEX)
+    {
+        candidates.clear();
+        for (uint32_t a = first[fan]; a < first[fan + 1]; ++a)
+        {
+            uint32_t t = adjacency[a];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+            order.push_back(t);
+            uint32_t corners[3] = { tris[t].t_, tris[t].tt_, tris[t].ttt_ };
+            for (uint32_t v : corners)
+            {
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (time - cachedAt[v] > cacheSize)
+                    cachedAt[v] = time++;
+            }
+        }
+
+        // The candidate that stays in the cache while its remaining
+        // triangles are emitted, the oldest such one first.
+        uint32_t next = NO_VERTEX;
+        uint64_t best = 0;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+                continue;
+            uint64_t priority = 0;
+            if (time - cachedAt[v] + 2 * live[v] <= cacheSize)
+                priority = time - cachedAt[v];
+            if (next == NO_VERTEX || priority > best)
+            {
+                next = v;
+                best = priority;
+            }
+        }
+        fan = next != NO_VERTEX ? next : skipDeadEnd(live, deadEnd, cursor);
+    }
+    return order;
+}
+
+// Tipsify can lose to an order that is already good, such as EDGE's own
+// strips over random topology; that order is kept then. Every index has to
+// be below numVertices.
+static void optimizeTriangleOrder(std::vector<MeshTriangle>& tris, uint32_t numVertices)
+{
+    std::vector<MeshTriangle> ordered;
+    ordered.reserve(tris.size());
+    for (uint32_t t : tipsify(tris, numVertices, VERTEX_CACHE_SIZE))
+        ordered.push_back(tris[t]);
+    if (simulateVertexCache(ordered, numVertices).misses < simulateVertexCache(tris, numVertices).misses)
+        tris.swap(ordered);
+}
+
+OptimizeStats optimizeMesh(GeomMeshHeader& h)
+{
+    OptimizeStats stats;
+    uint32_t numVertices = std::min<uint32_t>(h.num_vertices, (uint32_t)h.meshBlock1.size());
+    std::vector<MeshTriangle>& tris = h.outputTriangles();
+    stats.before = simulateVertexCache(tris, numVertices);
+
+    // Triangles pointing past the vertices can't be renumbered.
+    std::vector<MeshTriangle> valid;
+    valid.reserve(tris.size());
+    for (const MeshTriangle& tri : tris)
+    {
+        if (tri.t_ < numVertices && tri.tt_ < numVertices && tri.ttt_ < numVertices)
+            valid.push_back(tri);
+    }
+    stats.dropped = tris.size() - valid.size();
+
+    optimizeTriangleOrder(valid, numVertices);
+
+    std::vector<uint32_t> remap(numVertices, NO_VERTEX);
+    uint32_t numUsed = 0;
+    tris.clear();
+    for (const MeshTriangle& tri : valid)
+    {
+        uint32_t corners[3] = { tri.t_, tri.tt_, tri.ttt_ };
+        for (uint32_t& v : corners)
+        {
+            if (remap[v] == NO_VERTEX)
+                remap[v] = numUsed++;
+            v = remap[v];
+        }
+        tris.push_back(MeshTriangle(corners[0], corners[1], corners[2]));
+    }
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        if (remap[v] == NO_VERTEX)
+            remap[v] = numUsed++;
+    }
+
+    // A trailing partial vertex past num_vertices stays where it is.
+    std::vector<MeshVertex> vertices(h.meshBlock1);
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        MeshVertex& vertex = vertices[remap[v]];
+        vertex = std::move(h.meshBlock1[v]);
+        vertex.id_ = remap[v];
+        for (uint32_t& dup : vertex.duplicates)
+        {
+            if (dup < numVertices)
+                dup = remap[dup];
+        }
+    }
+    h.meshBlock1.swap(vertices);
+    for (uint32_t v = 0; v < numVertices && v < h.normals.size(); ++v)
+        h.normals[v] = vec3(h.meshBlock1[v].nx, h.meshBlock1[v].ny, h.meshBlock1[v].nz);
+
+    stats.after = simulateVertexCache(tris, numVertices);
+    return stats;
+}
+
+struct MeshletPoint
+{
+    float x, y, z;
+
+    float operator[](uint32_t axis) const
+    {
+        return axis == 0 ? x : axis == 1 ? y : z;
+    }
+};
+
+static MeshletPoint sub(const MeshletPoint& a, const MeshletPoint& b)
+{
+    MeshletPoint p = { a.x - b.x, a.y - b.y, a.z - b.z };
+    return p;
+}
+
+static float dot(const MeshletPoint& a, const MeshletPoint& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Ritter's sphere: the farthest apart pair of axis extremes, grown to take
+// in whatever is left outside.
+static void boundMeshlet(const MeshletPoint* points, uint32_t count, Meshlet& meshlet)
+{
+    uint32_t lowest[3] = { 0, 0, 0 };
+    uint32_t highest[3] = { 0, 0, 0 };
+    for (uint32_t v = 1; v < count; ++v)
+    {
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            if (points[v][axis] < points[lowest[axis]][axis])
+                lowest[axis] = v;
+            if (points[v][axis] > points[highest[axis]][axis])
+                highest[axis] = v;
+        }
+    }
+
+    uint32_t widestAxis = 0;
+    float widest = -1.0f;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        MeshletPoint d = sub(points[highest[axis]], points[lowest[axis]]);
+        if (dot(d, d) > widest)
+        {
+            widest = dot(d, d);
+            widestAxis = axis;
+        }
+    }
+
+    const MeshletPoint& a = points[lowest[widestAxis]];
+    const MeshletPoint& b = points[highest[widestAxis]];
+    MeshletPoint center = { (a.x + b.x) * 0.5f, (a.y + b.y) * 0.5f, (a.z + b.z) * 0.5f };
+    float radius = std::sqrt(widest) * 0.5f;
+    for (uint32_t v = 0; v < count; ++v)
+    {
+        MeshletPoint d = sub(points[v], center);
+        float distance = std::sqrt(dot(d, d));
+        if (distance > radius)
+        {
+            float grown = (radius + distance) * 0.5f;
+            float k = (grown - radius) / distance;
+            center.x += d.x * k;
+            center.y += d.y * k;
+            center.z += d.z * k;
+            radius = grown;
+        }
+    }
+
+    meshlet.center[0] = center.x;
+    meshlet.center[1] = center.y;
+    meshlet.center[2] = center.z;
+    meshlet.radius = radius;
+}
+
+// The cone around the meshlet's face normals, with its apex placed so
+// that no face is seen from behind it. Normals spread further than about
+// 84 degrees from the axis get a cutoff of 1, which never culls.
+static void coneMeshlet(const MeshletPoint* points, const uint8_t* triangles, uint32_t count, Meshlet& meshlet)
+{
+    MeshletPoint normals[MESHLET_MAX_TRIANGLES];
+    MeshletPoint corners[MESHLET_MAX_TRIANGLES];
+    uint32_t numNormals = 0;
+    MeshletPoint axis = { 0, 0, 0 };
+    for (uint32_t t = 0; t < count; ++t)
+    {
+        const MeshletPoint& p0 = points[triangles[t * 3]];
+        MeshletPoint e1 = sub(points[triangles[t * 3 + 1]], p0);
+        MeshletPoint e2 = sub(points[triangles[t * 3 + 2]], p0);
+        MeshletPoint n = { e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+        float length = std::sqrt(dot(n, n));
+        if (!(length > 0.0f))
+            continue;
+        n.x /= length;
+        n.y /= length;
+        n.z /= length;
+        normals[numNormals] = n;
+        corners[numNormals++] = p0;
+        axis.x += n.x;
+        axis.y += n.y;
+        axis.z += n.z;
+    }
+
+    MeshletPoint center = { meshlet.center[0], meshlet.center[1], meshlet.center[2] };
+    float length = std::sqrt(dot(axis, axis));
+    float spread = -1.0f;
+    if (length > 0.0f)
+    {
+        axis.x /= length;
+        axis.y /= length;
+        axis.z /= length;
+        spread = 1.0f;
+        for (uint32_t n = 0; n < numNormals; ++n)
+            spread = std::min(spread, dot(axis, normals[n]));
+    }
+
+    meshlet.coneAxis[0] = axis.x;
+    meshlet.coneAxis[1] = axis.y;
+    meshlet.coneAxis[2] = axis.z;
+    meshlet.coneApex[0] = center.x;
+    meshlet.coneApex[1] = center.y;
+    meshlet.coneApex[2] = center.z;
+    if (spread <= 0.1f)
+    {
+        meshlet.coneCutoff = 1.0f;
+        return;
+    }
+    meshlet.coneCutoff = std::sqrt(1.0f - spread * spread);
+
+    float back = 0.0f;
+    for (uint32_t n = 0; n < numNormals; ++n)
+        back = std::max(back, dot(sub(center, corners[n]), normals[n]) / dot(axis, normals[n]));
+    meshlet.coneApex[0] = center.x - axis.x * back;
+    meshlet.coneApex[1] = center.y - axis.y * back;
+    meshlet.coneApex[2] = center.z - axis.z * back;
+}
+
+MeshletStats buildMeshlets(GeomMeshHeader& h)
+{
+    MeshletStats stats;
+    uint32_t numVertices = std::min<uint32_t>(h.num_vertices, (uint32_t)h.meshBlock1.size());
+    const std::vector<MeshTriangle>& tris = h.outputTriangles();
+    h.meshlets.clear();
+    h.meshletVertices.clear();
+    h.meshletTriangles.clear();
+
+    // Meshlet-local index of every mesh vertex in the current meshlet.
+    const uint8_t NOT_IN_MESHLET = 0xFF;
+    std::vector<uint8_t> local(numVertices, NOT_IN_MESHLET);
+    Meshlet meshlet = {};
+
+    auto finish = [&]()
+    {
+        if (meshlet.triangleCount == 0)
+            return;
+        const uint32_t* vertices = h.meshletVertices.data() + meshlet.vertexOffset;
+        MeshletPoint points[MESHLET_MAX_VERTICES];
+        for (uint32_t v = 0; v < meshlet.vertexCount; ++v)
+        {
+            const MeshVertex& vertex = h.meshBlock1[vertices[v]];
+            points[v] = { vertex.vx, vertex.vy, vertex.vz };
+            local[vertices[v]] = NOT_IN_MESHLET;
+        }
+        boundMeshlet(points, meshlet.vertexCount, meshlet);
+        coneMeshlet(points, h.meshletTriangles.data() + meshlet.triangleOffset * 3, meshlet.triangleCount, meshlet);
+        h.meshlets.push_back(meshlet);
+        stats.vertices += meshlet.vertexCount;
+        stats.triangles += meshlet.triangleCount;
+
+        meshlet = Meshlet();
+        meshlet.vertexOffset = (uint32_t)h.meshletVertices.size();
+        meshlet.triangleOffset = (uint32_t)h.meshletTriangles.size() / 3;
+    };
+
+    for (const MeshTriangle& tri : tris)
+    {
+        uint32_t corners[3] = { tri.t_, tri.tt_, tri.ttt_ };
+        if (corners[0] >= numVertices || corners[1] >= numVertices || corners[2] >= numVertices)
+            continue;
+        uint32_t added = (local[corners[0]] == NOT_IN_MESHLET) + (local[corners[1]] == NOT_IN_MESHLET && corners[1] != corners[0]) +
+            (local[corners[2]] == NOT_IN_MESHLET && corners[2] != corners[0] && corners[2] != corners[1]);
+        if (meshlet.vertexCount + added > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+            finish();
+
+        for (uint32_t v : corners)
+        {
+            if (local[v] == NOT_IN_MESHLET)
+            {
+                local[v] = (uint8_t)meshlet.vertexCount++;
+                h.meshletVertices.push_back(v);
+            }
+            h.meshletTriangles.push_back(local[v]);
+        }
+        ++meshlet.triangleCount;
+    }
+    finish();
+
+    stats.meshlets = h.meshlets.size();
+    return stats;
+}
+
+// Symmetric 4x4 error matrix of a set of weighted planes.
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;
+
+    void addPlane(const double n[3], double d, double w)
+    {
+        a00 += w * n[0] * n[0];
+        a01 += w * n[0] * n[1];
+        a02 += w * n[0] * n[2];
+        a11 += w * n[1] * n[1];
+        a12 += w * n[1] * n[2];
+        a22 += w * n[2] * n[2];
+        b0 += w * n[0] * d;
+        b1 += w * n[1] * d;
+        b2 += w * n[2] * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+        a00 += q.a00;
+        a01 += q.a01;
+        a02 += q.a02;
+        a11 += q.a11;
+        a12 += q.a12;
+        a22 += q.a22;
+        b0 += q.b0;
+        b1 += q.b1;
+        b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    // Weighted sum of squared distances of p to the planes.
+    double error(const double p[3]) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) + 2 * (b0 * x + b1 * y + b2 * z) + c;
+        return std::max(e, 0.0);
+    }
+};
+
+static void cross(const double a[3], const double b[3], double out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static double dot3(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Simplifies one mesh level after level. Works on canonical vertices: of
+// the vertices with equal position, UV and normal, the first stands in for
+// all, and of those with equal position the first is the position vertex
+// the topology is built on.
+struct LodBuilder
+{
+    enum Kind : uint8_t
+    {
+        Interior,
+        Border, // on exactly two open edges
+        Locked
+    };
+
+    const GeomMeshHeader& h;
+    uint32_t numVertices;
+    std::vector<uint32_t> wedge;    // vertex -> canonical vertex
+    std::vector<uint32_t> position; // vertex -> position vertex
+    std::vector<bool> split;        // per position vertex: UVs or normals differ
+    std::vector<double> points;     // unit-sized positions, 3 per vertex
+    std::vector<Quadric> quadrics;  // per position vertex
+    std::vector<MeshTriangle> tris; // canonical vertices
+
+    static const double BORDER_WEIGHT;
+    static const double UV_WEIGHT;
+    static const double NORMAL_WEIGHT;
+    static const double MIN_FACE_COS;
+
+    LodBuilder(const GeomMeshHeader& header, uint32_t count)
+        : h(header), numVertices(count)
+    {
+    }
+
+    const double* point(uint32_t v) const
+    {
+        return &points[v * 3];
+    }
+
+    bool samePosition(uint32_t a, uint32_t b) const
+    {
+        const MeshVertex& va = h.meshBlock1[a];
+        const MeshVertex& vb = h.meshBlock1[b];
+        return va.vx == vb.vx && va.vy == vb.vy && va.vz == vb.vz;
+    }
+
+    bool sameWedge(uint32_t a, uint32_t b) const
+    {
+        const MeshVertex& va = h.meshBlock1[a];
+        const MeshVertex& vb = h.meshBlock1[b];
+        return samePosition(a, b) && va.tx == vb.tx && va.ty == vb.ty && va.nx == vb.nx && va.ny == vb.ny && va.nz == vb.nz;
+    }
+
+    // Returns false when face a, b, c has no area; normal is not unit length.
+    bool faceNormal(uint32_t a, uint32_t b, uint32_t c, double normal[3]) const
+    {
+        double e1[3], e2[3];
+        for (uint32_t k = 0; k < 3; ++k)
+        {
+            e1[k] = point(b)[k] - point(a)[k];
+            e2[k] = point(c)[k] - point(a)[k];
+        }
+        cross(e1, e2, normal);
+        return dot3(normal, normal) > 0.0;
+    }
+
+    void init(const std::vector<MeshTriangle>& source)
+    {
+        // Sorting by position and then the rest puts every group of equal
+        // vertices next to each other.
+        std::vector<uint32_t> order(numVertices);
+        for (uint32_t v = 0; v < numVertices; ++v)
+            order[v] = v;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+        {
+            const MeshVertex& va = h.meshBlock1[a];
+            const MeshVertex& vb = h.meshBlock1[b];
+            const float ka[8] = { va.vx, va.vy, va.vz, va.tx, va.ty, va.nx, va.ny, va.nz };
+            const float kb[8] = { vb.vx, vb.vy, vb.vz, vb.tx, vb.ty, vb.nx, vb.ny, vb.nz };
+            int c = memcmp(ka, kb, sizeof(ka));
+            return c != 0 ? c < 0 : a < b;
+        });
+        wedge.assign(numVertices, 0);
+        position.assign(numVertices, 0);
+        split.assign(numVertices, false);
+        for (uint32_t i = 0; i < numVertices; ++i)
+        {
+            uint32_t v = order[i];
+            bool samePos = i > 0 && samePosition(order[i - 1], v);
+            position[v] = samePos ? position[order[i - 1]] : v;
+            wedge[v] = samePos && sameWedge(order[i - 1], v) ? wedge[order[i - 1]] : v;
+            if (samePos && wedge[v] != wedge[order[i - 1]])
+                split[position[v]] = true;
+        }
+
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t v = 0; v < numVertices; ++v)
+        {
+            const float p[3] = { h.meshBlock1[v].vx, h.meshBlock1[v].vy, h.meshBlock1[v].vz };
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                lo[k] = std::min(lo[k], p[k]);
+                hi[k] = std::max(hi[k], p[k]);
+            }
+        }
+        double extent = std::max(std::max(hi[0] - lo[0], hi[1] - lo[1]), hi[2] - lo[2]);
+        double scale = extent > 0.0 && std::isfinite(extent) ? 1.0 / extent : 1.0;
+        points.resize(numVertices * 3);
+        for (uint32_t v = 0; v < numVertices; ++v)
+        {
+            points[v * 3] = (h.meshBlock1[v].vx - lo[0]) * scale;
+            points[v * 3 + 1] = (h.meshBlock1[v].vy - lo[1]) * scale;
+            points[v * 3 + 2] = (h.meshBlock1[v].vz - lo[2]) * scale;
+        }
+
+        for (const MeshTriangle& tri : source)
+        {
+            MeshTriangle t(wedge[tri.t_], wedge[tri.tt_], wedge[tri.ttt_]);
+            if (position[t.t_] != position[t.tt_] && position[t.tt_] != position[t.ttt_] && position[t.t_] != position[t.ttt_])
+                tris.push_back(t);
+        }
+
+        quadrics.assign(numVertices, Quadric());
+        for (const MeshTriangle& tri : tris)
+        {
+            double normal[3];
+            if (!faceNormal(tri.t_, tri.tt_, tri.ttt_, normal))
+                continue;
+            double length = std::sqrt(dot3(normal, normal));
+            for (double& n : normal)
+                n /= length;
+            double area = length * 0.5;
+            double d = -dot3(normal, point(tri.t_));
+            quadrics[position[tri.t_]].addPlane(normal, d, area);
+            quadrics[position[tri.tt_]].addPlane(normal, d, area);
+            quadrics[position[tri.ttt_]].addPlane(normal, d, area);
+        }
+        addBorderPlanes();
+    }
+
+    static uint64_t edgeKey(uint32_t a, uint32_t b)
+    {
+        return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    }
+
+    // Position-space edges of the current triangles, sorted, with repeats.
+    std::vector<uint64_t> edges() const
+    {
+        std::vector<uint64_t> keys;
+        keys.reserve(tris.size() * 3);
+        for (const MeshTriangle& tri : tris)
+        {
+            uint32_t p[3] = { position[tri.t_], position[tri.tt_], position[tri.ttt_] };
+            for (uint32_t k = 0; k < 3; ++k)
+                keys.push_back(edgeKey(p[k], p[(k + 1) % 3]));
+        }
+        std::sort(keys.begin(), keys.end());
+        return keys;
+    }
+
+    static bool isOpen(const std::vector<uint64_t>& keys, uint64_t key)
+    {
+        std::vector<uint64_t>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+        return it != keys.end() && *it == key && (it + 1 == keys.end() || *(it + 1) != key);
+    }
+
+    // Planes through the open edges, at right angles to their face, keep
+    // borders from being pulled inwards.
+    void addBorderPlanes()
+    {
+        std::vector<uint64_t> keys = edges();
+        for (const MeshTriangle& tri : tris)
+        {
+            uint32_t c[3] = { tri.t_, tri.tt_, tri.ttt_ };
+            double normal[3];
+            if (!faceNormal(c[0], c[1], c[2], normal))
+                continue;
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                uint32_t a = c[k], b = c[(k + 1) % 3];
+                if (!isOpen(keys, edgeKey(position[a], position[b])))
+                    continue;
+                double edge[3] = { point(b)[0] - point(a)[0], point(b)[1] - point(a)[1], point(b)[2] - point(a)[2] };
+                double plane[3];
+                cross(edge, normal, plane);
+                double length = std::sqrt(dot3(plane, plane));
+                if (!(length > 0.0))
+                    continue;
+                for (double& n : plane)
+                    n /= length;
+                double d = -dot3(plane, point(a));
+                double w = dot3(edge, edge) * BORDER_WEIGHT;
+                quadrics[position[a]].addPlane(plane, d, w);
+                quadrics[position[b]].addPlane(plane, d, w);
+            }
+        }
+    }
+
+    std::vector<uint8_t> classify(const std::vector<uint64_t>& keys) const
+    {
+        std::vector<uint8_t> kinds(numVertices, Interior);
+        std::vector<uint8_t> openEdges(numVertices, 0);
+        for (size_t i = 0; i < keys.size();)
+        {
+            size_t j = i;
+            while (j < keys.size() && keys[j] == keys[i])
+                ++j;
+            uint32_t a = (uint32_t)(keys[i] >> 32), b = (uint32_t)keys[i];
+            if (j - i > 2)
+            {
+                kinds[a] = kinds[b] = Locked;
+            }
+            else if (j - i == 1)
+            {
+                openEdges[a] = (uint8_t)std::min(openEdges[a] + 1, 3);
+                openEdges[b] = (uint8_t)std::min(openEdges[b] + 1, 3);
+            }
+            i = j;
+        }
+        for (uint32_t v = 0; v < numVertices; ++v)
+        {
+            if (split[v] || (openEdges[v] != 0 && openEdges[v] != 2))
+                kinds[v] = Locked;
+            else if (kinds[v] != Locked && openEdges[v] == 2)
+                kinds[v] = Border;
+        }
+        return kinds;
+    }
+
+    double attributeError(uint32_t from, uint32_t to) const
+    {
+        const MeshVertex& a = h.meshBlock1[from];
+        const MeshVertex& b = h.meshBlock1[to];
+        double uv = (a.tx - b.tx) * (a.tx - b.tx) + (a.ty - b.ty) * (a.ty - b.ty);
+        double normal = (a.nx - b.nx) * (a.nx - b.nx) + (a.ny - b.ny) * (a.ny - b.ny) + (a.nz - b.nz) * (a.nz - b.nz);
+        return quadrics[position[from]].weight * (uv * UV_WEIGHT + normal * NORMAL_WEIGHT);
+    }
+
+    struct Collapse
+    {
+        double cost;
+        uint32_t from; // canonical vertex that goes away
+        uint32_t to;
+    };
+
+    // One batch of collapses, cheapest first. Returns false when nothing
+    // could be collapsed.
+    bool collapseBatch(uint32_t target)
+    {
+        std::vector<uint64_t> keys = edges();
+        std::vector<uint8_t> kinds = classify(keys);
+
+        std::vector<Collapse> best(numVertices, Collapse{ DBL_MAX, NO_VERTEX, NO_VERTEX });
+        for (const MeshTriangle& tri : tris)
+        {
+            uint32_t c[3] = { tri.t_, tri.tt_, tri.ttt_ };
+            for (uint32_t k = 0; k < 6; ++k)
+            {
+                uint32_t from = c[k % 3], to = k < 3 ? c[(k + 1) % 3] : c[(k + 2) % 3];
+                uint32_t v = position[from], u = position[to];
+                if (kinds[v] == Locked || (kinds[v] == Border && !isOpen(keys, edgeKey(v, u))))
+                    continue;
+                double cost = quadrics[v].error(point(to)) + attributeError(from, to);
+                if (cost < best[v].cost)
+                    best[v] = Collapse{ cost, from, to };
+            }
+        }
+
+        std::vector<Collapse> collapses;
+        for (const Collapse& c : best)
+        {
+            if (c.from != NO_VERTEX)
+                collapses.push_back(c);
+        }
+        if (collapses.empty())
+            return false;
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+        {
+            return a.cost != b.cost ? a.cost < b.cost : a.from < b.from;
+        });
+
+        // Around two triangles go per collapse. The batch stops at half
+        // again the cost of the collapse that would get there, so cheaper
+        // collapses opened up by this batch get their turn in the next.
+        size_t goal = std::max<size_t>((tris.size() - target) / 2, 1);
+        double costLimit = goal < collapses.size() ? collapses[goal].cost * 1.5 : DBL_MAX;
+
+        std::vector<uint32_t> first(numVertices + 1, 0);
+        for (const MeshTriangle& tri : tris)
+        {
+            ++first[position[tri.t_] + 1];
+            ++first[position[tri.tt_] + 1];
+            ++first[position[tri.ttt_] + 1];
+        }
+        for (uint32_t v = 0; v < numVertices; ++v)
+            first[v + 1] += first[v];
+        std::vector<uint32_t> around(first[numVertices]);
+        std::vector<uint32_t> filled(first.begin(), first.end() - 1);
+        for (uint32_t t = 0; t < tris.size(); ++t)
+        {
+            around[filled[position[tris[t].t_]]++] = t;
+            around[filled[position[tris[t].tt_]]++] = t;
+            around[filled[position[tris[t].ttt_]]++] = t;
+        }
+
+        // A vertex whose triangles changed this batch is locked, so the face
+        // checks above stay valid; a vertex that went away is no target.
+        std::vector<bool> locked(numVertices, false);
+        std::vector<bool> removed(numVertices, false);
+        std::vector<uint32_t> remap(numVertices);
+        for (uint32_t v = 0; v < numVertices; ++v)
+            remap[v] = v;
+        size_t remaining = tris.size();
+        bool collapsed = false;
+        for (const Collapse& c : collapses)
+        {
+            if (c.cost > costLimit || remaining <= target)
+                break;
+            uint32_t v = position[c.from], u = position[c.to];
+            if (locked[v] || removed[u])
+                continue;
+
+            uint32_t gone = 0;
+            bool flips = false;
+            for (uint32_t a = first[v]; a < first[v + 1] && !flips; ++a)
+            {
+                const MeshTriangle& tri = tris[around[a]];
+                uint32_t corners[3] = { tri.t_, tri.tt_, tri.ttt_ };
+                if (position[corners[0]] == u || position[corners[1]] == u || position[corners[2]] == u)
+                {
+                    ++gone;
+                    continue;
+                }
+                double before[3], after[3];
+                if (!faceNormal(corners[0], corners[1], corners[2], before))
+                    continue;
+                for (uint32_t& corner : corners)
+                {
+                    if (position[corner] == v)
+                        corner = c.to;
+                }
+                flips = !faceNormal(corners[0], corners[1], corners[2], after) ||
+                    dot3(before, after) < MIN_FACE_COS * std::sqrt(dot3(before, before) * dot3(after, after));
+            }
+            if (flips)
+                continue;
+
+            remap[c.from] = c.to;
+            quadrics[u].add(quadrics[v]);
+            removed[v] = true;
+            for (uint32_t a = first[v]; a < first[v + 1]; ++a)
+            {
+                const MeshTriangle& tri = tris[around[a]];
+                locked[position[tri.t_]] = locked[position[tri.tt_]] = locked[position[tri.ttt_]] = true;
+            }
+            remaining -= std::min<size_t>(gone, remaining);
+            collapsed = true;
+        }
+        if (!collapsed)
+            return false;
+
+        size_t out = 0;
+        for (const MeshTriangle& tri : tris)
+        {
+            MeshTriangle t(remap[tri.t_], remap[tri.tt_], remap[tri.ttt_]);
+            if (position[t.t_] != position[t.tt_] && position[t.tt_] != position[t.ttt_] && position[t.t_] != position[t.ttt_])
+                tris[out++] = t;
+        }
+        tris.erase(tris.begin() + out, tris.end());
+        return true;
+    }
+
+    void simplify(uint32_t target)
+    {
+        while (tris.size() > target && collapseBatch(target))
+        {
+        }
+    }
+};
+
+const double LodBuilder::BORDER_WEIGHT = 10.0;
+const double LodBuilder::UV_WEIGHT = 1.0;
+const double LodBuilder::NORMAL_WEIGHT = 0.25;
+const double LodBuilder::MIN_FACE_COS = 0.26; // cos 75 degrees
+
+LodStats buildLods(GeomMeshHeader& h, const std::vector<float>& ratios, bool optimize)
+{
+    LodStats stats;
+    uint32_t numVertices = std::min<uint32_t>(h.num_vertices, (uint32_t)h.meshBlock1.size());
+    const std::vector<MeshTriangle>& tris = h.outputTriangles();
+    h.lods.clear();
+    stats.triangles = tris.size();
+
+    std::vector<MeshTriangle> valid;
+    for (const MeshTriangle& tri : tris)
+    {
+        if (tri.t_ < numVertices && tri.tt_ < numVertices && tri.ttt_ < numVertices)
+            valid.push_back(tri);
+    }
+
+    LodBuilder builder(h, numVertices);
+    builder.init(valid);
+    for (size_t level = 0; level < ratios.size() && level < MAX_LODS; ++level)
+    {
+        builder.simplify((uint32_t)(tris.size() * (double)ratios[level]));
+        h.lods.push_back(builder.tris);
+        if (optimize)
+            optimizeTriangleOrder(h.lods.back(), numVertices);
+        stats.lodTriangles[level] = h.lods.back().size();
+    }
+    return stats;
+}
+
+MeshProcessStats processMeshes(Geom& geom, const MeshOptions& options)
+{
+    MeshProcessStats total;
+    if (!options.any())
+        return total;
+
+    std::vector<MeshProcessStats> stats(geom.meshHeaders.size());
+    parallelFor(geom.meshHeaders.size(), 1, Stage::Count, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            GeomMeshHeader& h = geom.meshHeaders[i];
+            StageScope scope(Stage::Process, (int32_t)i);
+            scope.setItems(h.num_vertices);
+            if (options.weld)
+                stats[i].weld = weldMesh(h);
+            if (options.optimize)
+                stats[i].optimize = optimizeMesh(h);
+            if (!options.lods.empty())
+                stats[i].lods = buildLods(h, options.lods, options.optimize);
+            if (options.meshlets)
+                stats[i].meshlets = buildMeshlets(h);
+        }
+    });
+
+    for (const MeshProcessStats& s : stats)
+        total.add(s);
+    return total;
+}
+
+void printMeshProcessStats(const MeshProcessStats& stats, const MeshOptions& options)
+{
+    if (options.weld)
+    {
+        printf("weld: %llu of %llu vertices merged, %llu of %llu triangles dropped\n", (unsigned long long)stats.weld.welded,
+            (unsigned long long)stats.weld.vertices, (unsigned long long)stats.weld.dropped, (unsigned long long)stats.weld.triangles);
+    }
+    if (options.optimize)
+    {
+        const OptimizeStats& o = stats.optimize;
+        printf("vertex cache (FIFO %u): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", VERTEX_CACHE_SIZE, o.before.acmr(), o.after.acmr(),
+            o.before.atvr(), o.after.atvr());
+        if (o.dropped > 0)
+            printf(", %llu triangles pointing past the vertices dropped", (unsigned long long)o.dropped);
+        printf("\n");
+    }
+    if (!options.lods.empty())
+    {
+        const LodStats& l = stats.lods;
+        printf("lods of %llu triangles:", (unsigned long long)l.triangles);
+        for (size_t i = 0; i < options.lods.size() && i < MAX_LODS; ++i)
+            printf(" %.0f%% -> %.1f%%", options.lods[i] * 100.0, l.triangles > 0 ? l.lodTriangles[i] * 100.0 / l.triangles : 0.0);
+        printf("\n");
+    }
+    if (options.meshlets)
+    {
+        const MeshletStats& m = stats.meshlets;
+        printf("meshlets: %llu, %.1f vertices and %.1f triangles each on average\n", (unsigned long long)m.meshlets,
+            m.meshlets > 0 ? (double)m.vertices / m.meshlets : 0.0, m.meshlets > 0 ? (double)m.triangles / m.meshlets : 0.0);
+    }
+}
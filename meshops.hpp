@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct Geom;
+struct GeomMeshHeader;
+struct MeshTriangle;
+
+// Optional work on the decoded meshes between decoding and writing. Every
+// output (OBJ, export, the decoded callback) sees the processed meshes.
+struct MeshOptions
+{
+    // Merge vertices whose positions are within MeshVertex::EPSILON per
+    // component and whose UVs and normals are equal, then drop the
+    // triangles that collapse. Replaces the duplicate-of comments.
+    bool weld = false;
+    // Reorder the triangles for the post-transform cache, then the
+    // vertices into the order the triangles first use them. Runs after
+    // welding.
+    bool optimize = false;
+    // Split every mesh into meshlets for the binary exports. Runs last, on
+    // the final triangle order.
+    bool meshlets = false;
+    // Simplified levels of every mesh for the binary exports, as fractions
+    // of its triangles in decreasing order, e.g. 0.5, 0.25, 0.1. Up to
+    // MAX_LODS of them; built after optimizing, before the meshlets (which
+    // are for LOD0).
+    std::vector<float> lods;
+
+    bool any() const
+    {
+        return weld || optimize || meshlets || !lods.empty();
+    }
+};
+
+const uint32_t MAX_LODS = 8;
+
+struct WeldStats
+{
+    uint64_t vertices = 0;  // before
+    uint64_t welded = 0;    // merged into an earlier vertex
+    uint64_t triangles = 0; // before
+    uint64_t dropped = 0;   // degenerate or pointing past the vertices
+};
+
+// Expected linear time: vertices are hashed by a grid of cells two epsilons
+// wide, so a match can only be in the vertex's own cell or the nearer
+// neighbour on each axis.
+WeldStats weldMesh(GeomMeshHeader& h);
+
+// The FIFO post-transform cache the optimizer targets and the stats are
+// measured with.
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Misses of a FIFO cache of VERTEX_CACHE_SIZE vertices over a triangle
+// list. ACMR is misses per triangle (0.5 at best for large meshes), ATVR
+// misses per referenced vertex (1 at best).
+struct CacheStats
+{
+    uint64_t triangles = 0;
+    uint64_t vertices = 0;
+    uint64_t misses = 0;
+
+    double acmr() const
+    {
+        return triangles > 0 ? (double)misses / triangles : 0.0;
+    }
+
+    double atvr() const
+    {
+        return vertices > 0 ? (double)misses / vertices : 0.0;
+    }
+
+    void add(const CacheStats& other)
+    {
+        triangles += other.triangles;
+        vertices += other.vertices;
+        misses += other.misses;
+    }
+};
+
+// Triangles with an index of numVertices or more are skipped.
+CacheStats simulateVertexCache(const std::vector<MeshTriangle>& tris, uint32_t numVertices);
+
+struct OptimizeStats
+{
+    CacheStats before;
+    CacheStats after;
+    uint64_t dropped = 0; // pointing past the vertices
+};
+
+// Tipsify (Sander, Nehab and Barczak 2007), linear in the triangle count:
+// fans around the vertex most likely to still be in the cache, falling
+// back to recently used vertices at dead ends. The vertices are then
+// renumbered in order of first use, with unreferenced ones moved to the
+// end, so vertex fetches run forward through memory.
+OptimizeStats optimizeMesh(GeomMeshHeader& h);
+
+struct MeshletStats
+{
+    uint64_t meshlets = 0;
+    uint64_t vertices = 0;  // summed over the meshlets
+    uint64_t triangles = 0;
+};
+
+// Splits the triangles, in their current order, into meshlets of at most
+// MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles: a
+// triangle joins the current meshlet if it still fits, or starts the next
+// one. Triangles in cache order (--optimize) make for fuller, tighter
+// meshlets. Each gets a bounding sphere and a cone around its face
+// normals for backface culling. Triangles pointing past the vertices are
+// left out.
+MeshletStats buildMeshlets(GeomMeshHeader& h);
+
+struct LodStats
+{
+    uint64_t triangles = 0; // of LOD0
+    uint64_t lodTriangles[MAX_LODS] = {};
+};
+
+// Quadric error edge collapses (Garland and Heckbert), each vertex moved
+// onto a neighbour so the levels share LOD0's vertices. Errors are measured
+// in a unit-sized copy of the mesh, plus the UV and normal difference of
+// the two vertices. Vertices where UVs or normals are split (seams,
+// creases) and non-manifold ones never move; open borders only move along
+// themselves. Collapses that would turn a face over by 75 degrees or more
+// are skipped, so a level can stop short of its target. With optimize,
+// every level's triangles are put in cache order too.
+LodStats buildLods(GeomMeshHeader& h, const std::vector<float>& ratios, bool optimize);
+
+// What processMeshes did to one Geom, summed over its meshes.
+struct MeshProcessStats
+{
+    WeldStats weld;
+    OptimizeStats optimize;
+    MeshletStats meshlets;
+    LodStats lods;
+
+    void add(const MeshProcessStats& other)
+    {
+        lods.triangles += other.lods.triangles;
+        for (uint32_t i = 0; i < MAX_LODS; ++i)
+            lods.lodTriangles[i] += other.lods.lodTriangles[i];
+        meshlets.meshlets += other.meshlets.meshlets;
+        meshlets.vertices += other.meshlets.vertices;
+        meshlets.triangles += other.meshlets.triangles;
+        weld.vertices += other.weld.vertices;
+        weld.welded += other.weld.welded;
+        weld.triangles += other.weld.triangles;
+        weld.dropped += other.weld.dropped;
+        optimize.before.add(other.optimize.before);
+        optimize.after.add(other.optimize.after);
+        optimize.dropped += other.optimize.dropped;
+    }
+};
+
+// Runs the enabled steps on every mesh, in parallel.
+MeshProcessStats processMeshes(Geom& geom, const MeshOptions& options);
+
+// One line per enabled step.
+void printMeshProcessStats(const MeshProcessStats& stats, const MeshOptions& options);
@@ -0,0 +1,191 @@
+#include "perfcounters.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+const char* counterName(Counter counter)
+{
+    switch (counter)
+    {
+    case Counter::Cycles: return "cycles";
+    case Counter::Instructions: return "instructions";
+    case Counter::BranchMisses: return "branch-misses";
+    case Counter::L1DMisses: return "L1d-misses";
+    case Counter::LLCMisses: return "LLC-misses";
+    default: return "unknown";
+    }
+}
+
+static std::atomic<bool> g_reportedFailure(false);
+
+#ifdef __linux__
+
+struct ThreadCounters
+{
+    bool tried = false;
+    int leader = -1;
+    int fds[NUM_COUNTERS];
+    int slot[NUM_COUNTERS];
+    uint32_t numOpen = 0;
+    uint32_t mask = 0;
+
+    ~ThreadCounters()
+    {
+        for (uint32_t c = 0; c < NUM_COUNTERS && tried; ++c)
+        {
+            if (fds[c] >= 0)
+                close(fds[c]);
+        }
+    }
+};
+
+static thread_local ThreadCounters t_counters;
+
+static void counterConfig(Counter counter, perf_event_attr& attr)
+{
+    switch (counter)
+    {
+    case Counter::Cycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case Counter::Instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case Counter::BranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case Counter::L1DMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case Counter::LLCMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    default:
+        break;
+    }
+}
+
+bool countersOpen()
+{
+    ThreadCounters& t = t_counters;
+    if (t.tried)
+        return t.numOpen > 0;
+
+    t.tried = true;
+    int firstErrno = 0;
+    for (uint32_t c = 0; c < NUM_COUNTERS; ++c)
+    {
+        t.fds[c] = -1;
+        t.slot[c] = -1;
+
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        counterConfig((Counter)c, attr);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, t.leader, 0);
+        if (fd < 0)
+        {
+            if (firstErrno == 0)
+                firstErrno = errno;
+            continue;
+        }
+
+        if (t.leader < 0)
+            t.leader = fd;
+        t.fds[c] = fd;
+        t.slot[c] = (int)t.numOpen++;
+        t.mask |= 1u << c;
+    }
+
+    if (t.numOpen < NUM_COUNTERS && !g_reportedFailure.exchange(true))
+    {
+        if (t.numOpen == 0)
+            printf("Hardware counters unavailable (%s), continuing without them\n", strerror(firstErrno));
+        else
+            printf("Some hardware counters unavailable (%s), reporting the rest\n", strerror(firstErrno));
+    }
+
+    return t.numOpen > 0;
+}
+
+uint32_t countersAvailable()
+{
+    return t_counters.tried ? t_counters.mask : 0;
+}
+
+bool countersRead(CounterSample& sample)
+{
+    ThreadCounters& t = t_counters;
+    memset(&sample, 0, sizeof(sample));
+    if (t.numOpen == 0)
+        return false;
+
+    uint64_t buf[3 + NUM_COUNTERS];
+    ssize_t size = read(t.leader, buf, sizeof(buf));
+    if (size < (ssize_t)(sizeof(uint64_t) * (3 + t.numOpen)))
+        return false;
+
+    sample.enabled = buf[1];
+    sample.running = buf[2];
+    for (uint32_t c = 0; c < NUM_COUNTERS; ++c)
+    {
+        if (t.slot[c] >= 0)
+            sample.values[c] = buf[3 + t.slot[c]];
+    }
+    return true;
+}
+
+#else
+
+bool countersOpen()
+{
+    if (!g_reportedFailure.exchange(true))
+        printf("Hardware counters are only supported on Linux, continuing without them\n");
+    return false;
+}
+
+uint32_t countersAvailable()
+{
+    return 0;
+}
+
+bool countersRead(CounterSample& sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    return false;
+}
+
+#endif
+
+void countersDelta(const CounterSample& begin, const CounterSample& end, uint64_t out[NUM_COUNTERS])
+{
+    uint64_t enabled = end.enabled - begin.enabled;
+    uint64_t running = end.running - begin.running;
+    for (uint32_t c = 0; c < NUM_COUNTERS; ++c)
+    {
+        uint64_t delta = end.values[c] - begin.values[c];
+        if (running > 0 && running < enabled)
+            delta = (uint64_t)((double)delta * enabled / running);
+        out[c] = delta;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+
+// Hardware counters sampled around each stage scope with --counters.
+// Only implemented on Linux (perf_event_open); elsewhere, or when the
+// kernel refuses (perf_event_paranoid, containers, VMs without a PMU),
+// countersOpen() returns false and the profile omits the counter table.
+enum class Counter : uint8_t
+{
+    Cycles,
+    Instructions,
+    BranchMisses,
+    L1DMisses,
+    LLCMisses,
+    Count
+};
+
+static const uint32_t NUM_COUNTERS = (uint32_t)Counter::Count;
+
+const char* counterName(Counter counter);
+
+struct CounterSample
+{
+    uint64_t values[NUM_COUNTERS];
+    uint64_t enabled;
+    uint64_t running;
+};
+
+// Opens the counter group for the calling thread on first use. Returns
+// false when no counter could be opened.
+bool countersOpen();
+
+// Bitmask of the counters that could be opened on the calling thread.
+uint32_t countersAvailable();
+
+bool countersRead(CounterSample& sample);
+
+// Difference between two samples, scaled up when the kernel had to
+// multiplex the group and it only ran for part of the interval.
+void countersDelta(const CounterSample& begin, const CounterSample& end, uint64_t out[NUM_COUNTERS]);
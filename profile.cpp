@@ -0,0 +1,509 @@
+#include "profile.hpp"
+#include "perfcounters.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#define usableSize(p) _msize(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define usableSize(p) malloc_size(p)
+#else
+#include <malloc.h>
+#define usableSize(p) malloc_usable_size(p)
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+bool g_profileActive = false;
+bool g_allocTracking = false;
+
+static bool g_traceEnabled = false;
+static bool g_summaryEnabled = false;
+static bool g_countersEnabled = false;
+static std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+static std::vector<std::string> g_files;
+
+const char* stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::Read: return "read";
+    case Stage::Header: return "header parse";
+    case Stage::Vertex: return "vertex decode";
+    case Stage::Index: return "index decode";
+    case Stage::Process: return "mesh process";
+    case Stage::Write: return "write";
+    default: return "unknown";
+    }
+}
+
+const char* stageItemName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::Read: return "byte";
+    case Stage::Header: return "mesh";
+    case Stage::Vertex: return "vertex";
+    case Stage::Index: return "triangle";
+    case Stage::Process: return "vertex";
+    case Stage::Write: return "vertex";
+    default: return "item";
+    }
+}
+
+uint64_t profileNow()
+{
+    auto d = std::chrono::steady_clock::now() - g_epoch;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+// Allocation counters live in plain thread_locals because operator new
+// can't touch anything that allocates itself. They are folded into the
+// thread's ThreadProfile when the stage scope ends.
+static const uint8_t NO_STAGE = 0xFF;
+static thread_local uint8_t t_allocStage = NO_STAGE;
+static thread_local int64_t t_liveBytes = 0;
+static thread_local int64_t t_stageBase = 0;
+static thread_local int64_t t_stagePeak = 0;
+static thread_local uint64_t t_stageAllocs = 0;
+static thread_local uint64_t t_stageBytes = 0;
+static thread_local CounterSample t_stageCounters;
+
+static void trackAlloc(void* p)
+{
+    int64_t size = (int64_t)usableSize(p);
+    t_liveBytes += size;
+    if (t_allocStage != NO_STAGE)
+    {
+        t_stageAllocs++;
+        t_stageBytes += size;
+        if (t_liveBytes - t_stageBase > t_stagePeak)
+            t_stagePeak = t_liveBytes - t_stageBase;
+    }
+}
+
+static void trackFree(void* p)
+{
+    t_liveBytes -= (int64_t)usableSize(p);
+}
+
+static void* allocate(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    if (g_allocTracking)
+        trackAlloc(p);
+    return p;
+}
+
+static void release(void* p)
+{
+    if (p == nullptr)
+        return;
+    if (g_allocTracking)
+        trackFree(p);
+    free(p);
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); }
+    catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    try { return allocate(size); }
+    catch (...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+
+struct AllocStats
+{
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t peak = 0;
+};
+
+struct TraceEvent
+{
+    uint64_t begin;
+    uint64_t end;
+    int32_t file;
+    int32_t mesh;
+    uint8_t stage; // NUM_STAGES marks a whole-file span
+    uint32_t allocs;
+    uint64_t allocBytes;
+};
+
+struct TraceChunk
+{
+    static const uint32_t SIZE = 4096;
+    TraceEvent events[SIZE];
+    uint32_t count = 0;
+};
+
+// Every thread appends only to its own ThreadProfile, so recording never
+// takes a lock. The registry mutex is only taken once per thread and again
+// when the results are written after the workers have been joined.
+struct ThreadProfile
+{
+    uint32_t tid = 0;
+    std::string name;
+    int32_t currentFile = -1;
+    std::vector<TraceChunk*> chunks;
+    uint64_t stageCalls[NUM_STAGES] = {};
+    uint64_t stageNs[NUM_STAGES] = {};
+    AllocStats stageAllocs[NUM_STAGES];
+    uint64_t stageItems[NUM_STAGES] = {};
+    uint64_t stageCounters[NUM_STAGES][NUM_COUNTERS] = {};
+    uint32_t countersMask = 0;
+
+    void push(const TraceEvent& e)
+    {
+        if (chunks.empty() || chunks.back()->count == TraceChunk::SIZE)
+            chunks.push_back(new TraceChunk());
+        TraceChunk* c = chunks.back();
+        c->events[c->count++] = e;
+    }
+};
+
+static std::mutex g_threadsMutex;
+static std::vector<ThreadProfile*> g_threads;
+static thread_local ThreadProfile* t_profile = nullptr;
+
+static ThreadProfile* threadProfile()
+{
+    if (t_profile == nullptr)
+    {
+        ThreadProfile* p = new ThreadProfile();
+        std::lock_guard<std::mutex> lock(g_threadsMutex);
+        p->tid = (uint32_t)g_threads.size();
+        p->name = p->tid == 0 ? "main" : "thread " + std::to_string(p->tid);
+        g_threads.push_back(p);
+        t_profile = p;
+    }
+    return t_profile;
+}
+
+void profileEnable(bool trace, bool summary, bool allocs, bool counters)
+{
+    g_traceEnabled = trace;
+    g_summaryEnabled = summary || allocs || counters;
+    g_profileActive = g_traceEnabled || g_summaryEnabled;
+    g_allocTracking = allocs;
+    g_countersEnabled = counters && countersOpen();
+    threadProfile();
+}
+
+void profileSetFiles(const std::vector<std::string>& files)
+{
+    g_files = files;
+}
+
+void profileSetThreadName(const std::string& name)
+{
+    if (g_profileActive)
+        threadProfile()->name = name;
+}
+
+void profileBeginFile(int32_t file)
+{
+    threadProfile()->currentFile = file;
+}
+
+void profileEndFile(int32_t file, uint64_t begin, uint64_t end)
+{
+    ThreadProfile* p = threadProfile();
+    p->currentFile = -1;
+    if (g_traceEnabled)
+        p->push({ begin, end, file, -1, (uint8_t)NUM_STAGES, 0, 0 });
+}
+
+int32_t profileCurrentFile()
+{
+    return t_profile ? t_profile->currentFile : -1;
+}
+
+void profileBeginStage(Stage stage)
+{
+    threadProfile();
+    t_allocStage = (uint8_t)stage;
+    t_stageBase = t_liveBytes;
+    t_stagePeak = 0;
+    t_stageAllocs = 0;
+    t_stageBytes = 0;
+    if (g_countersEnabled && countersOpen())
+        countersRead(t_stageCounters);
+}
+
+void profileRecordStage(Stage stage, int32_t mesh, uint64_t items, uint64_t begin, uint64_t end)
+{
+    CounterSample counters;
+    bool haveCounters = g_countersEnabled && countersRead(counters);
+
+    uint32_t allocs = (uint32_t)t_stageAllocs;
+    uint64_t allocBytes = t_stageBytes;
+    t_allocStage = NO_STAGE;
+
+    ThreadProfile* p = threadProfile();
+    uint32_t s = (uint32_t)stage;
+    p->stageCalls[s]++;
+    p->stageNs[s] += end - begin;
+    p->stageItems[s] += items;
+    if (haveCounters)
+    {
+        uint64_t delta[NUM_COUNTERS];
+        countersDelta(t_stageCounters, counters, delta);
+        for (uint32_t c = 0; c < NUM_COUNTERS; ++c)
+            p->stageCounters[s][c] += delta[c];
+        p->countersMask |= countersAvailable();
+    }
+    AllocStats& a = p->stageAllocs[s];
+    a.count += allocs;
+    a.bytes += allocBytes;
+    if ((uint64_t)t_stagePeak > a.peak)
+        a.peak = (uint64_t)t_stagePeak;
+    if (g_traceEnabled)
+        p->push({ begin, end, p->currentFile, mesh, (uint8_t)stage, allocs, allocBytes });
+}
+
+static void writeJsonString(FILE* fp, const std::string& str)
+{
+    fputc('"', fp);
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            fputc('\\', fp);
+        if ((unsigned char)c < 0x20)
+        {
+            fprintf(fp, "\\u%04x", c);
+            continue;
+        }
+        fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+bool profileWriteTrace(const std::string& filename)
+{
+    if (!g_traceEnabled)
+        return false;
+
+    FILE* fp = fopen(filename.c_str(), "w+");
+    if (fp == nullptr)
+    {
+        printf("Could not open trace file %s\n", filename.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(g_threadsMutex);
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"geomparse\"}}");
+    for (ThreadProfile* p : g_threads)
+    {
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", p->tid);
+        writeJsonString(fp, p->name);
+        fprintf(fp, "}}");
+        fprintf(fp, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", p->tid, p->tid);
+
+        for (TraceChunk* c : p->chunks)
+        {
+            for (uint32_t i = 0; i < c->count; ++i)
+            {
+                const TraceEvent& e = c->events[i];
+                bool isFile = e.stage == NUM_STAGES;
+                std::string file = (e.file >= 0 && (size_t)e.file < g_files.size()) ? g_files[e.file] : "";
+
+                fprintf(fp, ",\n{\"name\":");
+                if (isFile)
+                {
+                    size_t lastslash = file.find_last_of("/\\");
+                    writeJsonString(fp, lastslash != std::string::npos ? file.substr(lastslash + 1) : file);
+                }
+                else
+                {
+                    writeJsonString(fp, stageName((Stage)e.stage));
+                }
+                fprintf(fp, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+                    isFile ? "file" : "stage", p->tid, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+                fprintf(fp, "\"file\":");
+                writeJsonString(fp, file);
+                if (e.mesh >= 0)
+                    fprintf(fp, ",\"mesh\":%d", e.mesh);
+                if (g_allocTracking && !isFile)
+                    fprintf(fp, ",\"allocs\":%u,\"alloc_bytes\":%llu", e.allocs, (unsigned long long)e.allocBytes);
+                fprintf(fp, "}}");
+            }
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return true;
+}
+
+void profilePrintSummary()
+{
+    if (!g_summaryEnabled)
+        return;
+
+    uint64_t calls[NUM_STAGES] = {};
+    uint64_t ns[NUM_STAGES] = {};
+    AllocStats allocs[NUM_STAGES];
+    uint64_t items[NUM_STAGES] = {};
+    uint64_t counters[NUM_STAGES][NUM_COUNTERS] = {};
+    uint32_t countersMask = 0;
+    {
+        std::lock_guard<std::mutex> lock(g_threadsMutex);
+        for (ThreadProfile* p : g_threads)
+        {
+            for (uint32_t s = 0; s < NUM_STAGES; ++s)
+            {
+                calls[s] += p->stageCalls[s];
+                ns[s] += p->stageNs[s];
+                allocs[s].count += p->stageAllocs[s].count;
+                allocs[s].bytes += p->stageAllocs[s].bytes;
+                if (p->stageAllocs[s].peak > allocs[s].peak)
+                    allocs[s].peak = p->stageAllocs[s].peak;
+                items[s] += p->stageItems[s];
+                for (uint32_t c = 0; c < NUM_COUNTERS; ++c)
+                    counters[s][c] += p->stageCounters[s][c];
+            }
+            countersMask |= p->countersMask;
+        }
+    }
+
+    printf("%-14s %10s %12s %12s", "stage", "calls", "total ms", "mean us");
+    if (g_allocTracking)
+        printf(" %12s %12s %12s %12s", "allocs", "allocs/call", "alloc MB", "peak KB");
+    printf("\n");
+    for (uint32_t s = 0; s < NUM_STAGES; ++s)
+    {
+        double mean = calls[s] > 0 ? (ns[s] / 1000.0) / calls[s] : 0.0;
+        printf("%-14s %10llu %12.3f %12.3f", stageName((Stage)s), (unsigned long long)calls[s], ns[s] / 1e6, mean);
+        if (g_allocTracking)
+        {
+            double perCall = calls[s] > 0 ? (double)allocs[s].count / calls[s] : 0.0;
+            printf(" %12llu %12.1f %12.3f %12.1f", (unsigned long long)allocs[s].count, perCall,
+                allocs[s].bytes / (1024.0 * 1024.0), allocs[s].peak / 1024.0);
+        }
+        printf("\n");
+    }
+
+    if (countersMask != 0)
+    {
+        auto has = [&](Counter c) { return (countersMask & (1u << (uint32_t)c)) != 0; };
+        printf("\n%-14s %10s %12s %10s %10s %8s %14s %14s %14s\n", "stage", "items", "per", "ns/item",
+            "Mcycles", "IPC", "br-miss/item", "L1d-miss/item", "LLC-miss/item");
+        for (uint32_t s = 0; s < NUM_STAGES; ++s)
+        {
+            const uint64_t* v = counters[s];
+            double n = items[s] > 0 ? (double)items[s] : 0.0;
+            printf("%-14s %10llu %12s %10.2f", stageName((Stage)s), (unsigned long long)items[s], stageItemName((Stage)s),
+                n > 0 ? ns[s] / n : 0.0);
+
+            if (has(Counter::Cycles))
+                printf(" %10.3f", v[(uint32_t)Counter::Cycles] / 1e6);
+            else
+                printf(" %10s", "n/a");
+
+            if (has(Counter::Cycles) && has(Counter::Instructions) && v[(uint32_t)Counter::Cycles] > 0)
+                printf(" %8.2f", (double)v[(uint32_t)Counter::Instructions] / v[(uint32_t)Counter::Cycles]);
+            else
+                printf(" %8s", "n/a");
+
+            const Counter perItem[] = { Counter::BranchMisses, Counter::L1DMisses, Counter::LLCMisses };
+            for (Counter c : perItem)
+            {
+                if (has(c) && n > 0)
+                    printf(" %14.3f", v[(uint32_t)c] / n);
+                else
+                    printf(" %14s", "n/a");
+            }
+            printf("\n");
+        }
+    }
+    printf("wall time %.3f ms\n", profileNow() / 1e6);
+}
+
+void profileStageTotals(uint64_t calls[NUM_STAGES], uint64_t ns[NUM_STAGES])
+{
+    std::lock_guard<std::mutex> lock(g_threadsMutex);
+    for (uint32_t s = 0; s < NUM_STAGES; ++s)
+    {
+        calls[s] = 0;
+        ns[s] = 0;
+    }
+    for (ThreadProfile* p : g_threads)
+    {
+        for (uint32_t s = 0; s < NUM_STAGES; ++s)
+        {
+            calls[s] += p->stageCalls[s];
+            ns[s] += p->stageNs[s];
+        }
+    }
+}
+
+void profileResetPeakRSS()
+{
+#ifdef __linux__
+    // "5" resets VmHWM to the current RSS (Linux 4.0+)
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if (fp != nullptr)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+#endif
+}
+
+uint64_t profilePeakRSS()
+{
+#if defined(__linux__)
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp != nullptr)
+    {
+        char line[256];
+        unsigned long long kb = 0;
+        while (fgets(line, sizeof(line), fp))
+        {
+            if (sscanf(line, "VmHWM: %llu kB", &kb) == 1)
+                break;
+        }
+        fclose(fp);
+        if (kb > 0)
+            return kb * 1024;
+    }
+#endif
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Decode stages that are timed by StageScope. Keep stageName() in sync.
+enum class Stage : uint8_t
+{
+    Read,
+    Header,
+    Vertex,
+    Index,
+    Process, // meshops, after decoding
+    Write,
+    Count
+};
+
+static const uint32_t NUM_STAGES = (uint32_t)Stage::Count;
+
+const char* stageName(Stage stage);
+const char* stageItemName(Stage stage);
+
+// True when either tracing or the stage summary is enabled. Checked inline
+// by the scopes so a normal run only pays for a branch.
+extern bool g_profileActive;
+
+// Set by --alloc-stats. The global operator new/delete replacements in
+// profile.cpp attribute allocations to the stage running on the same thread.
+extern bool g_allocTracking;
+
+uint64_t profileNow();
+
+void profileEnable(bool trace, bool summary, bool allocs = false, bool counters = false);
+void profileSetFiles(const std::vector<std::string>& files);
+void profileSetThreadName(const std::string& name);
+
+void profileBeginFile(int32_t file);
+void profileEndFile(int32_t file, uint64_t begin, uint64_t end);
+void profileBeginStage(Stage stage);
+// File of the innermost FileScope on this thread, -1 outside one or when
+// profiling is off.
+int32_t profileCurrentFile();
+void profileRecordStage(Stage stage, int32_t mesh, uint64_t items, uint64_t begin, uint64_t end);
+
+bool profileWriteTrace(const std::string& filename);
+void profilePrintSummary();
+
+// Stage totals summed over every thread so far. Callers measuring one run
+// take the difference of two snapshots.
+void profileStageTotals(uint64_t calls[NUM_STAGES], uint64_t ns[NUM_STAGES]);
+
+// Peak resident set size in bytes since the last reset, 0 when unknown.
+// The reset only works on Linux; elsewhere the peak covers the process
+// lifetime.
+void profileResetPeakRSS();
+uint64_t profilePeakRSS();
+
+struct StageScope
+{
+    StageScope(Stage stage, int32_t mesh = -1)
+        : m_stage(stage), m_mesh(mesh), m_items(0), m_begin(0)
+    {
+        if (g_profileActive)
+        {
+            profileBeginStage(stage);
+            m_begin = profileNow();
+        }
+    }
+
+    ~StageScope()
+    {
+        if (g_profileActive)
+            profileRecordStage(m_stage, m_mesh, m_items, m_begin, profileNow());
+    }
+
+    // Number of elements (see stageItemName) handled inside the scope, used
+    // for the per-vertex/per-triangle rates in the summary.
+    void setItems(uint64_t items)
+    {
+        m_items = items;
+    }
+
+    Stage m_stage;
+    int32_t m_mesh;
+    uint64_t m_items;
+    uint64_t m_begin;
+};
+
+struct FileScope
+{
+    FileScope(int32_t file)
+        : m_file(file), m_begin(0)
+    {
+        if (g_profileActive)
+        {
+            profileBeginFile(file);
+            m_begin = profileNow();
+        }
+    }
+
+    ~FileScope()
+    {
+        if (g_profileActive)
+            profileEndFile(m_file, m_begin, profileNow());
+    }
+
+    int32_t m_file;
+    uint64_t m_begin;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Bounded multi-producer multi-consumer queue (Vyukov's array queue). Every
+// cell carries a sequence number, so producers and consumers only contend on
+// their own position counter. push() blocks while the queue is full, which
+// is what bounds the memory held by a pipeline.
+template <typename T>
+struct BoundedQueue
+{
+    BoundedQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool tryPush(T& value)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Blocks until there is room.
+    void push(T value)
+    {
+        for (uint32_t spins = 0; !tryPush(value); ++spins)
+            backoff(spins);
+    }
+
+    // Blocks until a value arrives. Returns false once the queue is closed
+    // and drained.
+    bool pop(T& value)
+    {
+        for (uint32_t spins = 0;; ++spins)
+        {
+            if (tryPop(value))
+                return true;
+            if (m_closed.load(std::memory_order_acquire))
+                return tryPop(value);
+            backoff(spins);
+        }
+    }
+
+    // No more pushes will follow.
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static void backoff(uint32_t spins)
+    {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    std::atomic<bool> m_closed{ false };
+};
@@ -0,0 +1,275 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+static thread_local TaskScheduler* t_scheduler = nullptr;
+static thread_local uint32_t t_workerIndex = 0;
+
+TaskScheduler::TaskScheduler(uint32_t numWorkers)
+{
+    numWorkers = std::max(numWorkers, 1u);
+    for (uint32_t i = 0; i < numWorkers; ++i)
+    {
+        m_workers.emplace_back(new Worker());
+        m_workers.back()->index = i;
+    }
+    for (uint32_t i = 0; i < numWorkers; ++i)
+        m_threads.emplace_back(&TaskScheduler::workerMain, this, i);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    m_stop.store(true, std::memory_order_release);
+    m_idleCondition.notify_all();
+    for (std::thread& t : m_threads)
+        t.join();
+}
+
+TaskScheduler* TaskScheduler::current()
+{
+    return t_scheduler;
+}
+
+void TaskScheduler::spawn(TaskGroup& group, Stage stage, std::function<void()> fn)
+{
+    Task task;
+    task.fn = std::move(fn);
+    task.group = &group;
+    task.file = profileCurrentFile();
+    task.stage = stage;
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (t_scheduler == this)
+    {
+        Worker& worker = *m_workers[t_workerIndex];
+        task.owner = worker.index;
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(m_submitMutex);
+        m_submitted.push_back(std::move(task));
+    }
+
+    if (m_sleeping.load(std::memory_order_acquire) > 0)
+        m_idleCondition.notify_one();
+}
+
+bool TaskScheduler::popOwn(Worker& worker, TaskGroup* group, Task& task)
+{
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty() || (group && worker.tasks.back().group != group))
+        return false;
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool TaskScheduler::steal(Worker& thief, TaskGroup* group, Task& task)
+{
+    if (group == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_submitMutex);
+        if (!m_submitted.empty())
+        {
+            task = std::move(m_submitted.front());
+            m_submitted.pop_front();
+            return true;
+        }
+    }
+
+    uint32_t count = numWorkers();
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        Worker& victim = *m_workers[(thief.index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty() || (group && victim.tasks.front().group != group))
+            continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void TaskScheduler::execute(Worker& worker, Task& task)
+{
+    TaskGroup* group = task.group;
+    try
+    {
+        if (task.owner == worker.index)
+        {
+            task.fn();
+        }
+        else
+        {
+            // On another thread than the spawner, so reopen its scopes.
+            auto run = [&]()
+            {
+                if (task.stage == Stage::Count)
+                {
+                    task.fn();
+                }
+                else
+                {
+                    StageScope scope(task.stage);
+                    task.fn();
+                }
+            };
+            if (task.file < 0)
+            {
+                run();
+            }
+            else
+            {
+                FileScope scope(task.file);
+                run();
+            }
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(group->errorMutex);
+        if (!group->error)
+            group->error = std::current_exception();
+    }
+    task.fn = nullptr;
+
+    // The group may be gone as soon as pending reaches zero.
+    if (group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        std::lock_guard<std::mutex> lock(m_waitMutex);
+        m_waitCondition.notify_all();
+    }
+}
+
+static void backoff(uint32_t spins)
+{
+    if (spins < 64)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void TaskScheduler::wait(TaskGroup& group)
+{
+    if (t_scheduler == this)
+    {
+        Worker& worker = *m_workers[t_workerIndex];
+        uint32_t spins = 0;
+        while (group.pending.load(std::memory_order_acquire) != 0)
+        {
+            Task task;
+            if (popOwn(worker, &group, task) || steal(worker, &group, task))
+            {
+                execute(worker, task);
+                spins = 0;
+            }
+            else
+            {
+                backoff(spins++);
+            }
+        }
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(m_waitMutex);
+        m_waitCondition.wait(lock, [&]()
+        {
+            return group.pending.load(std::memory_order_acquire) == 0;
+        });
+    }
+
+    if (group.error)
+    {
+        std::exception_ptr error = group.error;
+        group.error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskScheduler::workerMain(uint32_t index)
+{
+    t_scheduler = this;
+    t_workerIndex = index;
+    profileSetThreadName("worker " + std::to_string(index));
+
+    Worker& worker = *m_workers[index];
+    uint32_t spins = 0;
+    for (;;)
+    {
+        Task task;
+        if (popOwn(worker, nullptr, task) || steal(worker, nullptr, task))
+        {
+            execute(worker, task);
+            spins = 0;
+            continue;
+        }
+        if (m_stop.load(std::memory_order_acquire))
+            break;
+        if (spins++ < 64)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing to steal for a while; sleep until something is spawned.
+        // A missed wakeup only costs the timeout.
+        m_sleeping.fetch_add(1, std::memory_order_acq_rel);
+        {
+            std::unique_lock<std::mutex> lock(m_idleMutex);
+            m_idleCondition.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        m_sleeping.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    t_scheduler = nullptr;
+}
+
+uint32_t schedulerWorkers()
+{
+    return t_scheduler ? t_scheduler->numWorkers() : 1;
+}
+
+void parallelFor(size_t count, size_t grain, Stage stage, const std::function<void(size_t, size_t)>& fn)
+{
+    TaskScheduler* scheduler = t_scheduler;
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = (count + grain - 1) / grain;
+    if (scheduler)
+        chunks = std::min<size_t>(chunks, (size_t)scheduler->numWorkers() * 4);
+    if (scheduler == nullptr || chunks <= 1)
+    {
+        if (count > 0)
+            fn(0, count);
+        return;
+    }
+
+    TaskGroup group;
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        size_t begin = count * c / chunks;
+        size_t end = count * (c + 1) / chunks;
+        scheduler->spawn(group, stage, [&fn, begin, end]()
+        {
+            fn(begin, end);
+        });
+    }
+
+    // The first chunk runs right here; an exception from it still waits
+    // for the rest, which reference fn.
+    std::exception_ptr error;
+    try
+    {
+        fn(0, count / chunks);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    scheduler->wait(group);
+    if (error)
+        std::rethrow_exception(error);
+}
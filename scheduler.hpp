@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profile.hpp"
+
+// Tasks spawned together and waited for together. The first exception a
+// task throws is kept and rethrown by wait().
+struct TaskGroup
+{
+    std::atomic<uint32_t> pending{ 0 };
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+// Work-stealing scheduler. Every worker has its own deque: it pushes and
+// pops nested tasks at the back, idle workers steal from the front, so a
+// thief takes the oldest (largest) piece of someone else's work. Tasks
+// submitted from outside go through a shared queue in submission order.
+//
+// A worker waiting for a group only runs tasks of that group, so FileScope
+// and StageScope never nest across files. A task run by a thief gets the
+// spawner's file and the stage it was spawned for.
+struct TaskScheduler
+{
+    TaskScheduler(uint32_t numWorkers);
+    ~TaskScheduler();
+
+    // Queues fn. From a worker it goes on that worker's deque, from any
+    // other thread on the shared queue.
+    void spawn(TaskGroup& group, Stage stage, std::function<void()> fn);
+
+    // Returns once every task of group has run. Workers help with the
+    // group's tasks meanwhile, other threads block.
+    void wait(TaskGroup& group);
+
+    uint32_t numWorkers() const
+    {
+        return (uint32_t)m_workers.size();
+    }
+
+    // The scheduler whose worker is running the calling thread, if any.
+    static TaskScheduler* current();
+
+private:
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup* group = nullptr;
+        int32_t file = -1;
+        Stage stage = Stage::Count;
+        uint32_t owner = UINT32_MAX;
+    };
+
+    struct Worker
+    {
+        uint32_t index;
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool popOwn(Worker& worker, TaskGroup* group, Task& task);
+    bool steal(Worker& thief, TaskGroup* group, Task& task);
+    void execute(Worker& worker, Task& task);
+    void workerMain(uint32_t index);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::mutex m_submitMutex;
+    std::deque<Task> m_submitted;
+    std::mutex m_waitMutex;
+    std::condition_variable m_waitCondition;
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCondition;
+    std::atomic<uint32_t> m_sleeping{ 0 };
+    std::atomic<bool> m_stop{ false };
+};
+
+// Worker count of the scheduler running the calling thread, 1 elsewhere.
+uint32_t schedulerWorkers();
+
+// Calls fn(begin, end) over [0, count) in chunks of at least grain items.
+// On a scheduler worker the chunks become tasks other workers can steal;
+// anywhere else it is a single fn(0, count) on the calling thread. Returns
+// once all chunks are done, rethrowing the first exception one of them
+// threw. stage is the StageScope a stolen chunk is timed under, Stage::Count
+// for chunks that open their own.
+void parallelFor(size_t count, size_t grain, Stage stage, const std::function<void(size_t, size_t)>& fn);
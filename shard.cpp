@@ -0,0 +1,547 @@
+#include "shard.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+static const char* SHARD_BY_NAMES[] = { "hash", "cost" };
+
+const char* shardByName(ShardBy by)
+{
+    return SHARD_BY_NAMES[(uint32_t)by];
+}
+
+bool shardByFromName(const std::string& name, ShardBy& by)
+{
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        if (name == SHARD_BY_NAMES[i])
+        {
+            by = (ShardBy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseShard(const std::string& text, ShardSpec& spec)
+{
+    unsigned index = 0, count = 0;
+    char tail = 0;
+    if (sscanf(text.c_str(), "%u/%u%c", &index, &count, &tail) != 2 || count == 0 || index >= count)
+        return false;
+    spec.index = index;
+    spec.count = count;
+    return true;
+}
+
+// FNV-1a, so every platform and build picks the same shard for a path.
+static uint64_t hashString(const std::string& str, uint64_t hash = 0xCBF29CE484222325ull)
+{
+    for (char c : str)
+    {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t corpusId(const std::vector<std::string>& files)
+{
+    uint64_t hash = hashString(std::to_string(files.size()));
+    for (const std::string& file : files)
+        hash = hashString(file + '\n', hash);
+    return hash;
+}
+
+std::vector<uint32_t> shardFiles(const std::vector<std::string>& files, const ShardSpec& spec)
+{
+    std::vector<uint32_t> shard;
+    if (spec.count <= 1)
+    {
+        for (uint32_t i = 0; i < files.size(); ++i)
+            shard.push_back(i);
+        return shard;
+    }
+
+    if (spec.by == ShardBy::Hash)
+    {
+        for (uint32_t i = 0; i < files.size(); ++i)
+        {
+            if (hashString(files[i]) % spec.count == spec.index)
+                shard.push_back(i);
+        }
+        return shard;
+    }
+
+    // Largest first into the least loaded shard. Only integers and
+    // index tie breaks, so every run arrives at the same assignment.
+    std::vector<uint64_t> cost(files.size());
+    std::vector<uint32_t> order(files.size());
+    for (uint32_t i = 0; i < files.size(); ++i)
+    {
+        cost[i] = estimateFile(files[i]).cost;
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        return cost[a] > cost[b];
+    });
+
+    std::vector<uint64_t> load(spec.count, 0);
+    for (uint32_t i : order)
+    {
+        uint32_t target = (uint32_t)(std::min_element(load.begin(), load.end()) - load.begin());
+        load[target] += cost[i];
+        if (target == spec.index)
+            shard.push_back(i);
+    }
+    std::sort(shard.begin(), shard.end());
+    return shard;
+}
+
+static void writeJsonString(FILE* fp, const std::string& str)
+{
+    fputc('"', fp);
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            fputc('\\', fp);
+        if ((unsigned char)c < 0x20)
+        {
+            fprintf(fp, "\\u%04x", c);
+            continue;
+        }
+        fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+bool writeManifest(const std::string& filename, const Manifest& manifest)
+{
+    std::string tmp = filename + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        printf("Could not open manifest file %s\n", tmp.c_str());
+        return false;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"geomparse_manifest\": 1,\n");
+    fprintf(fp, "  \"corpus\": \"%016" PRIx64 "\",\n", manifest.corpus);
+    fprintf(fp, "  \"corpus_files\": %u,\n", manifest.corpusFiles);
+    fprintf(fp, "  \"shard\": %u,\n", manifest.shard.index);
+    fprintf(fp, "  \"shards\": %u,\n", manifest.shard.count);
+    fprintf(fp, "  \"shard_by\": \"%s\",\n", shardByName(manifest.shard.by));
+    fprintf(fp, "  \"wall_ns\": %" PRIu64 ",\n", manifest.wallNs);
+    fprintf(fp, "  \"files\": [");
+    for (size_t i = 0; i < manifest.files.size(); ++i)
+    {
+        const ManifestEntry& e = manifest.files[i];
+        const FileResult& r = e.result;
+        fprintf(fp, "%s\n    {\"index\": %u, \"path\": ", i ? "," : "", e.index);
+        writeJsonString(fp, e.path);
+        fprintf(fp, ", \"status\": \"%s\", \"meshes\": %u, \"vertices\": %" PRIu64 ", \"triangles\": %" PRIu64
+            ", \"bytes\": %" PRIu64 ", \"ns\": %" PRIu64 "}",
+            fileStatusName(r.status), r.meshes, r.vertices, r.triangles, r.bytes, r.ns);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    bool ok = fflush(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+
+    std::error_code ec;
+    if (ok)
+        std::filesystem::rename(tmp, filename, ec);
+    if (!ok || ec)
+    {
+        printf("Could not write manifest file %s\n", filename.c_str());
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+// Just enough JSON for what writeManifest produces: objects with string or
+// number values, and the one array of file objects.
+struct ManifestReader
+{
+    const std::string& text;
+    size_t at = 0;
+
+    ManifestReader(const std::string& text)
+        : text(text)
+    {
+    }
+
+    void skipSpace()
+    {
+        while (at < text.size() && isspace((unsigned char)text[at]))
+            ++at;
+    }
+
+    bool consume(char c)
+    {
+        skipSpace();
+        if (at >= text.size() || text[at] != c)
+            return false;
+        ++at;
+        return true;
+    }
+
+    bool readString(std::string& out)
+    {
+        if (!consume('"'))
+            return false;
+        out.clear();
+        while (at < text.size() && text[at] != '"')
+        {
+            char c = text[at++];
+            if (c == '\\' && at < text.size())
+            {
+                c = text[at++];
+                if (c == 'u' && at + 4 <= text.size())
+                {
+                    c = (char)strtoul(text.substr(at, 4).c_str(), nullptr, 16);
+                    at += 4;
+                }
+                else if (c == 'n')
+                {
+                    c = '\n';
+                }
+                else if (c == 't')
+                {
+                    c = '\t';
+                }
+            }
+            out.push_back(c);
+        }
+        return consume('"');
+    }
+
+    bool readNumber(uint64_t& out)
+    {
+        skipSpace();
+        char* end = nullptr;
+        out = strtoull(text.c_str() + at, &end, 10);
+        if (end == text.c_str() + at)
+            return false;
+        at = end - text.c_str();
+        return true;
+    }
+
+    // Calls field(key) for every key of an object; field reads the value.
+    template <typename Field>
+    bool readObject(Field field)
+    {
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        do
+        {
+            std::string key;
+            if (!readString(key) || !consume(':') || !field(key))
+                return false;
+        } while (consume(','));
+        return consume('}');
+    }
+
+    bool skipValue()
+    {
+        skipSpace();
+        std::string str;
+        uint64_t number;
+        return at < text.size() && text[at] == '"' ? readString(str) : readNumber(number);
+    }
+};
+
+bool readManifest(const std::string& filename, Manifest& manifest)
+{
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        printf("Could not open %s\n", filename.c_str());
+        return false;
+    }
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        text.append(buf, n);
+    fclose(fp);
+
+    manifest = Manifest();
+    bool isManifest = false;
+    ManifestReader reader(text);
+    auto readFile = [&](const std::string& key, ManifestEntry& e)
+    {
+        FileResult& r = e.result;
+        uint64_t value = 0;
+        std::string str;
+        if (key == "path")
+            return reader.readString(e.path);
+        if (key == "status")
+            return reader.readString(str) && fileStatusFromName(str, r.status);
+        if (!reader.readNumber(value))
+            return false;
+        if (key == "index")
+            e.index = (uint32_t)value;
+        else if (key == "meshes")
+            r.meshes = (uint32_t)value;
+        else if (key == "vertices")
+            r.vertices = value;
+        else if (key == "triangles")
+            r.triangles = value;
+        else if (key == "bytes")
+            r.bytes = value;
+        else if (key == "ns")
+            r.ns = value;
+        return true;
+    };
+    bool ok = reader.readObject([&](const std::string& key)
+    {
+        uint64_t value = 0;
+        std::string str;
+        if (key == "files")
+        {
+            if (!reader.consume('['))
+                return false;
+            if (reader.consume(']'))
+                return true;
+            do
+            {
+                ManifestEntry e;
+                if (!reader.readObject([&](const std::string& fileKey) { return readFile(fileKey, e); }))
+                    return false;
+                manifest.files.push_back(e);
+            } while (reader.consume(','));
+            return reader.consume(']');
+        }
+        if (key == "corpus")
+        {
+            if (!reader.readString(str))
+                return false;
+            manifest.corpus = strtoull(str.c_str(), nullptr, 16);
+            return true;
+        }
+        if (key == "shard_by")
+            return reader.readString(str) && shardByFromName(str, manifest.shard.by);
+        if (key != "geomparse_manifest" && key != "corpus_files" && key != "shard" && key != "shards" && key != "wall_ns")
+            return reader.skipValue();
+        if (!reader.readNumber(value))
+            return false;
+        if (key == "geomparse_manifest")
+            isManifest = value == 1;
+        else if (key == "corpus_files")
+            manifest.corpusFiles = (uint32_t)value;
+        else if (key == "shard")
+            manifest.shard.index = (uint32_t)value;
+        else if (key == "shards")
+            manifest.shard.count = (uint32_t)value;
+        else
+            manifest.wallNs = value;
+        return true;
+    });
+
+    if (!ok || !isManifest)
+    {
+        printf("%s is not a geomparse manifest\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void printMergeUsage()
+{
+    printf("Usage geomparse merge [-o merged.json] part.json...\n");
+    printf("  Checks that the partial manifests of a sharded run cover every shard\n");
+    printf("  and every file of the corpus once, prints their stats and writes the\n");
+    printf("  combined manifest. Exits non-zero when anything is missing.\n");
+}
+
+struct ShardStats
+{
+    uint32_t files = 0;
+    uint32_t converted = 0;
+    uint64_t vertices = 0;
+    uint64_t triangles = 0;
+    uint64_t bytes = 0;
+    uint64_t busyNs = 0;
+    uint64_t wallNs = 0;
+
+    void add(const FileResult& r)
+    {
+        ++files;
+        converted += r.status == FileStatus::Converted;
+        vertices += r.vertices;
+        triangles += r.triangles;
+        bytes += r.bytes;
+        busyNs += r.ns;
+    }
+
+    void print(const char* name) const
+    {
+        printf("%-8s %7u files %7u converted %12" PRIu64 " vertices %12" PRIu64 " triangles %9.1f MiB %10.1f ms wall %10.1f ms busy\n",
+            name, files, converted, vertices, triangles, bytes / 1048576.0, wallNs / 1e6, busyNs / 1e6);
+    }
+};
+
+int mergeMain(int argc, char* argv[])
+{
+    std::string output;
+    std::vector<std::string> parts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (arg[0] == '-')
+        {
+            printMergeUsage();
+            return -1;
+        }
+        else
+        {
+            parts.push_back(arg);
+        }
+    }
+    if (parts.empty())
+    {
+        printMergeUsage();
+        return -1;
+    }
+
+    std::vector<Manifest> manifests(parts.size());
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        if (!readManifest(parts[i], manifests[i]))
+            return -1;
+    }
+
+    bool complete = true;
+    const Manifest& first = manifests[0];
+    for (size_t i = 1; i < manifests.size(); ++i)
+    {
+        const Manifest& m = manifests[i];
+        if (m.corpus != first.corpus || m.corpusFiles != first.corpusFiles || m.shard.count != first.shard.count || m.shard.by != first.shard.by)
+        {
+            printf("%s is from a different run than %s (corpus, file count, shard count or shard_by differ)\n", parts[i].c_str(), parts[0].c_str());
+            return -1;
+        }
+    }
+
+    std::vector<int32_t> shardPart(first.shard.count, -1);
+    for (size_t i = 0; i < manifests.size(); ++i)
+    {
+        uint32_t shard = manifests[i].shard.index;
+        if (shard >= first.shard.count)
+        {
+            printf("%s has shard %u of %u\n", parts[i].c_str(), shard, first.shard.count);
+            complete = false;
+        }
+        else if (shardPart[shard] >= 0)
+        {
+            printf("shard %u is in both %s and %s\n", shard, parts[shardPart[shard]].c_str(), parts[i].c_str());
+            complete = false;
+        }
+        else
+        {
+            shardPart[shard] = (int32_t)i;
+        }
+    }
+    for (uint32_t s = 0; s < first.shard.count; ++s)
+    {
+        if (shardPart[s] < 0)
+        {
+            printf("shard %u/%u is missing\n", s, first.shard.count);
+            complete = false;
+        }
+    }
+
+    Manifest merged;
+    merged.corpus = first.corpus;
+    merged.corpusFiles = first.corpusFiles;
+    merged.shard.by = first.shard.by;
+    merged.files.resize(first.corpusFiles);
+    std::vector<int32_t> filePart(first.corpusFiles, -1);
+    uint32_t badFiles = 0;
+    for (size_t i = 0; i < manifests.size(); ++i)
+    {
+        for (const ManifestEntry& e : manifests[i].files)
+        {
+            if (e.index >= first.corpusFiles || filePart[e.index] >= 0)
+            {
+                if (badFiles++ < 16)
+                    printf("%s: file %u (%s) is %s\n", parts[i].c_str(), e.index, e.path.c_str(), e.index >= first.corpusFiles ? "outside the corpus" : "listed twice");
+                complete = false;
+                continue;
+            }
+            filePart[e.index] = (int32_t)i;
+            merged.files[e.index] = e;
+        }
+    }
+    uint32_t missing = 0;
+    for (uint32_t f = 0; f < first.corpusFiles; ++f)
+    {
+        if (filePart[f] < 0 && missing++ < 16)
+            printf("file %u of the corpus is in no manifest\n", f);
+    }
+    if (missing > 0)
+    {
+        printf("%u of %u files missing\n", missing, first.corpusFiles);
+        complete = false;
+    }
+
+    ShardStats total;
+    uint64_t maxBusy = 0;
+    for (uint32_t s = 0; s < first.shard.count; ++s)
+    {
+        if (shardPart[s] < 0)
+            continue;
+        const Manifest& m = manifests[shardPart[s]];
+        ShardStats stats;
+        for (const ManifestEntry& e : m.files)
+            stats.add(e.result);
+        stats.wallNs = m.wallNs;
+        char name[32];
+        snprintf(name, sizeof(name), "%u/%u", s, first.shard.count);
+        stats.print(name);
+        merged.wallNs = std::max(merged.wallNs, m.wallNs);
+        maxBusy = std::max(maxBusy, stats.busyNs);
+    }
+    for (const ManifestEntry& e : merged.files)
+        total.add(e.result);
+    total.files = first.corpusFiles - missing;
+    total.wallNs = merged.wallNs;
+    total.print("total");
+    if (first.shard.count > 1 && total.busyNs > 0)
+        printf("busiest shard %.2fx the mean\n", (double)maxBusy * first.shard.count / total.busyNs);
+
+    uint32_t failed = 0;
+    for (uint32_t f = 0; f < first.corpusFiles; ++f)
+    {
+        const ManifestEntry& e = merged.files[f];
+        if (filePart[f] >= 0 && e.result.status != FileStatus::Converted)
+        {
+            if (failed++ < 16)
+                printf("%s: %s\n", e.path.c_str(), fileStatusName(e.result.status));
+        }
+    }
+    if (failed > 0)
+        printf("%u files not converted\n", failed);
+
+    if (!complete)
+    {
+        printf("manifests incomplete, nothing merged\n");
+        return 1;
+    }
+    if (!output.empty() && !writeManifest(output, merged))
+        return -1;
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+
+// Splitting one corpus across processes or machines without anything to
+// coordinate them. Every run is given the same file list (in the same
+// order, with the same spelling of the paths), picks its own shard
+// deterministically and writes a partial manifest; `geomparse merge` then
+// checks that the manifests cover the corpus exactly once and combines
+// them. Manifests and outputs only need a local or shared directory.
+
+enum class ShardBy : uint8_t
+{
+    Hash, // by path, stable when files are added to or removed from the corpus
+    Cost  // balanced by estimateFile(), every run reads all mesh headers
+};
+
+const char* shardByName(ShardBy by);
+bool shardByFromName(const std::string& name, ShardBy& by);
+
+struct ShardSpec
+{
+    uint32_t index = 0;
+    uint32_t count = 1;
+    ShardBy by = ShardBy::Hash;
+};
+
+// "K/N" with K < N
+bool parseShard(const std::string& text, ShardSpec& spec);
+
+// Corpus indices of the files in shard spec.index, in corpus order.
+std::vector<uint32_t> shardFiles(const std::vector<std::string>& files, const ShardSpec& spec);
+
+// Identifies a file list, so manifests of different corpora aren't merged.
+uint64_t corpusId(const std::vector<std::string>& files);
+
+struct ManifestEntry
+{
+    uint32_t index = 0; // in the corpus
+    std::string path;
+    FileResult result;
+};
+
+struct Manifest
+{
+    uint64_t corpus = 0;
+    uint32_t corpusFiles = 0;
+    ShardSpec shard;
+    uint64_t wallNs = 0;
+    std::vector<ManifestEntry> files;
+};
+
+// Written to filename.tmp and renamed, so a manifest that exists is complete.
+bool writeManifest(const std::string& filename, const Manifest& manifest);
+bool readManifest(const std::string& filename, Manifest& manifest);
+
+// geomparse merge [-o merged.json] part.json...
+int mergeMain(int argc, char* argv[]);
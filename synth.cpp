@@ -0,0 +1,569 @@
+#include "synth.hpp"
+#include "half.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+static const uint32_t MAX_VERTICES = 0xFFFF / 12; // meshBlock1Length is 16 bit
+static const uint32_t MAX_TRIANGLES = 0xFFFF / 3; // numIndices is 16 bit
+static const uint32_t MESH_HEADER_SIZE = 128;
+static const uint32_t GEOM_HEADER_SIZE = 16;
+
+static const uint8_t FACE_NEW = 0xC0;
+static const uint8_t FACE_BACKREF_31 = 0x00; // -3 -1 0
+static const uint8_t FACE_BACKREF_12 = 0x40; // -1 -2 0
+static const uint8_t FACE_BACKREF_23 = 0x80; // -2 -3 0
+
+std::vector<uint8_t> encodeFaces(const std::vector<uint16_t>& triangles, std::vector<uint16_t>& stream, uint32_t faceOpCounts[4])
+{
+    uint32_t numTris = (uint32_t)triangles.size() / 3;
+    std::vector<uint8_t> faceData(((numTris + numTris) + 7) / 8, 0);
+    stream.clear();
+
+    for (uint32_t t = 0; t < numTris; ++t)
+    {
+        const uint16_t* tri = &triangles[t * 3];
+        uint8_t op = FACE_NEW;
+        if (t > 0)
+        {
+            const uint16_t* prev = &triangles[(t - 1) * 3];
+            if (tri[0] == prev[0] && tri[1] == prev[2])
+                op = FACE_BACKREF_31;
+            else if (tri[0] == prev[2] && tri[1] == prev[1])
+                op = FACE_BACKREF_12;
+            else if (tri[0] == prev[1] && tri[1] == prev[0])
+                op = FACE_BACKREF_23;
+        }
+
+        if (op == FACE_NEW)
+        {
+            stream.push_back(tri[0]);
+            stream.push_back(tri[1]);
+        }
+        stream.push_back(tri[2]);
+
+        faceData[t / 4] |= op >> ((t % 4) * 2);
+        if (faceOpCounts != nullptr)
+            faceOpCounts[op >> 6]++;
+    }
+
+    return faceData;
+}
+
+std::vector<uint8_t> write1bArray(const std::vector<uint16_t>& stream, std::vector<uint16_t>& explicitIndices)
+{
+    std::vector<uint8_t> prefaceData((stream.size() + 7) / 8, 0);
+    explicitIndices.clear();
+
+    uint16_t indexValue = 0;
+    for (size_t i = 0; i < stream.size(); ++i)
+    {
+        if (stream[i] == indexValue)
+        {
+            indexValue++;
+        }
+        else
+        {
+            prefaceData[i / 8] |= 0x80 >> (i % 8);
+            explicitIndices.push_back(stream[i]);
+        }
+    }
+
+    return prefaceData;
+}
+
+bool encodeBackRefIndices(const std::vector<uint16_t>& explicitIndices, int32_t backRefOffset, std::vector<uint16_t>& raw, uint16_t& usedOffset)
+{
+    const uint32_t NUM_BACKREFS = 8;
+    uint32_t total = ((uint32_t)explicitIndices.size() + 0x1F) & 0xFFFFFFE0;
+
+    // Padding repeats the lane's previous value so it encodes as a zero delta.
+    std::vector<int32_t> full(total);
+    std::vector<int32_t> delta(total);
+    int32_t minDelta = 0;
+    int32_t maxDelta = 0;
+    for (uint32_t i = 0; i < total; ++i)
+    {
+        int32_t prev = i >= NUM_BACKREFS ? full[i - NUM_BACKREFS] : 0;
+        full[i] = i < explicitIndices.size() ? explicitIndices[i] : prev;
+        delta[i] = full[i] - prev;
+        minDelta = std::min(minDelta, delta[i]);
+        maxDelta = std::max(maxDelta, delta[i]);
+    }
+
+    bool ok = true;
+    int32_t offset = -minDelta;
+    if (backRefOffset >= 0)
+    {
+        if (backRefOffset >= -minDelta && maxDelta + backRefOffset <= 0xFFFF)
+            offset = backRefOffset;
+        else
+            ok = false;
+    }
+
+    raw.resize(total);
+    for (uint32_t i = 0; i < total; ++i)
+        raw[i] = (uint16_t)(delta[i] + offset);
+    usedOffset = (uint16_t)offset;
+    return ok;
+}
+
+std::vector<uint8_t> writeVariableBitArray(const std::vector<uint16_t>& raw, uint32_t numBitsPerValue)
+{
+    // readVariableBitArray loads three bytes per value, so keep the tail readable.
+    std::vector<uint8_t> data(((raw.size() * numBitsPerValue) + 7) / 8 + 3, 0);
+    uint32_t offset = 0;
+    for (uint16_t value : raw)
+    {
+        for (uint32_t b = 0; b < numBitsPerValue; ++b, ++offset)
+        {
+            if (value & (1u << (numBitsPerValue - 1 - b)))
+                data[offset / 8] |= 0x80 >> (offset & 0x07);
+        }
+    }
+    return data;
+}
+
+static void put8(std::vector<uint8_t>& out, uint8_t v)
+{
+    out.push_back(v);
+}
+
+static void put16(std::vector<uint8_t>& out, uint16_t v)
+{
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)v);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v)
+{
+    put16(out, (uint16_t)(v >> 16));
+    put16(out, (uint16_t)v);
+}
+
+static void putf32(std::vector<uint8_t>& out, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    put32(out, v);
+}
+
+static void putf16(std::vector<uint8_t>& out, float f)
+{
+    half_float::half h(f);
+    put16(out, h.data_);
+}
+
+static void putString(std::vector<uint8_t>& out, const std::string& str)
+{
+    char buf[64];
+    memset(buf, 0, sizeof(buf));
+    strncpy(buf, str.c_str(), sizeof(buf) - 1);
+    out.insert(out.end(), buf, buf + sizeof(buf));
+}
+
+static void set32(std::vector<uint8_t>& out, size_t at, uint32_t v)
+{
+    out[at] = (uint8_t)(v >> 24);
+    out[at + 1] = (uint8_t)(v >> 16);
+    out[at + 2] = (uint8_t)(v >> 8);
+    out[at + 3] = (uint8_t)v;
+}
+
+static void align16(std::vector<uint8_t>& out)
+{
+    while (out.size() % 16)
+        out.push_back(0);
+}
+
+static uint32_t bitWidth(uint32_t value)
+{
+    uint32_t bits = 1;
+    while (bits < 32 && (value >> bits) != 0)
+        bits++;
+    return bits;
+}
+
+std::vector<uint8_t> encodeIndexArray(const std::vector<uint16_t>& triangles, uint32_t indexBits, int32_t backRefOffset, EdgeIndexStats* stats)
+{
+    EdgeIndexStats local;
+    EdgeIndexStats& s = stats != nullptr ? *stats : local;
+
+    std::vector<uint16_t> stream;
+    std::vector<uint8_t> faceData = encodeFaces(triangles, stream, s.faceOps);
+
+    std::vector<uint16_t> explicitIndices;
+    std::vector<uint8_t> prefaceData = write1bArray(stream, explicitIndices);
+
+    std::vector<uint16_t> raw;
+    if (!encodeBackRefIndices(explicitIndices, backRefOffset, raw, s.backRefOffset))
+        encodeBackRefIndices(explicitIndices, -1, raw, s.backRefOffset);
+
+    uint32_t maxRaw = 0;
+    for (uint16_t r : raw)
+        maxRaw = std::max<uint32_t>(maxRaw, r);
+    uint32_t bits = bitWidth(maxRaw);
+    if (indexBits >= bits && indexBits <= 16)
+        bits = indexBits;
+
+    std::vector<uint8_t> varBitData = writeVariableBitArray(raw, bits);
+
+    s.numVarBitIndices = (uint32_t)explicitIndices.size();
+    s.num1BitIndices = (uint32_t)prefaceData.size() * 8;
+    s.bits = (uint8_t)bits;
+
+    std::vector<uint8_t> out;
+    put16(out, (uint16_t)explicitIndices.size());
+    put16(out, s.backRefOffset);
+    put16(out, (uint16_t)prefaceData.size());
+    put8(out, (uint8_t)bits);
+    put8(out, 0);
+    out.insert(out.end(), prefaceData.begin(), prefaceData.end());
+    out.insert(out.end(), faceData.begin(), faceData.end());
+    out.insert(out.end(), varBitData.begin(), varBitData.end());
+    return out;
+}
+
+SynthMesh synthMesh(SynthRng& rng, const SynthOptions& options, uint32_t numVertices)
+{
+    SynthMesh mesh;
+    numVertices = std::min(std::max(numVertices, 3u), MAX_VERTICES);
+
+    float cx = rng.unit() * 20.0f - 10.0f;
+    float cy = rng.unit() * 20.0f - 10.0f;
+    float cz = rng.unit() * 20.0f - 10.0f;
+    float radius = 0.5f + rng.unit() * 4.0f;
+    uint32_t numTexCoords = (uint32_t)(numVertices * std::min(std::max(options.texCoords, 0.0f), 1.0f));
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        mesh.positions.push_back(cx + (rng.unit() * 2.0f - 1.0f) * radius);
+        mesh.positions.push_back(cy + (rng.unit() * 2.0f - 1.0f) * radius);
+        mesh.positions.push_back(cz + (rng.unit() * 2.0f - 1.0f) * radius);
+        // Drawn either way, so the rest of the corpus doesn't change.
+        float s = rng.unit();
+        float t = rng.unit();
+        if (v < numTexCoords)
+        {
+            mesh.uvs.push_back(s);
+            mesh.uvs.push_back(t);
+        }
+        for (uint32_t n = 0; n < 3; ++n)
+            mesh.normals.push_back((int8_t)(rng.range(0, 254) - 127));
+        for (uint32_t n = 0; n < 3; ++n)
+            mesh.normals.push_back(0);
+    }
+
+    uint32_t numTris = (uint32_t)(numVertices * options.trisPerVertex);
+    numTris = std::min(std::max(numTris, 1u), MAX_TRIANGLES);
+
+    float weights[4];
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        weights[i] = std::max(options.faceOps[i], 0.0f);
+        sum += weights[i];
+    }
+    if (sum <= 0.0f)
+    {
+        weights[0] = sum = 1.0f;
+    }
+
+    // Spread first uses of the vertices evenly over the index stream.
+    float streamLength = numTris * (1.0f + 2.0f * weights[0] / sum);
+    float freshRatio = std::min(1.0f, numVertices / streamLength);
+    uint32_t window = std::max(options.reuseWindow, 1u);
+    uint32_t next = 0;
+    auto pick = [&]() -> uint16_t
+    {
+        if (next == 0 || (next < numVertices && rng.unit() < freshRatio))
+            return (uint16_t)next++;
+        uint32_t lo = next > window ? next - window : 0;
+        return (uint16_t)rng.range(lo, next - 1);
+    };
+
+    for (uint32_t t = 0; t < numTris; ++t)
+    {
+        float r = rng.unit() * sum;
+        uint32_t op = 0;
+        while (op < 3 && r >= weights[op])
+        {
+            r -= weights[op];
+            op++;
+        }
+        if (t == 0)
+            op = 0;
+
+        uint16_t a, b;
+        const uint16_t* prev = t > 0 ? &mesh.triangles[(t - 1) * 3] : nullptr;
+        switch (op)
+        {
+        case 1: a = prev[0]; b = prev[2]; break;
+        case 2: a = prev[2]; b = prev[1]; break;
+        case 3: a = prev[1]; b = prev[0]; break;
+        default:
+            a = pick();
+            b = pick();
+            for (uint32_t retry = 0; retry < 4 && b == a; ++retry)
+                b = pick();
+            break;
+        }
+
+        uint16_t c = pick();
+        for (uint32_t retry = 0; retry < 4 && (c == a || c == b); ++retry)
+            c = pick();
+
+        mesh.triangles.push_back(a);
+        mesh.triangles.push_back(b);
+        mesh.triangles.push_back(c);
+    }
+
+    return mesh;
+}
+
+SynthFile synthFile(const SynthOptions& options, uint32_t fileIndex, EdgeIndexStats* stats)
+{
+    SynthRng rng((uint64_t)options.seed * 1000003ull + fileIndex);
+    uint32_t numMeshes = rng.range(std::max(options.minMeshes, 1u), std::max(options.maxMeshes, options.minMeshes));
+    uint32_t numMaterials = std::max(options.numMaterials, 1u);
+
+    SynthFile file;
+    std::vector<uint8_t>& out = file.geom;
+    out.resize(GEOM_HEADER_SIZE + MESH_HEADER_SIZE * numMeshes, 0);
+
+    float aabb[6] = { 1e30f, 1e30f, 1e30f, -1e30f, -1e30f, -1e30f };
+    for (uint32_t m = 0; m < numMeshes; ++m)
+    {
+        SynthMesh mesh = synthMesh(rng, options, rng.range(options.minVertices, std::max(options.maxVertices, options.minVertices)));
+        mesh.materialId = (uint8_t)rng.range(0, std::min(numMaterials, 256u) - 1);
+        uint32_t numVertices = (uint32_t)mesh.positions.size() / 3;
+
+        EdgeIndexStats meshStats;
+        std::vector<uint8_t> indexData = encodeIndexArray(mesh.triangles, options.indexBits, options.backRefOffset, &meshStats);
+        while (indexData.size() > 0xFFFF)
+        {
+            // meshTrianglesSize is 16 bit, drop triangles until the block fits
+            mesh.triangles.resize(((mesh.triangles.size() / 3) / 2) * 3);
+            meshStats = EdgeIndexStats();
+            indexData = encodeIndexArray(mesh.triangles, options.indexBits, options.backRefOffset, &meshStats);
+        }
+        if (stats != nullptr)
+        {
+            stats->numVarBitIndices += meshStats.numVarBitIndices;
+            stats->num1BitIndices += meshStats.num1BitIndices;
+            stats->bits = std::max(stats->bits, meshStats.bits);
+            for (uint32_t i = 0; i < 4; ++i)
+                stats->faceOps[i] += meshStats.faceOps[i];
+        }
+
+        align16(out);
+        uint32_t positionsAddress = (uint32_t)out.size();
+        for (uint32_t i = 0; i < numVertices * 3; ++i)
+        {
+            putf32(out, mesh.positions[i]);
+            aabb[i % 3] = std::min(aabb[i % 3], mesh.positions[i]);
+            aabb[3 + i % 3] = std::max(aabb[3 + i % 3], mesh.positions[i]);
+        }
+        uint32_t positionsEnd = (uint32_t)out.size();
+        for (int8_t n : mesh.normals)
+            put8(out, (uint8_t)n);
+
+        align16(out);
+        uint32_t uvAddress = (uint32_t)out.size();
+        for (float uv : mesh.uvs)
+            putf16(out, uv);
+        uint32_t uvLength = (uint32_t)out.size() - uvAddress;
+
+        align16(out);
+        uint32_t indexAddress = (uint32_t)out.size();
+        out.insert(out.end(), indexData.begin(), indexData.end());
+
+        std::vector<uint8_t> h;
+        put32(h, 0);                                         // signature
+        put16(h, 0);                                         // unk1
+        put8(h, 0);                                          // unk2
+        put8(h, mesh.materialId);
+        put16(h, 0);                                         // unk3
+        put16(h, (uint16_t)mesh.triangles.size());           // numIndices
+        put32(h, 0xFFFFFFFF);
+        put32(h, indexAddress);
+        put16(h, (uint16_t)indexData.size());
+        put16(h, 0);
+        put32(h, positionsAddress);
+        put32(h, positionsEnd);
+        put16(h, (uint16_t)(positionsEnd - positionsAddress));
+        put16(h, 0);
+        put32(h, (uint32_t)mesh.normals.size());             // normalBlockLength
+        put32(h, 0);
+        put32(h, uvAddress);
+        put32(h, uvLength);
+        while (h.size() < MESH_HEADER_SIZE)
+            put32(h, 0);                                     // offsets
+        memcpy(&out[GEOM_HEADER_SIZE + m * MESH_HEADER_SIZE], h.data(), MESH_HEADER_SIZE);
+    }
+
+    align16(out);
+    putf32(out, aabb[3]);
+    putf32(out, aabb[4]);
+    putf32(out, aabb[5]);
+    putf32(out, aabb[0]);
+    putf32(out, aabb[1]);
+    putf32(out, aabb[2]);
+
+    set32(out, 0, numMeshes);
+    set32(out, 4, 0);
+    set32(out, 8, 0);
+    set32(out, 12, (uint32_t)out.size());
+
+    put32(file.mat, numMaterials);
+    for (uint32_t m = 0; m < numMaterials; ++m)
+    {
+        char name[64];
+        put32(file.mat, 2);
+        snprintf(name, sizeof(name), "synth_mat%u", m);
+        putString(file.mat, name);
+        snprintf(name, sizeof(name), "synth_tex%u.dds", m);
+        putString(file.mat, name);
+        snprintf(name, sizeof(name), "synth_mat%u_normal", m);
+        putString(file.mat, name);
+        snprintf(name, sizeof(name), "synth_tex%u_n.dds", m);
+        putString(file.mat, name);
+    }
+
+    return file;
+}
+
+static bool writeBytes(const std::string& filename, const std::vector<uint8_t>& data)
+{
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        printf("Could not write %s\n", filename.c_str());
+        return false;
+    }
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    return true;
+}
+
+std::vector<std::string> synthCorpus(const std::string& dir, const SynthOptions& options, EdgeIndexStats* stats, uint64_t* totalBytes)
+{
+    std::vector<std::string> files;
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    std::string base = dir;
+    if (!base.empty() && base.back() != '/' && base.back() != '\\')
+        base += "/";
+
+    FILE* list = fopen((base + "corpus.txt").c_str(), "w+");
+    for (uint32_t i = 0; i < options.numFiles; ++i)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "synth_%04u", i);
+        std::string geom = base + name + ".geom.edge";
+        SynthFile file = synthFile(options, i, stats);
+        if (totalBytes != nullptr)
+            *totalBytes += file.geom.size() + file.mat.size();
+        if (!writeBytes(geom, file.geom) || !writeBytes(base + name + ".mat.edge", file.mat))
+            break;
+        files.push_back(geom);
+        if (list != nullptr)
+            fprintf(list, "%s\n", geom.c_str());
+    }
+    if (list != nullptr)
+        fclose(list);
+    return files;
+}
+
+static bool parseRange(const char* arg, uint32_t& lo, uint32_t& hi)
+{
+    unsigned a = 0;
+    unsigned b = 0;
+    int n = sscanf(arg, "%u:%u", &a, &b);
+    if (n < 1)
+        return false;
+    lo = a;
+    hi = n == 2 ? b : a;
+    return true;
+}
+
+static void printSynthUsage()
+{
+    printf("Usage geomparse synth outdir [options]\n");
+    printf("  --seed N               corpus seed (default 1)\n");
+    printf("  --files N              number of .geom.edge/.mat.edge pairs (default 16)\n");
+    printf("  --meshes MIN[:MAX]     meshes per file (default 1:4)\n");
+    printf("  --vertices MIN[:MAX]   vertices per mesh, at most %u (default 64:2048)\n", MAX_VERTICES);
+    printf("  --tris-per-vertex F    triangle to vertex ratio (default 1.8)\n");
+    printf("  --materials N          materials per file (default 2)\n");
+    printf("  --tex-coords F         fraction of the vertices with UVs (default 1)\n");
+    printf("  --index-bits N         force the variable-bit index width (default narrowest)\n");
+    printf("  --backref-offset N     force the back-ref delta offset (default smallest)\n");
+    printf("  --face-ops N,A,B,C     weights of new/-3-1/-1-2/-2-3 face ops (default .1,.3,.3,.3)\n");
+    printf("  --reuse-window N       explicit indices reach back at most N vertices (default 64)\n");
+}
+
+int synthMain(int argc, char* argv[])
+{
+    SynthOptions options;
+    std::string dir;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--seed" && hasValue)
+            options.seed = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--files" && hasValue)
+            options.numFiles = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--meshes" && hasValue)
+            ok = parseRange(argv[++i], options.minMeshes, options.maxMeshes);
+        else if (arg == "--vertices" && hasValue)
+            ok = parseRange(argv[++i], options.minVertices, options.maxVertices);
+        else if (arg == "--tris-per-vertex" && hasValue)
+            options.trisPerVertex = (float)atof(argv[++i]);
+        else if (arg == "--materials" && hasValue)
+            options.numMaterials = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--tex-coords" && hasValue)
+            options.texCoords = (float)atof(argv[++i]);
+        else if (arg == "--index-bits" && hasValue)
+            options.indexBits = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--backref-offset" && hasValue)
+            options.backRefOffset = atoi(argv[++i]);
+        else if (arg == "--face-ops" && hasValue)
+            ok = sscanf(argv[++i], "%f,%f,%f,%f", &options.faceOps[0], &options.faceOps[1], &options.faceOps[2], &options.faceOps[3]) == 4;
+        else if (arg == "--reuse-window" && hasValue)
+            options.reuseWindow = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg[0] != '-' && dir.empty())
+            dir = arg;
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            printSynthUsage();
+            return -1;
+        }
+    }
+
+    if (dir.empty())
+    {
+        printSynthUsage();
+        return -1;
+    }
+
+    EdgeIndexStats stats;
+    uint64_t bytes = 0;
+    std::vector<std::string> files = synthCorpus(dir, options, &stats, &bytes);
+    if (files.size() != options.numFiles)
+        return -1;
+
+    printf("Wrote %u geoms (%.2f MB) to %s\n", options.numFiles, bytes / (1024.0 * 1024.0), dir.c_str());
+    printf("indices: %u 1-bit, %u variable-bit, widest %u bits\n", stats.num1BitIndices, stats.numVarBitIndices, stats.bits);
+    printf("face ops: %u new, %u -3-1, %u -1-2, %u -2-3\n", stats.faceOps[3], stats.faceOps[0], stats.faceOps[1], stats.faceOps[2]);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Synthetic .geom.edge/.mat.edge generator. Everything is derived from the
+// seed with a portable RNG, so the same options produce byte-identical
+// corpora on every platform.
+
+struct SynthOptions
+{
+    uint32_t seed = 1;
+    uint32_t numFiles = 16;
+    uint32_t minMeshes = 1;
+    uint32_t maxMeshes = 4;
+    uint32_t minVertices = 64;
+    uint32_t maxVertices = 2048;
+    float trisPerVertex = 1.8f;
+    uint32_t numMaterials = 2;
+    // Fraction of each mesh's vertices, the first ones, that get UVs; the
+    // texture block of real files can be shorter than the vertex block.
+    float texCoords = 1.0f;
+
+    // 0 picks the narrowest width that holds every delta. A wider width is
+    // honoured as is; a narrower one falls back to the narrowest.
+    uint32_t indexBits = 0;
+    // -1 derives the offset from the smallest delta.
+    int32_t backRefOffset = -1;
+    // Relative weights of the four face ops: new triangle, backref -3 -1,
+    // backref -1 -2 and backref -2 -3.
+    float faceOps[4] = { 0.1f, 0.3f, 0.3f, 0.3f };
+    // Explicit (var-bit) indices are drawn from the last reuseWindow
+    // vertices. Smaller windows give smaller deltas and narrower indices.
+    uint32_t reuseWindow = 64;
+};
+
+struct SynthRng
+{
+    uint64_t state;
+
+    SynthRng(uint64_t seed)
+        : state(seed * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull)
+    {
+    }
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [lo, hi]
+    uint32_t range(uint32_t lo, uint32_t hi)
+    {
+        if (hi <= lo)
+            return lo;
+        return lo + (uint32_t)(next() % ((uint64_t)hi - lo + 1));
+    }
+
+    float unit()
+    {
+        return (next() >> 40) * (1.0f / 16777216.0f);
+    }
+};
+
+// EDGE index encoder, the inverse of GeomMeshHeader::parseIndexArray.
+// Each step undoes one decode step:
+//   encodeFaces            <- buildFaces
+//   write1bArray           <- read1bArray
+//   encodeBackRefIndices   <- readBackRefIndices
+//   writeVariableBitArray  <- readVariableBitArray
+struct EdgeIndexStats
+{
+    uint32_t numVarBitIndices = 0;
+    uint32_t num1BitIndices = 0;
+    uint16_t backRefOffset = 0;
+    uint8_t bits = 0;
+    uint32_t faceOps[4] = {};
+};
+
+// Picks a face op per triangle (reusing two corners of the previous
+// triangle where possible) and returns the face bytes plus the remaining
+// index stream.
+std::vector<uint8_t> encodeFaces(const std::vector<uint16_t>& triangles, std::vector<uint16_t>& stream, uint32_t faceOpCounts[4]);
+
+// Splits the index stream into the 1-bit preface (0 = next sequential
+// vertex) and the explicit indices that go into the variable-bit array.
+std::vector<uint8_t> write1bArray(const std::vector<uint16_t>& stream, std::vector<uint16_t>& explicitIndices);
+
+// Turns explicit indices into per-lane deltas (8 lanes) biased by
+// backRefOffset. Pads to a multiple of 32 and returns false when the
+// requested offset doesn't keep every delta non-negative.
+bool encodeBackRefIndices(const std::vector<uint16_t>& explicitIndices, int32_t backRefOffset, std::vector<uint16_t>& raw, uint16_t& usedOffset);
+
+std::vector<uint8_t> writeVariableBitArray(const std::vector<uint16_t>& raw, uint32_t numBitsPerValue);
+
+// Complete mesh index block as found at meshTrianglesAddress.
+std::vector<uint8_t> encodeIndexArray(const std::vector<uint16_t>& triangles, uint32_t indexBits, int32_t backRefOffset, EdgeIndexStats* stats = nullptr);
+
+struct SynthMesh
+{
+    std::vector<float> positions; // xyz
+    std::vector<float> uvs;       // uv, of the first vertices only with texCoords < 1
+    std::vector<int8_t> normals;  // 6 bytes per vertex as stored
+    std::vector<uint16_t> triangles;
+    uint8_t materialId = 0;
+};
+
+SynthMesh synthMesh(SynthRng& rng, const SynthOptions& options, uint32_t numVertices);
+
+// Serialised file pair.
+struct SynthFile
+{
+    std::vector<uint8_t> geom;
+    std::vector<uint8_t> mat;
+};
+
+SynthFile synthFile(const SynthOptions& options, uint32_t fileIndex, EdgeIndexStats* stats = nullptr);
+
+// Writes options.numFiles pairs into dir plus a corpus.txt list of the
+// .geom.edge paths. Returns the generated geom paths.
+std::vector<std::string> synthCorpus(const std::string& dir, const SynthOptions& options, EdgeIndexStats* stats = nullptr, uint64_t* totalBytes = nullptr);
+
+int synthMain(int argc, char* argv[]);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "geomparse_lib.h"
+
+// Vertex layouts known at compile time. Each attribute gets the next
+// offset aligned for its format and the stride is rounded up to the
+// largest alignment, like the equivalent struct would be. Passing
+// Layout::descriptor() to gpDecodeMesh selects a writer generated for
+// exactly that layout: the chunk's positions, normals and texture
+// coordinates are stored to each vertex in one pass, at constant offsets
+// and without looking at a format per vertex. A runtime layout that
+// happens to match one of the layouts below gets the same writer; any
+// other one takes the generic path.
+
+constexpr uint32_t vertexFormatSize(GpFormat format)
+{
+    return format == GP_FORMAT_FLOAT32 ? 4 : format == GP_FORMAT_FLOAT16 || format == GP_FORMAT_SNORM16 ? 2 : format == GP_FORMAT_SNORM8 ? 1 : 0;
+}
+
+constexpr uint32_t vertexAlign(uint32_t offset, uint32_t alignment)
+{
+    return alignment == 0 ? offset : (offset + alignment - 1) / alignment * alignment;
+}
+
+template <GpFormat Position, GpFormat Normal = GP_FORMAT_NONE, GpFormat TexCoord = GP_FORMAT_NONE>
+struct VertexLayout
+{
+    static const GpFormat POSITION_FORMAT = Position;
+    static const GpFormat NORMAL_FORMAT = Normal;
+    static const GpFormat TEXCOORD_FORMAT = TexCoord;
+
+    static const uint32_t POSITION_OFFSET = 0;
+    static const uint32_t NORMAL_OFFSET = vertexAlign(POSITION_OFFSET + vertexFormatSize(Position) * 3, vertexFormatSize(Normal));
+    static const uint32_t TEXCOORD_OFFSET = vertexAlign(NORMAL_OFFSET + vertexFormatSize(Normal) * 3, vertexFormatSize(TexCoord));
+    static const uint32_t ALIGNMENT = vertexFormatSize(Position) > vertexFormatSize(Normal) ?
+        (vertexFormatSize(Position) > vertexFormatSize(TexCoord) ? vertexFormatSize(Position) : vertexFormatSize(TexCoord)) :
+        (vertexFormatSize(Normal) > vertexFormatSize(TexCoord) ? vertexFormatSize(Normal) : vertexFormatSize(TexCoord));
+    static const uint32_t STRIDE = vertexAlign(TEXCOORD_OFFSET + vertexFormatSize(TexCoord) * 2, ALIGNMENT);
+
+    static_assert(Position != GP_FORMAT_NONE, "every layout has positions");
+    static_assert(Position != GP_FORMAT_SNORM16 && Position != GP_FORMAT_SNORM8, "normalized formats are for normals");
+    static_assert(TexCoord != GP_FORMAT_SNORM16 && TexCoord != GP_FORMAT_SNORM8, "normalized formats are for normals");
+
+    static GpVertexLayout descriptor()
+    {
+        GpVertexLayout layout = {};
+        layout.stride = STRIDE;
+        layout.elements[GP_ATTRIBUTE_POSITION].format = Position;
+        layout.elements[GP_ATTRIBUTE_POSITION].offset = POSITION_OFFSET;
+        layout.elements[GP_ATTRIBUTE_NORMAL].format = Normal;
+        layout.elements[GP_ATTRIBUTE_NORMAL].offset = Normal == GP_FORMAT_NONE ? 0 : NORMAL_OFFSET;
+        layout.elements[GP_ATTRIBUTE_TEXCOORD].format = TexCoord;
+        layout.elements[GP_ATTRIBUTE_TEXCOORD].offset = TexCoord == GP_FORMAT_NONE ? 0 : TEXCOORD_OFFSET;
+        return layout;
+    }
+};
+
+// The layouts the library has writers for.
+typedef VertexLayout<GP_FORMAT_FLOAT32> VertexLayoutP;
+typedef VertexLayout<GP_FORMAT_FLOAT32, GP_FORMAT_FLOAT32> VertexLayoutPN;
+typedef VertexLayout<GP_FORMAT_FLOAT32, GP_FORMAT_FLOAT32, GP_FORMAT_FLOAT32> VertexLayoutPNT;
+typedef VertexLayout<GP_FORMAT_FLOAT32, GP_FORMAT_FLOAT32, GP_FORMAT_FLOAT16> VertexLayoutPNTh;     // half UVs, 28 bytes
+typedef VertexLayout<GP_FORMAT_FLOAT32, GP_FORMAT_SNORM16, GP_FORMAT_FLOAT16> VertexLayoutPN16Th;  // 24 bytes
+typedef VertexLayout<GP_FORMAT_FLOAT32, GP_FORMAT_SNORM8, GP_FORMAT_FLOAT16> VertexLayoutPN8Th;    // 20 bytes
+typedef VertexLayout<GP_FORMAT_FLOAT16, GP_FORMAT_SNORM8, GP_FORMAT_FLOAT16> VertexLayoutPhN8Th;   // 14 bytes
+
+static_assert(VertexLayoutPNT::STRIDE == 32, "PNT layout");
+static_assert(VertexLayoutPN8Th::TEXCOORD_OFFSET == 16 && VertexLayoutPN8Th::STRIDE == 20, "PN8Th layout");
+static_assert(VertexLayoutPhN8Th::STRIDE == 14, "PhN8Th layout");
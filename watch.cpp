@@ -0,0 +1,296 @@
+#include "watch.hpp"
+#include "profile.hpp"
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int)
+{
+    g_stop = 1;
+}
+
+// The same file by any spelling the inputs or the events give it.
+static std::string corpusKey(const std::string& file)
+{
+    return std::filesystem::path(file).lexically_normal().generic_string();
+}
+
+static bool endsWith(const std::string& str, const std::string& suffix)
+{
+    return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+struct Watcher
+{
+    struct Dir
+    {
+        std::string prefix; // prepended to names, "" or ending in '/'
+        bool recursive = false;
+    };
+
+    int fd = -1;
+    std::unordered_map<int, Dir> dirs;
+    // Inputs named directly or in a list; in a directory that isn't
+    // watched recursively, only these count.
+    std::unordered_set<std::string> files;
+    std::set<std::string> pending;
+
+    ~Watcher()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool addDir(const std::string& prefix, bool recursive)
+    {
+        const uint32_t MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR;
+        int wd = inotify_add_watch(fd, prefix.empty() ? "." : prefix.c_str(), MASK);
+        if (wd < 0)
+        {
+            printf("Could not watch %s: %s\n", prefix.empty() ? "." : prefix.c_str(), strerror(errno));
+            return false;
+        }
+        Dir& dir = dirs[wd];
+        dir.prefix = prefix;
+        dir.recursive = dir.recursive || recursive;
+        return true;
+    }
+
+    // Watches dir and everything below it. With queue, the .geom.edge files
+    // already there are converted, for directories that appear while
+    // watching and may have been filled before their watch was added.
+    void addTree(const std::string& dir, bool queue)
+    {
+        addDir(dir + "/", true);
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            std::string name = it->path().generic_string();
+            if (it->is_directory(ec))
+                addDir(name + "/", true);
+            else if (queue && endsWith(name, ".geom.edge"))
+                pending.insert(name);
+        }
+    }
+
+    void changed(const Dir& dir, const std::string& name, bool isDir)
+    {
+        std::string path = dir.prefix + name;
+        if (isDir)
+        {
+            if (dir.recursive)
+                addTree(path, true);
+            return;
+        }
+
+        if (endsWith(path, ".mat.edge"))
+        {
+            // The Geom using this material, if there is one.
+            path = path.substr(0, path.size() - 8) + "geom.edge";
+            std::error_code ec;
+            if (!std::filesystem::is_regular_file(path, ec))
+                return;
+        }
+        else if (!endsWith(path, ".geom.edge"))
+        {
+            return;
+        }
+        if (dir.recursive || files.count(path))
+            pending.insert(path);
+    }
+
+    // Returns false when events were lost.
+    bool readEvents()
+    {
+        alignas(inotify_event) char buffer[16384];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return true;
+        bool complete = true;
+        for (char* p = buffer; p < buffer + n;)
+        {
+            const inotify_event* event = (const inotify_event*)p;
+            p += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                complete = false;
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                dirs.erase(event->wd);
+                continue;
+            }
+            auto it = dirs.find(event->wd);
+            if (it == dirs.end() || event->len == 0)
+                continue;
+            bool isDir = (event->mask & IN_ISDIR) != 0;
+            // A file is complete once closed after writing or moved in;
+            // for directories creation is what counts.
+            if (!isDir && (event->mask & IN_CREATE))
+                continue;
+            Dir dir = it->second; // addTree may rehash dirs
+            changed(dir, event->name, isDir);
+        }
+        return complete;
+    }
+};
+
+int watchInputs(const std::vector<std::string>& inputs, const std::vector<std::string>& corpus, const BatchOptions& options)
+{
+    // Quiet time that ends a burst of events, and the longest a change
+    // waits while events keep coming.
+    const uint64_t QUIET_NS = 25000000;
+    const uint64_t MAX_DELAY_NS = 250000000;
+
+    Watcher watcher;
+    watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.fd < 0)
+    {
+        printf("inotify unavailable: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // The workers start with the signals blocked, so they always land on
+    // this thread and interrupt poll().
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::unique_ptr<TaskScheduler> scheduler;
+    if (options.jobs > 1 && !options.pipeline && options.reader == ReaderKind::Sync)
+        scheduler.reset(new TaskScheduler(options.jobs));
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onSignal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    MaterialCache materials;
+    BatchOptions batch = options;
+    batch.scheduler = scheduler.get();
+    batch.materials = &materials;
+
+    std::unordered_map<std::string, uint32_t> corpusIndex;
+    for (uint32_t i = 0; i < (uint32_t)corpus.size(); ++i)
+        corpusIndex.emplace(corpusKey(corpus[i]), i);
+    uint32_t nextIndex = (uint32_t)corpus.size();
+
+    for (const std::string& input : inputs)
+    {
+        std::error_code ec;
+        if (std::filesystem::is_directory(input, ec))
+        {
+            std::string dir = input;
+            while (dir.size() > 1 && dir.back() == '/')
+                dir.pop_back();
+            watcher.addTree(dir, false);
+            continue;
+        }
+        std::vector<std::string> files;
+        collectInputs(input, files);
+        for (const std::string& file : files)
+        {
+            size_t slash = file.find_last_of('/');
+            watcher.addDir(slash == std::string::npos ? "" : file.substr(0, slash + 1), false);
+            watcher.files.insert(file);
+        }
+    }
+    printf("watching %zu directories, ctrl-c to stop\n", watcher.dirs.size());
+    fflush(stdout);
+
+    uint64_t firstEvent = 0;
+    uint64_t lastEvent = 0;
+    while (!g_stop)
+    {
+        int timeout = -1;
+        if (!watcher.pending.empty())
+        {
+            uint64_t deadline = std::min(lastEvent + QUIET_NS, firstEvent + MAX_DELAY_NS);
+            uint64_t now = profileNow();
+            timeout = deadline > now ? (int)((deadline - now + 999999) / 1000000) : 0;
+        }
+
+        pollfd pfd = { watcher.fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            printf("poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (ready > 0)
+        {
+            bool hadPending = !watcher.pending.empty();
+            if (!watcher.readEvents())
+            {
+                printf("inotify queue overflowed, rescanning the inputs\n");
+                std::vector<std::string> all;
+                for (const std::string& input : inputs)
+                    collectInputs(input, all);
+                watcher.pending.insert(all.begin(), all.end());
+            }
+            lastEvent = profileNow();
+            if (!hadPending)
+                firstEvent = lastEvent;
+        }
+
+        uint64_t now = profileNow();
+        if (watcher.pending.empty() || (now < lastEvent + QUIET_NS && now < firstEvent + MAX_DELAY_NS))
+            continue;
+
+        std::vector<std::string> files(watcher.pending.begin(), watcher.pending.end());
+        watcher.pending.clear();
+        batch.corpusIndices.clear();
+        for (const std::string& file : files)
+        {
+            auto it = corpusIndex.emplace(corpusKey(file), nextIndex).first;
+            if (it->second == nextIndex)
+                ++nextIndex;
+            batch.corpusIndices.push_back(it->second);
+        }
+        std::vector<FileResult> results = runBatch(files, batch);
+        uint32_t converted = 0;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            if (results[i].status == FileStatus::Converted)
+                ++converted;
+            else
+                printf("%s: %s\n", files[i].c_str(), fileStatusName(results[i].status));
+        }
+        printf("converted %u of %zu changed files in %.1f ms (%.1f ms after the first change)\n", converted, files.size(),
+            (profileNow() - now) / 1e6, (profileNow() - firstEvent) / 1e6);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+#else
+
+int watchInputs(const std::vector<std::string>&, const std::vector<std::string>&, const BatchOptions&)
+{
+    printf("--watch needs inotify, which this build doesn't support\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+
+// --watch: after the first batch, stay resident and convert inputs again as
+// they change. Directories given as inputs are watched recursively (new
+// subdirectories included), .geom.edge files given directly or in a list
+// through their directory. A written or moved-in .geom.edge is converted,
+// and so is the .geom.edge next to a .mat.edge that changed. Events are
+// collected until the inputs have been quiet for a moment, so a tool
+// writing a batch of files triggers one conversion. Only an overflowing
+// event queue makes it look at every input again. Linux only (inotify).
+// corpus is every file of the first batch before --shard, in order: a file
+// keeps its index there (see BatchOptions::corpusIndices) across batches,
+// and files that show up later get the next unused ones.
+int watchInputs(const std::vector<std::string>& inputs, const std::vector<std::string>& corpus, const BatchOptions& options);